@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace naive {
+
+// Counting Bloom filter over hash values: says "no" for most values that were never inserted,
+// and never for one that was. Supports erase, so it can follow a container's contents.
+//
+// Blocked: all probes for a value fall into one 64 byte block, so a query touches a single cache
+// line. A block holds 128 four-bit counters. A counter that reaches 15 sticks there and is never
+// decremented, which keeps erase from creating false negatives. Holding more values than the
+// capacity the filter was sized for raises the false positive rate; the owner resizes it.
+template <typename Allocator = std::allocator<uint8_t>>
+class CountingBloomFilter
+{
+public:
+    static constexpr size_t BlockBytes = 64;
+    static constexpr size_t BlockCounters = 2 * BlockBytes;
+    static constexpr unsigned MaxProbes = 9;
+    static constexpr uint8_t StuckCounter = 15;
+
+public:
+    CountingBloomFilter() = default;
+
+    explicit CountingBloomFilter(const Allocator& allocator) :
+        m_blocks(BlockAllocator(allocator))
+    { }
+
+public:
+    bool enabled() const
+    { return !m_blocks.empty(); }
+
+    size_t capacity() const
+    { return m_capacity; }
+
+    double false_positive_rate() const
+    { return m_false_positive_rate; }
+
+    // Size for `capacity` values at the given false positive rate. Drops all values
+    void reset(size_t capacity, double false_positive_rate)
+    {
+        m_capacity = std::max<size_t>(capacity, 64);
+        m_false_positive_rate = std::min(std::max(false_positive_rate, 1e-6), 0.5);
+
+        // Optimal Bloom filter: m = -n ln p / (ln 2)^2 counters, k = m / n ln 2 probes. A block
+        // concentrates the probes, so give it a bit more room than the formula asks for.
+        const double ln2 = std::log(2.0);
+        const double counters = 1.2 * m_capacity * -std::log(m_false_positive_rate) / (ln2 * ln2);
+        const double probes = std::round(counters / m_capacity * ln2 / 1.2);
+
+        m_probes = static_cast<unsigned>(std::min<double>(std::max(probes, 1.0), MaxProbes));
+        m_blocks.assign(static_cast<size_t>(std::ceil(counters / BlockCounters)), Block());
+    }
+
+    // Back to the disabled state, freeing the counters
+    void release()
+    {
+        m_blocks.clear();
+        m_blocks.shrink_to_fit();
+        m_capacity = 0;
+    }
+
+    // Forget all values, keeping the size
+    void clear()
+    { std::fill(m_blocks.begin(), m_blocks.end(), Block()); }
+
+    void insert(size_t hash)
+    {
+        Block& block = m_blocks[block_index(hash)];
+        for_each_probe(hash, [&](size_t counter) {
+            const uint8_t value = block.get(counter);
+            if (value != StuckCounter) {
+                block.set(counter, value + 1);
+            }
+        });
+    }
+
+    // The value must have been inserted
+    void erase(size_t hash)
+    {
+        Block& block = m_blocks[block_index(hash)];
+        for_each_probe(hash, [&](size_t counter) {
+            const uint8_t value = block.get(counter);
+            if (value != StuckCounter) {
+                block.set(counter, value - 1);
+            }
+        });
+    }
+
+    bool may_contain(size_t hash) const
+    {
+        const Block& block = m_blocks[block_index(hash)];
+        bool found = true;
+        for_each_probe(hash, [&](size_t counter) { found = found && block.get(counter) != 0; });
+        return found;
+    }
+
+    void swap(CountingBloomFilter& other) noexcept
+    {
+        m_blocks.swap(other.m_blocks);
+        std::swap(m_capacity, other.m_capacity);
+        std::swap(m_false_positive_rate, other.m_false_positive_rate);
+        std::swap(m_probes, other.m_probes);
+    }
+
+private:
+    struct alignas(BlockBytes) Block
+    {
+        uint8_t nibbles[BlockBytes] = {};
+
+        uint8_t get(size_t counter) const
+        { return (nibbles[counter / 2] >> (4 * (counter % 2))) & 0xF; }
+
+        void set(size_t counter, uint8_t value)
+        {
+            const unsigned shift = 4 * (counter % 2);
+            nibbles[counter / 2] = static_cast<uint8_t>((nibbles[counter / 2] & ~(0xF << shift)) | (value << shift));
+        }
+    };
+
+    using BlockAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Block>;
+
+    // Hash values from std::hash are often the key itself, so mix them before use
+    static uint64_t mix(uint64_t hash)
+    {
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    size_t block_index(size_t hash) const
+    { return static_cast<size_t>(mix(hash) % m_blocks.size()); }
+
+    // Counters within the block come from a second mix of the hash, 7 bits each
+    template <typename F>
+    void for_each_probe(size_t hash, F&& f) const
+    {
+        uint64_t bits = mix(hash ^ 0x9E3779B97F4A7C15ull);
+        for (unsigned i = 0; i < m_probes; ++i) {
+            f(static_cast<size_t>(bits % BlockCounters));
+            bits >>= 7;
+        }
+    }
+
+private:
+    std::vector<Block, BlockAllocator> m_blocks;
+    size_t   m_capacity            = 0;
+    double   m_false_positive_rate = 0.01;
+    unsigned m_probes              = 1;
+};
+
+} /*namespace naive*/
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace naive {
+
+// Index policies: a side table the tree keeps from keys to nodes, for lookups that skip the descent.
+// Policy::Table<Node, Allocator> is the table; the tree tells it about every node that is linked,
+// unlinked or moved.
+
+// No side table, lookups descend
+struct NoIndex
+{
+    template <typename Node, typename Allocator>
+    struct Table { };
+};
+
+// Open addressing hash table from key to node, with linear probing. Slots keep the hash next to
+// the node pointer, so a probe only looks at a node whose hash matches. Erasure shifts the
+// following entries back instead of leaving tombstones. At most 3/4 of the slots are in use.
+template <typename Hash>
+struct HashIndex
+{
+    template <typename Node, typename Allocator>
+    class Table
+    {
+    public:
+        Table() = default;
+
+        explicit Table(const Allocator& allocator) :
+            m_slots(SlotAllocator(allocator))
+        { }
+
+    public:
+        size_t size() const
+        { return m_size; }
+
+        size_t capacity() const
+        { return m_slots.size(); }
+
+        // Room for `count` nodes without growing
+        void reserve(size_t count)
+        {
+            if (count * 4 > m_slots.size() * 3) {
+                rehash(std::max<size_t>(capacity_for(count), 16));
+            }
+        }
+
+        // There is room for the node and no node with an equal key is in the table
+        void insert(Node* node)
+        {
+            const size_t hash = m_hash(node->key());
+            size_t slot = home(hash);
+            while (m_slots[slot].node != nullptr) {
+                slot = (slot + 1) & m_mask;
+            }
+
+            m_slots[slot] = Slot{node, hash};
+            ++m_size;
+        }
+
+        void erase(const Node* node)
+        {
+            size_t slot = home(m_hash(node->key()));
+            while (m_slots[slot].node != node) {
+                slot = (slot + 1) & m_mask;
+            }
+
+            // Move back every following entry whose home isn't between the hole and itself
+            for (size_t next = (slot + 1) & m_mask; m_slots[next].node != nullptr; next = (next + 1) & m_mask) {
+                const size_t next_home = home(m_slots[next].hash);
+                if (((next - next_home) & m_mask) >= ((next - slot) & m_mask)) {
+                    m_slots[slot] = m_slots[next];
+                    slot = next;
+                }
+            }
+
+            m_slots[slot] = Slot();
+            --m_size;
+        }
+
+        // The node whose key `equal` accepts, among those with the key's hash
+        template <typename K, typename Equal>
+        Node* find(const K& key, Equal&& equal) const
+        {
+            if (m_size == 0) {
+                return nullptr;
+            }
+
+            const size_t hash = m_hash(key);
+            for (size_t slot = home(hash); m_slots[slot].node != nullptr; slot = (slot + 1) & m_mask) {
+                if (m_slots[slot].hash == hash && equal(m_slots[slot].node)) {
+                    return m_slots[slot].node;
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Forget all nodes, keeping the slots
+        void clear()
+        {
+            std::fill(m_slots.begin(), m_slots.end(), Slot());
+            m_size = 0;
+        }
+
+        void swap(Table& other) noexcept
+        {
+            m_slots.swap(other.m_slots);
+            std::swap(m_mask, other.m_mask);
+            std::swap(m_shift, other.m_shift);
+            std::swap(m_size, other.m_size);
+            std::swap(m_hash, other.m_hash);
+        }
+
+    private:
+        struct Slot
+        {
+            Node*  node = nullptr;
+            size_t hash = 0;
+        };
+
+        using SlotAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Slot>;
+
+        static size_t capacity_for(size_t count)
+        {
+            size_t capacity = 1;
+            while (capacity * 3 < count * 4) {
+                capacity *= 2;
+            }
+            return capacity;
+        }
+
+        // Fibonacci hashing: std::hash of an integer is often the integer itself, the multiplication
+        // spreads it over the high bits
+        size_t home(size_t hash) const
+        { return static_cast<size_t>((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> m_shift); }
+
+        void rehash(size_t capacity)
+        {
+            std::vector<Slot, SlotAllocator> slots(capacity, Slot(), m_slots.get_allocator());
+            slots.swap(m_slots);
+            m_mask = capacity - 1;
+            m_shift = 64;
+            for (size_t i = capacity; i > 1; i /= 2) {
+                --m_shift;
+            }
+
+            for (const Slot& entry : slots) {
+                if (entry.node != nullptr) {
+                    size_t slot = home(entry.hash);
+                    while (m_slots[slot].node != nullptr) {
+                        slot = (slot + 1) & m_mask;
+                    }
+                    m_slots[slot] = entry;
+                }
+            }
+        }
+
+    private:
+        std::vector<Slot, SlotAllocator> m_slots;
+        size_t   m_mask  = 0;
+        unsigned m_shift = 64;
+        size_t   m_size  = 0;
+        Hash     m_hash;
+    };
+};
+
+} /*namespace naive*/
@@ -0,0 +1,314 @@
+#pragma once
+
+#include "RedBlackTree.h"
+
+namespace naive {
+
+// Hook embedded into objects stored in an IntrusiveMap: the links and colour of a tree node.
+//
+// T derives from IntrusiveMapHook<T>, so the object itself is the tree node and linking it into
+// a map allocates nothing. Copying an object does not copy its links, the copy starts unlinked.
+// The hook adds the Layout accessors and value() to T. An object can be in one map at a time.
+template <typename T, typename Layout = PlainLayout>
+class IntrusiveMapHook :
+    public NodeLinks<T, Layout>
+{
+    static_assert(!IsContiguousLayout<Layout>::value, "Hooks can't be kept in a node slab");
+    static_assert(!IsParentFreeLayout<Layout>::value, "Objects are erased without a search, through their parent links");
+
+public:
+    using ValueType = T;
+
+public:
+    IntrusiveMapHook() = default;
+
+    IntrusiveMapHook(const IntrusiveMapHook&) :
+        NodeLinks<T, Layout>()
+    { }
+
+    IntrusiveMapHook& operator=(const IntrusiveMapHook&)
+    { return *this; }
+
+public:
+    // The object the hook is embedded into, as iterators see it
+    const T& value() const
+    { return static_cast<const T&>(*this); }
+
+    T& value()
+    { return static_cast<T&>(*this); }
+};
+
+// Ordered container of objects it does not own, linked through their IntrusiveMapHook.
+//
+// KeyOfValue returns the key of an object: `const Key& operator()(const T&) const`. Keys of linked
+// objects must not change. Insertion and erasure never allocate, and erasing an object needs no
+// search. Objects must outlive their membership; the map unlinks whatever is left when it goes away.
+template <typename Key, typename T, typename KeyOfValue>
+class IntrusiveMap :
+    private RedBlackTreeBase<T>
+{
+public:
+    using ValueType            = T;
+    using Iterator             = naive::Iterator<IntrusiveMap>;
+    using ConstIterator        = naive::ConstIterator<IntrusiveMap>;
+    using ReverseIterator      = naive::ReverseIterator<IntrusiveMap>;
+    using ReverseConstIterator = naive::ReverseConstIterator<IntrusiveMap>;
+
+private:
+    using TreeNode = T;
+    using Base     = RedBlackTreeBase<T>;
+    using Base::m_root;
+    using Base::m_size;
+    using Base::m_min_node;
+    using Base::m_max_node;
+
+public:
+    IntrusiveMap() = default;
+
+    explicit IntrusiveMap(const KeyOfValue& key_of) :
+        m_key_of(key_of)
+    { }
+
+    IntrusiveMap(const IntrusiveMap&) = delete;
+    IntrusiveMap& operator=(const IntrusiveMap&) = delete;
+
+    IntrusiveMap(IntrusiveMap&& map) noexcept :
+        Base(std::move(map)),
+        m_key_of(map.m_key_of)
+    { }
+
+    IntrusiveMap& operator=(IntrusiveMap&& map) noexcept
+    {
+        clear();
+        swap(map);
+        return *this;
+    }
+
+    ~IntrusiveMap()
+    { clear(); }
+
+public:
+    // Iterators
+
+    Iterator begin()
+    { return Iterator(this, m_min_node); }
+    Iterator end()
+    { return Iterator(this, nullptr); }
+
+    ConstIterator cbegin() const
+    { return ConstIterator(this, m_min_node); }
+    ConstIterator cend() const
+    { return ConstIterator(this, nullptr); }
+
+    ReverseIterator rbegin()
+    { return ReverseIterator(this, m_max_node); }
+    ReverseIterator rend()
+    { return ReverseIterator(this, nullptr); }
+
+    ReverseConstIterator rcbegin() const
+    { return ReverseIterator(this, m_max_node); }
+    ReverseConstIterator rcend() const
+    { return ReverseIterator(this, nullptr); }
+
+    // Iterator to an object linked into this map
+    Iterator iterator_to(T& object)
+    { return Iterator(this, &object); }
+
+    ConstIterator iterator_to(const T& object) const
+    { return ConstIterator(this, const_cast<T*>(&object)); }
+
+public:
+    // Capacity
+
+    bool empty() const
+    { return m_size == 0; }
+
+    size_t size() const
+    { return m_size; }
+
+public:
+    // Modifiers
+
+    // Unlinks all objects
+    void clear()
+    {
+        if (m_root != nullptr) {
+            do_clear(m_root);
+        }
+        this->reset();
+    }
+
+    // Links the object unless an object with the same key is in the map already
+    Pair<Iterator, bool> insert(T& object)
+    {
+        const Key& key = m_key_of(object);
+
+        TreeNode* candidate = nullptr;
+        TreeNode* parent = nullptr;
+        bool right = false;
+        TreeNode* node = m_root;
+        while (node != nullptr) {
+            right = !(key < m_key_of(*node));
+            if (right) {
+                candidate = node;
+            }
+
+            parent = node;
+            node = node->child(right);
+        }
+
+        if (candidate != nullptr && !(m_key_of(*candidate) < key)) {
+            return MakePair(Iterator(this, candidate), false);
+        }
+
+        this->link_node(parent, right, &object);
+        return MakePair(Iterator(this, &object), true);
+    }
+
+    // Unlinks the object, which must be in this map. Returns the iterator following it
+    Iterator erase(T& object)
+    {
+        Iterator next(this, &object);
+        ++next;
+
+        this->unlink_node(&object);
+        reset_hook(&object);
+        return next;
+    }
+
+    Iterator erase(ConstIterator pos)
+    { return erase(*pos.m_current); }
+
+    size_t erase(const Key& key)
+    {
+        TreeNode* node = do_find(key);
+        if (node == nullptr) {
+            return 0;
+        }
+
+        erase(*node);
+        return 1;
+    }
+
+    void swap(IntrusiveMap& other) noexcept
+    {
+        if (&other != this) {
+            std::swap(m_key_of, other.m_key_of);
+            this->swap_nodes(other);
+        }
+    }
+
+public:
+    // Lookup
+
+    size_t count(const Key& key) const
+    { return (do_find(key) != nullptr) ? 1 : 0; }
+
+    ConstIterator find(const Key& key) const
+    { return ConstIterator(this, do_find(key)); }
+
+    Iterator find(const Key& key)
+    { return Iterator(this, do_find(key)); }
+
+    Iterator lower_bound(const Key& key)
+    { return Iterator(this, do_lower_bound(key)); }
+
+    ConstIterator lower_bound(const Key& key) const
+    { return ConstIterator(this, do_lower_bound(key)); }
+
+    Iterator upper_bound(const Key& key)
+    { return Iterator(this, do_upper_bound(key)); }
+
+    ConstIterator upper_bound(const Key& key) const
+    { return ConstIterator(this, do_upper_bound(key)); }
+
+private:
+    TreeNode* do_find(const Key& key) const
+    {
+        TreeNode* node = m_root;
+        TreeNode* candidate = nullptr;
+        while (node != nullptr) {
+            if (key < m_key_of(*node)) {
+                node = node->left_child();
+            } else {
+                candidate = node;
+                node = node->right_child();
+            }
+        }
+
+        return (candidate != nullptr && !(m_key_of(*candidate) < key)) ? candidate : nullptr;
+    }
+
+    TreeNode* do_lower_bound(const Key& key) const
+    {
+        TreeNode* node = m_root;
+        TreeNode* bound = nullptr;
+
+        while (node != nullptr) {
+            if (!(m_key_of(*node) < key)) {
+                bound = node;
+                node = node->left_child();
+            } else {
+                node = node->right_child();
+            }
+        }
+
+        return bound;
+    }
+
+    TreeNode* do_upper_bound(const Key& key) const
+    {
+        TreeNode* node = m_root;
+        TreeNode* bound = nullptr;
+
+        while (node != nullptr) {
+            if (key < m_key_of(*node)) {
+                bound = node;
+                node = node->left_child();
+            } else {
+                node = node->right_child();
+            }
+        }
+
+        return bound;
+    }
+
+    void do_clear(TreeNode* node)
+    {
+        if (node->left_child() != nullptr) {
+            do_clear(node->left_child());
+        }
+
+        if (node->right_child() != nullptr) {
+            do_clear(node->right_child());
+        }
+
+        reset_hook(node);
+    }
+
+    static void reset_hook(TreeNode* node)
+    {
+        node->set_parent(nullptr);
+        node->set_left_child(nullptr);
+        node->set_right_child(nullptr);
+        node->set_red_color();
+    }
+
+private:
+    template <typename U>
+    friend class BaseIterator;
+
+    TreeNode* get_last() const
+    { return m_max_node; }
+
+private:
+    KeyOfValue m_key_of;
+};
+
+template <typename Key, typename T, typename KeyOfValue>
+void swap(IntrusiveMap<Key, T, KeyOfValue>& lhs, IntrusiveMap<Key, T, KeyOfValue>& rhs)
+{
+    lhs.swap(rhs);
+}
+
+} /*namespace naive*/
@@ -7,22 +7,45 @@
 
 namespace naive {
 
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Allocator = std::allocator<Pair<const Key, Value>>, typename Layout = PlainLayout,
+          typename Compare = std::less<Key>, typename Index = NoIndex>
 class Map :
-    public RedBlackTree<Key, Value>
+    public RedBlackTree<Key, Value, Allocator, Layout, Compare, Index>
 {
 public:
-    using Tree                 = RedBlackTree<Key, Value>;
-    using ValueType            = Tree::ValueType;
-    using Iterator             = Tree::Iterator;
-    using ConstIterator        = Tree::ConstIterator;
-    using ReverseIterator      = Tree::ReverseIterator;
-    using ReverseConstIterator = Tree::ReverseConstIterator;
+    using Tree                 = RedBlackTree<Key, Value, Allocator, Layout, Compare, Index>;
+    using ValueType            = typename Tree::ValueType;
+    using AllocatorType        = typename Tree::AllocatorType;
+    using CompareType          = typename Tree::CompareType;
+    using Iterator             = typename Tree::Iterator;
+    using ConstIterator        = typename Tree::ConstIterator;
+    using ReverseIterator      = typename Tree::ReverseIterator;
+    using ReverseConstIterator = typename Tree::ReverseConstIterator;
+    using InsertPosition       = typename Tree::InsertPosition;
+    using BatchOpType          = BatchOp<Key, Value>;
+
+private:
+    // Lookups by other types than Key need a transparent comparator
+    template <typename K>
+    using EnableTransparent = std::enable_if_t<IsTransparentCompare<Compare, K>::value>;
+
+    // Erasing by such a key must not be picked for erasing at an iterator
+    template <typename K>
+    using EnableTransparentErase = std::enable_if_t<IsTransparentCompare<Compare, K>::value &&
+                                                    !std::is_convertible<const K&, ConstIterator>::value>;
 
 public:
     // Construct, destruct, assign
     Map() = default;
 
+    explicit Map(const Allocator& allocator) :
+        Tree(allocator)
+    { }
+
+    explicit Map(const Compare& compare, const Allocator& allocator = Allocator()) :
+        Tree(compare, allocator)
+    { }
+
     Map(const Map& map) :
         Tree(map)
     { }
@@ -31,14 +54,15 @@ public:
         Tree(std::move(map))
     { }
 
+    // Sorted input without equal keys is recognized and built from in linear time
     template<class InputIt>
-    Map(InputIt first, InputIt last) :
-        Tree()
-    { insert(first, last); }
+    Map(InputIt first, InputIt last, const Allocator& allocator = Allocator()) :
+        Tree(allocator)
+    { Tree::assign_range(first, last); }
 
-    Map(std::initializer_list<ValueType> init) :
-        Tree()
-    { insert(init); }
+    Map(std::initializer_list<ValueType> init, const Allocator& allocator = Allocator()) :
+        Tree(allocator)
+    { Tree::assign_range(init.begin(), init.end()); }
 
     ~Map() = default;
 
@@ -57,35 +81,56 @@ public:
     Map& operator=(std::initializer_list<ValueType> ilist)
     {
         clear();
-        insert(ilist);
+        Tree::assign_range(ilist.begin(), ilist.end());
         return *this;
     }
 
+    // Builds the map from a range sorted by key without equal keys, in linear time
+    template <class ForwardIt>
+    static Map from_sorted(ForwardIt first, ForwardIt last, const Allocator& allocator = Allocator())
+    {
+        Map map(allocator);
+        map.assign_sorted(first, last);
+        return map;
+    }
+
+    // Replaces the contents with a range sorted by key without equal keys, in linear time
+    template <class ForwardIt>
+    void assign_sorted(ForwardIt first, ForwardIt last)
+    { Tree::assign_sorted(first, last); }
+
+    // Replaces the contents with a range in any order, sorting it and building the tree on up to
+    // `threads` threads (0: one per core). Of elements with equal keys, the first or the last one
+    // in the range is kept.
+    template <class ForwardIt>
+    void bulk_load(ForwardIt first, ForwardIt last, unsigned threads = 0, DuplicateKeys duplicates = DuplicateKeys::KeepFirst)
+    { Tree::bulk_load(first, last, threads, duplicates); }
+
 public:
     // Element access
     Value& at(const Key& key)
     {
-        TreeNode* node = do_find(key);
-        if (node == nullptr) {
+        auto it = find(key);
+        if (it == end()) {
             throw std::out_of_range("");
         }
-        return node->value();
+        return it->second;
     }
 
     const Value& at(const Key& key) const
     {
-        TreeNode* node = do_find(key);
-        if (node == nullptr) {
+        auto it = find(key);
+        if (it == cend()) {
             throw std::out_of_range("");
         }
-        return node->value();
+        return it->second;
     }
 
     Value& operator[](const Key& key)
-    { return (emplace(key, Value()).first)->second; }
+    { return try_emplace(key).first->second; }
 
     Value& operator[](Key&& key)
-    { return (emplace(std::forward<Key>(key), Value()).first)->second; }
+    { return try_emplace(std::move(key)).first->second; }
 
 public:
     // Iterators
@@ -119,6 +164,44 @@ public:
     size_t size() const
     { return Tree::size(); }
 
+    void reserve(size_t count)
+    { Tree::reserve(count); }
+
+    void shrink_to_fit()
+    { Tree::shrink_to_fit(); }
+
+    AllocatorType get_allocator() const
+    { return Tree::get_allocator(); }
+
+    CompareType key_comp() const
+    { return Tree::key_comp(); }
+
+    // Let find() and count() check the last few found elements before searching the tree.
+    // Lookups then modify the container: don't turn it on for one searched by several threads.
+    void enable_find_cache(bool enable = true)
+    { Tree::enable_find_cache(enable); }
+
+    bool find_cache_enabled() const
+    { return Tree::find_cache_enabled(); }
+
+    FindCacheStats find_cache_stats() const
+    { return Tree::find_cache_stats(); }
+
+    // Reject most lookups of absent keys with a counting Bloom filter of the keys instead of a
+    // descent. Needs std::hash<Key>; the filter is kept up to date by every modification.
+    void enable_filter(double false_positive_rate = 0.01)
+    { Tree::enable_filter(false_positive_rate); }
+
+    void disable_filter()
+    { Tree::disable_filter(); }
+
+    bool filter_enabled() const
+    { return Tree::filter_enabled(); }
+
+    // Checks the tree's invariants and the index and filter entries, walking every element
+    bool verify() const
+    { return Tree::verify(); }
+
 public:
     // Modifiers
 
@@ -161,26 +244,99 @@ public:
     Pair<Iterator, bool> emplace(Args && ... args)
     { return Tree::emplace(std::forward<Args>(args)...); }
 
+    // Inserts without a search when the element belongs right before the hint, e.g. appending
+    // increasing keys with end() as the hint. Otherwise the hint is ignored.
     template <typename ... Args>
     Pair<Iterator, bool> emplace_hint(ConstIterator hint, Args && ... args)
     { return Tree::emplace_hint(hint, std::forward<Args>(args)...); }
 
+    // Inserts (key, Value(args...)) if the key is missing. For a present key nothing is constructed
+    // and the arguments are left alone.
+    template <typename ... Args>
+    Pair<Iterator, bool> try_emplace(const Key& key, Args && ... args)
+    { return Tree::try_emplace(key, std::forward<Args>(args)...); }
+
+    template <typename ... Args>
+    Pair<Iterator, bool> try_emplace(Key&& key, Args && ... args)
+    { return Tree::try_emplace(std::move(key), std::forward<Args>(args)...); }
+
+    // Assigns the value if the key is present, inserts (key, value) otherwise. One search either way
+    template <typename V>
+    Pair<Iterator, bool> insert_or_assign(const Key& key, V&& value)
+    { return Tree::insert_or_assign(key, std::forward<V>(value)); }
+
+    template <typename V>
+    Pair<Iterator, bool> insert_or_assign(Key&& key, V&& value)
+    { return Tree::insert_or_assign(std::move(key), std::forward<V>(value)); }
+
+    // Merges the value into the one mapped to the key, or inserts (key, value) if there's none.
+    // combine(Value& mapped, V&& value) updates the mapped value in place, e.g. for counters:
+    //
+    //     counts.upsert(key, n, [](uint64_t& count, uint64_t n) { count += n; });
+    template <typename V, typename Combine>
+    Pair<Iterator, bool> upsert(const Key& key, V&& value, Combine&& combine)
+    { return Tree::upsert(key, std::forward<V>(value), std::forward<Combine>(combine)); }
+
+    template <typename V, typename Combine>
+    Pair<Iterator, bool> upsert(Key&& key, V&& value, Combine&& combine)
+    { return Tree::upsert(std::move(key), std::forward<V>(value), std::forward<Combine>(combine)); }
+
+    // Lookup for a key that may be inserted next: when it's missing, the iterator is end() and the
+    // position tells emplace_at() where to link the element, saving the second search.
+    //
+    //     auto [it, position] = map.find_or_position(key);
+    //     if (it == map.end()) {
+    //         it = map.emplace_at(position, key, make_value()).first;
+    //     }
+    Pair<Iterator, InsertPosition> find_or_position(const Key& key)
+    { return Tree::find_or_position(key); }
+
+    // The element must have the key the position was found for. If the map has been modified since,
+    // the position is not used and the key is searched for again.
+    template <typename ... Args>
+    Pair<Iterator, bool> emplace_at(InsertPosition position, Args && ... args)
+    { return Tree::emplace_at(position, std::forward<Args>(args)...); }
+
+    // Applies a batch of upserts and erasures sorted by key, as a replication stream sends them,
+    // in one walk over the tree: each key is found from the previous one's position. Pass move
+    // iterators to move the keys and values in.
+    //
+    //     map.apply_batch({{BatchAction::Upsert, 3, "c"}, {BatchAction::Erase, 5, {}}});
+    template <typename ForwardIt>
+    void apply_batch(ForwardIt first, ForwardIt last)
+    { Tree::apply_batch(first, last); }
+
+    void apply_batch(std::initializer_list<BatchOpType> ops)
+    { Tree::apply_batch(ops.begin(), ops.end()); }
+
+    template <typename Ops>
+    void apply_batch(const Ops& ops)
+    { Tree::apply_batch(std::begin(ops), std::end(ops)); }
+
     Iterator erase(Iterator pos)
     { return Tree::erase(pos); }
 
     Iterator erase(ConstIterator pos)
     { return Tree::erase(pos); }
 
+    // Cuts the range out of the tree and joins the rest back: O(log n), plus freeing the elements
     Iterator erase(ConstIterator first, ConstIterator last)
+    { return Tree::erase(first, last); }
+
+    size_t erase(const Key& key)
     {
-        while (first != last) {
-            first = erase(first);
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
         }
 
-        return first;
+        erase(it);
+        return 1;
     }
 
-    size_t erase(const Key& key)
+    // Heterogeneous erasure, e.g. by std::string_view with std::less<>
+    template <typename K, typename = EnableTransparentErase<K>>
+    size_t erase(const K& key)
     {
         auto it = find(key);
         if (it == end()) {
@@ -191,9 +347,73 @@ public:
         return 1;
     }
 
+    // Erases the elements with keys from `lower` up to, not including, `upper`. Returns how many
+    // there were. O(log n) plus freeing them; to free them later, or on another thread, cut() the
+    // range instead and drop the result when convenient.
+    size_t erase(const Key& lower, const Key& upper)
+    { return Tree::erase_range(lower, upper); }
+
+    // Erases the elements for which pred(element) is true and returns how many there were, see
+    // also erase_if(map, pred). Rebuilds the tree in linear time when many of them go.
+    template <typename Predicate>
+    size_t erase_if(Predicate pred)
+    { return Tree::erase_if(pred); }
+
+    // Moves the elements with keys from `key` on into the returned map. O(log n) plus a walk of
+    // the smaller part, to count it. Elements of contiguous layouts, and of maps whose allocators
+    // compare unequal, are moved one by one.
+    Map split(const Key& key)
+    {
+        Map map(key_comp(), get_allocator());
+        Tree::move_range(lower_bound(key), end(), map);
+        return map;
+    }
+
+    // Moves the elements with keys from `lower` up to, not including, `upper` into the returned
+    // map, in the time split() takes
+    Map cut(const Key& lower, const Key& upper)
+    {
+        Map map(key_comp(), get_allocator());
+        if (key_comp()(lower, upper)) {
+            Tree::move_range(lower_bound(lower), lower_bound(upper), map);
+        }
+        return map;
+    }
+
+    // Appends the elements of `map`, whose keys must all be greater than those here, leaving it
+    // empty. O(log n) when its nodes can be taken over, see split().
+    void join(Map& map)
+    { Tree::join(map); }
+
+    // Set operations, leaving `map` empty. When the maps share an allocator and the layout isn't
+    // contiguous, the nodes move between them and the work is O(m log(n/m + 1)) for sizes m <= n,
+    // split over up to `threads` threads (0: one per core). Otherwise each element is looked up
+    // in the other map with a finger search. Comparisons and `merge` must not throw; `merge` may
+    // run on several threads at once.
+
+    // Moves the elements of `map` here. merge(value here, value there as an rvalue) combines the
+    // mapped values of a key in both
+    template <typename Merge = KeepLeftValue>
+    void unite(Map& map, Merge merge = Merge(), unsigned threads = 0)
+    {
+        static_assert(!std::is_arithmetic_v<Merge>, "Pass KeepLeftValue() as the merge to give a thread count alone");
+        Tree::unite(map, merge, threads);
+    }
+
+    // Keeps the elements whose keys are in `map` too
+    void intersect(Map& map, unsigned threads = 0)
+    { Tree::intersect(map, threads); }
+
+    // Erases the elements whose keys are in `map`
+    void subtract(Map& map, unsigned threads = 0)
+    { Tree::subtract(map, threads); }
+
     void swap(Map& other) noexcept
     { Tree::swap(other); }
 
+    void compact(CompactOrder order = CompactOrder::VanEmdeBoas)
+    { Tree::compact(order); }
+
 public:
     // Lookup
 
@@ -224,12 +444,96 @@ public:
     ConstIterator upper_bound(const Key& key) const
     { return Tree::upper_bound(key); }
 
+    // Finger search, starting from an element close to the key rather than from the root
+
+    Iterator find(ConstIterator hint, const Key& key)
+    { return Tree::find(hint, key); }
+
+    ConstIterator find(ConstIterator hint, const Key& key) const
+    { return Tree::find(hint, key); }
+
+    Iterator lower_bound(ConstIterator hint, const Key& key)
+    { return Tree::lower_bound(hint, key); }
+
+    ConstIterator lower_bound(ConstIterator hint, const Key& key) const
+    { return Tree::lower_bound(hint, key); }
+
+    // Heterogeneous lookup, e.g. by std::string_view in a Map<std::string, V, ..., std::less<>>
+
+    template <typename K, typename = EnableTransparent<K>>
+    size_t count(const K& key) const
+    { return Tree::count(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator find(const K& key) const
+    { return Tree::find(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    Iterator find(const K& key)
+    { return Tree::find(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    Pair<Iterator, Iterator> equal_range(const K& key)
+    { return Tree::equal_range(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    Pair<ConstIterator, ConstIterator> equal_range(const K& key) const
+    { return Tree::equal_range(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    Iterator lower_bound(const K& key)
+    { return Tree::lower_bound(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator lower_bound(const K& key) const
+    { return Tree::lower_bound(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    Iterator upper_bound(const K& key)
+    { return Tree::upper_bound(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator upper_bound(const K& key) const
+    { return Tree::upper_bound(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    Iterator find(ConstIterator hint, const K& key)
+    { return Tree::find(hint, key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator find(ConstIterator hint, const K& key) const
+    { return Tree::find(hint, key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    Iterator lower_bound(ConstIterator hint, const K& key)
+    { return Tree::lower_bound(hint, key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator lower_bound(ConstIterator hint, const K& key) const
+    { return Tree::lower_bound(hint, key); }
+
+    // Batched lookup of many keys, of Key or of a type the transparent comparator accepts.
+    // out[i] is find(first[i]); the descents are interleaved to overlap their cache misses.
+
+    template <typename ForwardIt, typename RandomIt>
+    void find_many(ForwardIt first, ForwardIt last, RandomIt out)
+    { Tree::find_many(first, last, out); }
+
+    template <typename ForwardIt, typename RandomIt>
+    void find_many(ForwardIt first, ForwardIt last, RandomIt out) const
+    { Tree::find_many(first, last, out); }
+
+    // How many of the keys are in the container
+    template <typename ForwardIt>
+    size_t count_many(ForwardIt first, ForwardIt last) const
+    { return Tree::count_many(first, last); }
+
 private:
-    using TreeNode = Tree::TreeNode;
+    using TreeNode = typename Tree::TreeNode;
 };
 
-template<typename Key, typename Value>
-bool operator==(const Map<Key, Value>& lhs, const Map<Key, Value>& rhs)
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+bool operator==(const Map<Key, Value, Allocator, Layout, Compare, Index>& lhs, const Map<Key, Value, Allocator, Layout, Compare, Index>& rhs)
 {
     if (lhs.size() != rhs.size()) {
         return false;
@@ -248,40 +552,80 @@ bool operator==(const Map<Key, Value>& lhs, const Map<Key, Value>& rhs)
     return true;
 }
 
-template<typename Key, typename Value>
-bool operator!=(const Map<Key, Value>& lhs, const Map<Key, Value>& rhs)
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+bool operator!=(const Map<Key, Value, Allocator, Layout, Compare, Index>& lhs, const Map<Key, Value, Allocator, Layout, Compare, Index>& rhs)
 {
     return !operator==(lhs, rhs);
 }
 
-template<typename Key, typename Value>
-bool operator<(const Map<Key, Value>& lhs, const Map<Key, Value>& rhs)
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+bool operator<(const Map<Key, Value, Allocator, Layout, Compare, Index>& lhs, const Map<Key, Value, Allocator, Layout, Compare, Index>& rhs)
 {
     return std::lexicographical_compare(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend());
 }
 
-template<typename Key, typename Value>
-bool operator<=(const Map<Key, Value>& lhs, const Map<Key, Value>& rhs)
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+bool operator<=(const Map<Key, Value, Allocator, Layout, Compare, Index>& lhs, const Map<Key, Value, Allocator, Layout, Compare, Index>& rhs)
 {
     return !operator<(rhs, lhs);
 }
 
-template<typename Key, typename Value>
-bool operator>(const Map<Key, Value>& lhs, const Map<Key, Value>& rhs)
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+bool operator>(const Map<Key, Value, Allocator, Layout, Compare, Index>& lhs, const Map<Key, Value, Allocator, Layout, Compare, Index>& rhs)
 {
     return operator<(rhs, lhs);
 }
 
-template<typename Key, typename Value>
-bool operator>=(const Map<Key, Value>& lhs, const Map<Key, Value>& rhs)
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+bool operator>=(const Map<Key, Value, Allocator, Layout, Compare, Index>& lhs, const Map<Key, Value, Allocator, Layout, Compare, Index>& rhs)
 {
     return !operator<(lhs, rhs);
 }
 
-template<typename Key, typename Value>
-void swap(Map<Key, Value>& lhs, Map<Key, Value>& rhs)
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+void swap(Map<Key, Value, Allocator, Layout, Compare, Index>& lhs, Map<Key, Value, Allocator, Layout, Compare, Index>& rhs)
 {
     lhs.swap(rhs);
 }
 
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index, typename Predicate>
+size_t erase_if(Map<Key, Value, Allocator, Layout, Compare, Index>& map, Predicate pred)
+{
+    return map.erase_if(pred);
+}
+
+// Set operations as functions of two maps, see Map::unite(). The maps are taken by value: pass
+// them with std::move to let the result reuse their nodes.
+
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index, typename Merge = KeepLeftValue>
+Map<Key, Value, Allocator, Layout, Compare, Index> map_union(Map<Key, Value, Allocator, Layout, Compare, Index> lhs, Map<Key, Value, Allocator, Layout, Compare, Index> rhs,
+                                                             Merge merge = Merge(), unsigned threads = 0)
+{
+    lhs.unite(rhs, merge, threads);
+    return lhs;
+}
+
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+Map<Key, Value, Allocator, Layout, Compare, Index> map_intersection(Map<Key, Value, Allocator, Layout, Compare, Index> lhs, Map<Key, Value, Allocator, Layout, Compare, Index> rhs,
+                                                                    unsigned threads = 0)
+{
+    lhs.intersect(rhs, threads);
+    return lhs;
+}
+
+template<typename Key, typename Value, typename Allocator, typename Layout, typename Compare, typename Index>
+Map<Key, Value, Allocator, Layout, Compare, Index> map_difference(Map<Key, Value, Allocator, Layout, Compare, Index> lhs, Map<Key, Value, Allocator, Layout, Compare, Index> rhs,
+                                                                  unsigned threads = 0)
+{
+    lhs.subtract(rhs, threads);
+    return lhs;
+}
+
+// Map that also keeps a hash table from keys to nodes: find(), count() and at() by Key take one
+// hash probe instead of a descent, ordered operations still use the tree. Costs a slot of two
+// words per 3/4 element and a hash table update on every insertion and erasure.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename Allocator = std::allocator<Pair<const Key, Value>>,
+          typename Layout = PlainLayout, typename Compare = std::less<Key>>
+using IndexedMap = Map<Key, Value, Allocator, Layout, Compare, HashIndex<Hash>>;
+
 } /*namespace naive*/
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace naive {
+
+// Node layout policies.
+//
+// A layout decides how a tree node stores its links (parent, left and right child) and its colour.
+// TreeNode derives from Layout::Links<TreeNode>, and the tree only talks to the links through
+// the accessors below, so the layout can be picked at compile time without touching the algorithms.
+
+// Three pointers and a separate colour flag. With padding it is 32 bytes on 64-bit platforms.
+struct PlainLayout
+{
+    template <typename Node>
+    class Links
+    {
+    public:
+        Node* parent() const
+        { return m_parent; }
+
+        void set_parent(Node* parent)
+        { m_parent = parent; }
+
+        Node* left_child() const
+        { return m_left_child; }
+
+        void set_left_child(Node* child)
+        { m_left_child = child; }
+
+        Node* right_child() const
+        { return m_right_child; }
+
+        void set_right_child(Node* child)
+        { m_right_child = child; }
+
+        // Lets descents pick a side without a branch
+        Node* child(bool right) const
+        { return right ? m_right_child : m_left_child; }
+
+        void set_color(bool black)
+        { m_black = black; }
+
+        void set_black_color()
+        { m_black = true; }
+
+        void set_red_color()
+        { m_black = false; }
+
+        bool is_black() const
+        { return m_black; }
+
+        bool is_red() const
+        { return !m_black; }
+
+    private:
+        Node* m_parent = nullptr;
+        Node* m_left_child = nullptr;
+        Node* m_right_child = nullptr;
+        bool  m_black = false;
+    };
+};
+
+// The colour lives in the lowest bit of the parent pointer, which is always zero for an aligned node.
+// Saves a word per node: 24 bytes of links on 64-bit platforms.
+struct PackedColorLayout
+{
+    template <typename Node>
+    class Links
+    {
+    public:
+        Node* parent() const
+        { return reinterpret_cast<Node*>(m_parent_and_color & ~ColorMask); }
+
+        void set_parent(Node* parent)
+        {
+            static_assert(alignof(Node) > ColorMask, "Node alignment leaves no room for the colour bit");
+            m_parent_and_color = reinterpret_cast<uintptr_t>(parent) | (m_parent_and_color & ColorMask);
+        }
+
+        Node* left_child() const
+        { return m_left_child; }
+
+        void set_left_child(Node* child)
+        { m_left_child = child; }
+
+        Node* right_child() const
+        { return m_right_child; }
+
+        void set_right_child(Node* child)
+        { m_right_child = child; }
+
+        // Lets descents pick a side without a branch
+        Node* child(bool right) const
+        { return right ? m_right_child : m_left_child; }
+
+        void set_color(bool black)
+        { m_parent_and_color = (m_parent_and_color & ~ColorMask) | (black ? ColorMask : 0); }
+
+        void set_black_color()
+        { m_parent_and_color |= ColorMask; }
+
+        void set_red_color()
+        { m_parent_and_color &= ~ColorMask; }
+
+        bool is_black() const
+        { return (m_parent_and_color & ColorMask) != 0; }
+
+        bool is_red() const
+        { return (m_parent_and_color & ColorMask) == 0; }
+
+    private:
+        static constexpr uintptr_t ColorMask = 1;
+
+        uintptr_t m_parent_and_color = 0;
+        Node*     m_left_child = nullptr;
+        Node*     m_right_child = nullptr;
+    };
+};
+
+// No parent link at all: the colour lives in the lowest bit of the left child pointer, 16 bytes of
+// links on 64-bit platforms. Whoever needs the ancestors of a node keeps them on a path from the
+// root instead. Iterators carry that path, so they are large, and linking or unlinking any node may
+// rotate the ancestors of others: like in a vector, every insertion and erasure invalidates
+// iterators. Insertion and erasure descend once more to find the path, finger searches and hints
+// start from the root.
+struct ParentFreeLayout
+{
+    static constexpr bool ParentFree = true;
+
+    template <typename Node>
+    class Links
+    {
+    public:
+        // Nodes are created with a parent, it isn't stored
+        void set_parent(Node*)
+        { }
+
+        Node* left_child() const
+        { return reinterpret_cast<Node*>(m_left_and_color & ~ColorMask); }
+
+        void set_left_child(Node* child)
+        {
+            static_assert(alignof(Node) > ColorMask, "Node alignment leaves no room for the colour bit");
+            m_left_and_color = reinterpret_cast<uintptr_t>(child) | (m_left_and_color & ColorMask);
+        }
+
+        Node* right_child() const
+        { return m_right_child; }
+
+        void set_right_child(Node* child)
+        { m_right_child = child; }
+
+        // Lets descents pick a side without a branch
+        Node* child(bool right) const
+        { return right ? m_right_child : left_child(); }
+
+        void set_color(bool black)
+        { m_left_and_color = (m_left_and_color & ~ColorMask) | (black ? ColorMask : 0); }
+
+        void set_black_color()
+        { m_left_and_color |= ColorMask; }
+
+        void set_red_color()
+        { m_left_and_color &= ~ColorMask; }
+
+        bool is_black() const
+        { return (m_left_and_color & ColorMask) != 0; }
+
+        bool is_red() const
+        { return (m_left_and_color & ColorMask) == 0; }
+
+    private:
+        static constexpr uintptr_t ColorMask = 1;
+
+        uintptr_t m_left_and_color = 0;
+        Node*     m_right_child = nullptr;
+    };
+};
+
+// Links are 32-bit offsets from the node itself, counted in nodes, and the colour is packed into
+// the parent offset: 12 bytes of links on any platform. An offset only means something inside
+// one array, so a tree with this layout keeps all its nodes in a single slab (see NodeSlab.h).
+// No absolute address is stored, which lets the slab be moved or copied with memcpy.
+struct IndexLayout
+{
+    static constexpr bool Contiguous = true;
+
+    // Parent offsets lose a bit to the colour
+    static constexpr size_t MaxNodes = size_t(1) << 30;
+
+    template <typename Node>
+    class Links
+    {
+    public:
+        Node* parent() const
+        { return node_at(static_cast<int32_t>(m_parent_and_color) >> 1); }
+
+        void set_parent(Node* parent)
+        { m_parent_and_color = (static_cast<uint32_t>(offset_of(parent)) << 1) | (m_parent_and_color & ColorMask); }
+
+        Node* left_child() const
+        { return node_at(m_left_child); }
+
+        void set_left_child(Node* child)
+        { m_left_child = offset_of(child); }
+
+        Node* right_child() const
+        { return node_at(m_right_child); }
+
+        void set_right_child(Node* child)
+        { m_right_child = offset_of(child); }
+
+        // Lets descents pick a side without a branch
+        Node* child(bool right) const
+        { return node_at(right ? m_right_child : m_left_child); }
+
+        void set_color(bool black)
+        { m_parent_and_color = (m_parent_and_color & ~ColorMask) | (black ? ColorMask : 0); }
+
+        void set_black_color()
+        { m_parent_and_color |= ColorMask; }
+
+        void set_red_color()
+        { m_parent_and_color &= ~ColorMask; }
+
+        bool is_black() const
+        { return (m_parent_and_color & ColorMask) != 0; }
+
+        bool is_red() const
+        { return (m_parent_and_color & ColorMask) == 0; }
+
+    private:
+        static constexpr uint32_t ColorMask = 1;
+
+        Node* self() const
+        { return const_cast<Node*>(static_cast<const Node*>(this)); }
+
+        // A node never links to itself, so offset 0 stands for nullptr
+        Node* node_at(int32_t offset) const
+        { return (offset != 0) ? self() + offset : nullptr; }
+
+        int32_t offset_of(const Node* node) const
+        { return (node != nullptr) ? static_cast<int32_t>(node - self()) : 0; }
+
+    private:
+        uint32_t m_parent_and_color = 0;
+        int32_t  m_left_child = 0;
+        int32_t  m_right_child = 0;
+    };
+};
+
+// Splits every node in two: the links and a copy of the key stay in a compact "hot" node, while the
+// element (key and mapped value) goes to a separate "cold" allocation that is only read when an
+// iterator is dereferenced. Lookups then pull in many more keys per cache line.
+//
+// Applies to elements of at least MinValueSize bytes, so the split can be forced (0) or chosen
+// by element size (see AutoColdValueLayout). Links are stored as in Base. Keys must be copyable.
+template <typename Base = PlainLayout, size_t MinValueSize = 0>
+struct ColdValueLayout :
+    Base
+{
+    template <typename ValueType>
+    static constexpr bool ColdValue = sizeof(ValueType) >= MinValueSize;
+};
+
+// Splits elements that do not fit into a cache line
+template <typename Base = PlainLayout>
+using AutoColdValueLayout = ColdValueLayout<Base, 64>;
+
+template <typename Layout, typename ValueType, typename = void>
+struct IsColdValueLayout :
+    std::false_type
+{ };
+
+template <typename Layout, typename ValueType>
+struct IsColdValueLayout<Layout, ValueType, std::void_t<decltype(Layout::template ColdValue<ValueType>)>> :
+    std::bool_constant<Layout::template ColdValue<ValueType>>
+{ };
+
+// Stores the bytes of a std::string_view key right behind the node, in the same allocation, and keeps
+// the key as a view of them: no second allocation per key, and comparisons read memory next to the
+// links. The node is allocated as a run of whole node slots. Links are stored as in Base, which must
+// not be contiguous.
+template <typename Base = PlainLayout>
+struct InlineKeyLayout :
+    Base
+{
+    static constexpr bool InlineKey = true;
+};
+
+template <typename Layout, typename = void>
+struct IsInlineKeyLayout :
+    std::false_type
+{ };
+
+template <typename Layout>
+struct IsInlineKeyLayout<Layout, std::void_t<decltype(Layout::InlineKey)>> :
+    std::bool_constant<Layout::InlineKey>
+{ };
+
+// Caches an order-preserving prefix of string-like keys in every node: the first 8 bytes as a big-endian
+// integer, zero-padded. When the prefixes of two keys differ, one integer comparison orders them and
+// the key bytes are not read. Keys must convert to std::string_view. Links are stored as in Base.
+template <typename Base = PlainLayout>
+struct KeyPrefixLayout :
+    Base
+{
+    static constexpr bool KeyPrefix = true;
+};
+
+template <typename Layout, typename = void>
+struct IsKeyPrefixLayout :
+    std::false_type
+{ };
+
+template <typename Layout>
+struct IsKeyPrefixLayout<Layout, std::void_t<decltype(Layout::KeyPrefix)>> :
+    std::bool_constant<Layout::KeyPrefix>
+{ };
+
+// Layouts without parent links
+template <typename Layout, typename = void>
+struct IsParentFreeLayout :
+    std::false_type
+{ };
+
+template <typename Layout>
+struct IsParentFreeLayout<Layout, std::void_t<decltype(Layout::ParentFree)>> :
+    std::bool_constant<Layout::ParentFree>
+{ };
+
+// Layouts with index links keep all nodes of a tree in one slab
+template <typename Layout, typename = void>
+struct IsContiguousLayout :
+    std::false_type
+{ };
+
+template <typename Layout>
+struct IsContiguousLayout<Layout, std::void_t<decltype(Layout::Contiguous)>> :
+    std::bool_constant<Layout::Contiguous>
+{ };
+
+} /*namespace naive*/
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace naive {
+
+// Size-class pool for fixed-size objects such as tree nodes.
+//
+// Requests are rounded up to a multiple of Granularity bytes and served from the free list of
+// their size class. Object sizes are multiples of their alignment, so slots of a class keep the
+// alignment of the objects stored in it. Free lists are refilled from big blocks, so erasing and
+// inserting again recycles the very same memory without going to the general purpose allocator.
+// Requests that are too big or over-aligned go straight to operator new.
+//
+// The pool is not thread safe.
+class NodePool
+{
+public:
+    static constexpr size_t Granularity   = sizeof(void*);
+    static constexpr size_t MaxClassSize  = 512;
+    static constexpr size_t ClassCount    = MaxClassSize / Granularity;
+    static constexpr size_t MinBlockSlots = 64;
+    static constexpr size_t MaxBlockSlots = 64 * 1024;
+
+public:
+    NodePool() = default;
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool()
+    {
+        for (const Block& block : m_blocks) {
+            ::operator delete(block.data);
+        }
+    }
+
+public:
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        if (!is_pooled(size, alignment)) {
+            return ::operator new(size, std::align_val_t(alignment));
+        }
+
+        SizeClass& size_class = m_classes[class_index(size)];
+        if (size_class.free_list == nullptr) {
+            add_block(class_index(size), std::clamp(size_class.capacity, MinBlockSlots, MaxBlockSlots));
+        }
+
+        FreeSlot* slot = size_class.free_list;
+        size_class.free_list = slot->next;
+        --size_class.free_count;
+        return slot;
+    }
+
+    void deallocate(void* p, size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        if (!is_pooled(size, alignment)) {
+            ::operator delete(p, std::align_val_t(alignment));
+            return;
+        }
+
+        SizeClass& size_class = m_classes[class_index(size)];
+        size_class.free_list = new (p) FreeSlot{size_class.free_list};
+        ++size_class.free_count;
+    }
+
+    // Make sure that `count` objects of `size` bytes can be allocated without touching operator new
+    void reserve(size_t size, size_t count, size_t alignment = alignof(std::max_align_t))
+    {
+        if (!is_pooled(size, alignment)) {
+            return;
+        }
+
+        const size_t index = class_index(size);
+        if (m_classes[index].free_count < count) {
+            add_block(index, count - m_classes[index].free_count);
+        }
+    }
+
+    // Add a block of `count` adjacent slots that are handed out, in address order, before any other free slot
+    void reserve_contiguous(size_t size, size_t count, size_t alignment = alignof(std::max_align_t))
+    {
+        if (is_pooled(size, alignment) && count != 0) {
+            add_block(class_index(size), count);
+        }
+    }
+
+    // Give back every block none of whose slots is in use
+    void shrink_to_fit()
+    {
+        std::sort(m_blocks.begin(), m_blocks.end(),
+            [](const Block& lhs, const Block& rhs) { return lhs.data < rhs.data; });
+
+        // Count free slots per block
+        std::vector<size_t> free_slots(m_blocks.size(), 0);
+        for (const SizeClass& size_class : m_classes) {
+            for (FreeSlot* slot = size_class.free_list; slot != nullptr; slot = slot->next) {
+                ++free_slots[find_block(slot)];
+            }
+        }
+
+        std::vector<bool> released(m_blocks.size(), false);
+        bool any_released = false;
+        for (size_t i = 0; i < m_blocks.size(); ++i) {
+            released[i] = (free_slots[i] == m_blocks[i].slots);
+            any_released = any_released || released[i];
+        }
+
+        if (!any_released) {
+            return;
+        }
+
+        // Unlink slots of released blocks from the free lists
+        for (SizeClass& size_class : m_classes) {
+            FreeSlot** link = &size_class.free_list;
+            while (*link != nullptr) {
+                if (released[find_block(*link)]) {
+                    *link = (*link)->next;
+                    --size_class.free_count;
+                } else {
+                    link = &(*link)->next;
+                }
+            }
+        }
+
+        std::vector<Block> kept;
+        for (size_t i = 0; i < m_blocks.size(); ++i) {
+            if (released[i]) {
+                m_classes[m_blocks[i].class_index].capacity -= m_blocks[i].slots;
+                ::operator delete(m_blocks[i].data);
+            } else {
+                kept.push_back(m_blocks[i]);
+            }
+        }
+        m_blocks.swap(kept);
+    }
+
+    // Number of objects of `size` bytes the pool can hold without growing
+    size_t capacity(size_t size) const
+    { return (size <= MaxClassSize) ? m_classes[class_index(size)].capacity : 0; }
+
+    // Total number of bytes currently owned by the pool
+    size_t allocated_bytes() const
+    {
+        size_t bytes = 0;
+        for (const Block& block : m_blocks) {
+            bytes += block.slots * slot_size(block.class_index);
+        }
+        return bytes;
+    }
+
+private:
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    struct SizeClass
+    {
+        FreeSlot* free_list = nullptr;
+        size_t    free_count = 0;
+        size_t    capacity = 0;
+    };
+
+    struct Block
+    {
+        char*  data;
+        size_t slots;
+        size_t class_index;
+    };
+
+private:
+    static bool is_pooled(size_t size, size_t alignment)
+    { return size <= MaxClassSize && alignment <= alignof(std::max_align_t); }
+
+    static size_t class_index(size_t size)
+    { return (std::max(size, sizeof(FreeSlot)) + Granularity - 1) / Granularity - 1; }
+
+    static size_t slot_size(size_t index)
+    { return (index + 1) * Granularity; }
+
+    void add_block(size_t index, size_t slots)
+    {
+        const size_t size = slot_size(index);
+        char* data = static_cast<char*>(::operator new(slots * size));
+        m_blocks.push_back(Block{data, slots, index});
+
+        // Thread the new slots in address order so that consecutive allocations are adjacent
+        SizeClass& size_class = m_classes[index];
+        for (size_t i = slots; i > 0; --i) {
+            size_class.free_list = new (data + (i - 1) * size) FreeSlot{size_class.free_list};
+        }
+        size_class.free_count += slots;
+        size_class.capacity += slots;
+    }
+
+    // m_blocks must be sorted by address
+    size_t find_block(const void* p) const
+    {
+        auto it = std::upper_bound(m_blocks.begin(), m_blocks.end(), static_cast<const char*>(p),
+            [](const char* address, const Block& block) { return address < block.data; });
+        return static_cast<size_t>(it - m_blocks.begin()) - 1;
+    }
+
+private:
+    SizeClass          m_classes[ClassCount];
+    std::vector<Block> m_blocks;
+};
+
+// Standard allocator on top of NodePool.
+//
+// Rebound copies (e.g. the node allocator of a Map) share the pool of the original.
+// Copy-constructed containers get a pool of their own, so two maps never share free lists.
+template <typename T>
+class PoolAllocator
+{
+public:
+    template <typename U>
+    friend class PoolAllocator;
+
+    using value_type                             = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+
+public:
+    PoolAllocator() :
+        m_pool(std::make_shared<NodePool>())
+    { }
+
+    PoolAllocator(const PoolAllocator&) = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept :
+        m_pool(other.m_pool)
+    { }
+
+    PoolAllocator& operator=(const PoolAllocator&) = default;
+
+public:
+    T* allocate(size_t n)
+    { return static_cast<T*>(m_pool->allocate(n * sizeof(T), alignof(T))); }
+
+    void deallocate(T* p, size_t n)
+    { m_pool->deallocate(p, n * sizeof(T), alignof(T)); }
+
+    PoolAllocator select_on_container_copy_construction() const
+    { return PoolAllocator(); }
+
+    void reserve(size_t n)
+    { m_pool->reserve(sizeof(T), n, alignof(T)); }
+
+    void reserve_contiguous(size_t n)
+    { m_pool->reserve_contiguous(sizeof(T), n, alignof(T)); }
+
+    void shrink_to_fit()
+    { m_pool->shrink_to_fit(); }
+
+    const NodePool& pool() const
+    { return *m_pool; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const
+    { return m_pool == other.m_pool; }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const
+    { return m_pool != other.m_pool; }
+
+private:
+    std::shared_ptr<NodePool> m_pool;
+};
+
+} /*namespace naive*/
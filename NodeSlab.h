@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace naive {
+
+// Contiguous node storage for layouts whose links only make sense inside one array (IndexLayout).
+//
+// Works like a vector with a free list: erased slots are handed out again before the slab grows.
+// Growing moves every node to a new array at the same index, so links stay valid but pointers
+// and iterators into the tree don't; the owner has to rebase them (see index_of() and node_at()).
+template <typename Node, typename Allocator>
+class NodeSlab
+{
+public:
+    using AllocatorTraits = std::allocator_traits<Allocator>;
+
+    // Nodes can be moved or copied byte-wise
+    static constexpr bool TriviallyRelocatable = std::is_trivially_copy_constructible_v<Node> &&
+                                                 std::is_trivially_destructible_v<Node>;
+
+    static constexpr size_t NoSlot = size_t(-1);
+
+public:
+    NodeSlab() = default;
+
+    NodeSlab(const NodeSlab&) = delete;
+    NodeSlab& operator=(const NodeSlab&) = delete;
+
+    NodeSlab(NodeSlab&& slab) noexcept
+    { swap(slab); }
+
+public:
+    size_t capacity() const
+    { return m_capacity; }
+
+    bool full() const
+    { return m_free_head == NoSlot && m_used == m_capacity; }
+
+    // Uninitialized slot for one node. The slab must not be full
+    Node* allocate()
+    {
+        if (m_free_head != NoSlot) {
+            Node* node = m_nodes + m_free_head;
+            m_free_head = next_free(m_free_head);
+            return node;
+        }
+
+        return m_nodes + m_used++;
+    }
+
+    // Slot of an already destroyed node
+    void deallocate(Node* node)
+    {
+        const size_t index = node - m_nodes;
+        new (static_cast<void*>(node)) uint32_t(static_cast<uint32_t>(m_free_head));
+        m_free_head = index;
+    }
+
+    // Forget all slots. Nodes must have been destroyed already
+    void clear()
+    {
+        m_used = 0;
+        m_free_head = NoSlot;
+    }
+
+    size_t index_of(const Node* node) const
+    { return (node != nullptr) ? static_cast<size_t>(node - m_nodes) : NoSlot; }
+
+    Node* node_at(size_t index) const
+    { return (index != NoSlot) ? m_nodes + index : nullptr; }
+
+    // Move all nodes into an array of `capacity` slots
+    void reallocate(Allocator& allocator, size_t capacity, size_t max_capacity)
+    {
+        if (capacity > max_capacity) {
+            throw std::length_error("NodeSlab: too many nodes");
+        }
+
+        capacity = std::max(capacity, m_used);
+        Node* nodes = (capacity != 0) ? AllocatorTraits::allocate(allocator, capacity) : nullptr;
+
+        if constexpr (TriviallyRelocatable) {
+            if (m_used != 0) {
+                std::memcpy(static_cast<void*>(nodes), static_cast<const void*>(m_nodes), m_used * sizeof(Node));
+            }
+        } else {
+            std::vector<bool> free_slots(m_used, false);
+            for (size_t slot = m_free_head; slot != NoSlot; slot = next_free(slot)) {
+                free_slots[slot] = true;
+                new (static_cast<void*>(nodes + slot)) uint32_t(static_cast<uint32_t>(next_free(slot)));
+            }
+
+            for (size_t i = 0; i < m_used; ++i) {
+                if (!free_slots[i]) {
+                    AllocatorTraits::construct(allocator, nodes + i, std::move(m_nodes[i]));
+                    AllocatorTraits::destroy(allocator, m_nodes + i);
+                }
+            }
+        }
+
+        if (m_nodes != nullptr) {
+            AllocatorTraits::deallocate(allocator, m_nodes, m_capacity);
+        }
+        m_nodes = nodes;
+        m_capacity = capacity;
+    }
+
+    // Byte-wise copy of another slab. This slab must hold no nodes
+    void copy_from(Allocator& allocator, const NodeSlab& slab, size_t max_capacity)
+    {
+        static_assert(TriviallyRelocatable, "Nodes have to be copied one by one");
+
+        if (m_capacity < slab.m_used) {
+            clear();
+            reallocate(allocator, slab.m_used, max_capacity);
+        }
+
+        if (slab.m_used != 0) {
+            std::memcpy(static_cast<void*>(m_nodes), static_cast<const void*>(slab.m_nodes), slab.m_used * sizeof(Node));
+        }
+        m_used = slab.m_used;
+        m_free_head = slab.m_free_head;
+    }
+
+    // Give the array back. The slab must hold no nodes
+    void release(Allocator& allocator)
+    {
+        if (m_nodes != nullptr) {
+            AllocatorTraits::deallocate(allocator, m_nodes, m_capacity);
+        }
+        m_nodes = nullptr;
+        m_capacity = 0;
+        clear();
+    }
+
+    void swap(NodeSlab& other) noexcept
+    {
+        std::swap(m_nodes, other.m_nodes);
+        std::swap(m_capacity, other.m_capacity);
+        std::swap(m_used, other.m_used);
+        std::swap(m_free_head, other.m_free_head);
+    }
+
+private:
+    size_t next_free(size_t slot) const
+    {
+        const uint32_t next = *std::launder(reinterpret_cast<const uint32_t*>(m_nodes + slot));
+        return (next != static_cast<uint32_t>(NoSlot)) ? next : NoSlot;
+    }
+
+private:
+    Node*  m_nodes = nullptr;
+    size_t m_capacity = 0;
+    size_t m_used = 0;        // Slots ever handed out, the free ones are chained from m_free_head
+    size_t m_free_head = NoSlot;
+};
+
+} /*namespace naive*/
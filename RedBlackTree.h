@@ -1,71 +1,139 @@
 #pragma once
 
-#include <xtree>
-
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "HashIndex.h"
+#include "NodeLayout.h"
+#include "NodeSlab.h"
 #include "Utility.h"
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
 namespace naive {
 
 // TODO: dependent names
 
+// Element stored by a tree: the key with its mapped value, or for sets (Value = void) the key alone
 template <typename Key, typename Value>
-class TreeNode
+struct TreeElement
 {
-public:
-    using ValueType = Pair<const Key, Value>;
+    using Type = Pair<const Key, Value>;
 
-public:
-    TreeNode() = default;
+    static const Key& key(const Type& element)
+    { return element.first; }
+};
 
-    TreeNode(TreeNode* parent, Key&& key, Value&& value) :
-        m_parent(parent),
-        m_value(std::forward<Key>(key), std::forward<Value>(value))
-    {
-    }
+template <typename Key>
+struct TreeElement<Key, void>
+{
+    using Type = Key;
 
-    template <typename ... Args>
-    TreeNode(TreeNode* parent, Args && ... args) :
-        m_parent(parent),
-        m_value(std::forward<Args>(args)...)
-    {
-    }
+    static const Key& key(const Type& element)
+    { return element; }
+};
 
-public:
-    TreeNode* parent() const
-    { return m_parent; }
+// Finds the key among the arguments that construct an element, so that the tree can be searched
+// before anything is built. Args are the argument types without references and cv-qualifiers.
+template <typename Key, bool IsMap, typename ... Args>
+struct KeyExtractor
+{
+    static constexpr bool Extractable = false;
+};
+
+// Sets: the key itself
+template <typename Key>
+struct KeyExtractor<Key, false, Key>
+{
+    static constexpr bool Extractable = true;
+
+    static const Key& extract(const Key& key)
+    { return key; }
+};
 
-    TreeNode*& parent()
-    { return m_parent; }
+// Maps: the key and the mapped value
+template <typename Key, typename Second>
+struct KeyExtractor<Key, true, Key, Second>
+{
+    static constexpr bool Extractable = true;
+
+    static const Key& extract(const Key& key, const Second&)
+    { return key; }
+};
+
+// Maps: an element, or another pair with the key first
+template <typename Key, typename First, typename Second>
+struct KeyExtractor<Key, true, Pair<First, Second>>
+{
+    static constexpr bool Extractable = std::is_same_v<std::remove_cv_t<First>, Key>;
 
-    TreeNode* left_child() const
-    { return m_left_child; }
+    static const Key& extract(const Pair<First, Second>& element)
+    { return element.first; }
+};
 
-    TreeNode*& left_child()
-    { return m_left_child; }
+// Maps: piecewise construction, with the key as the only argument for the first member
+template <typename Key, typename K, typename ... ValueArgs>
+struct KeyExtractor<Key, true, PiecewiseConstructT, std::tuple<K>, std::tuple<ValueArgs...>>
+{
+    static constexpr bool Extractable = std::is_same_v<std::remove_cv_t<std::remove_reference_t<K>>, Key>;
 
-    TreeNode* right_child() const
-    { return m_right_child; }
+    static const Key& extract(const PiecewiseConstructT&, const std::tuple<K>& key, const std::tuple<ValueArgs...>&)
+    { return std::get<0>(key); }
+};
 
-    TreeNode*& right_child()
-    { return m_right_child; }
+// Arguments that aren't the key, but whose first one builds a key on its own: for maps the first
+// of a key and a mapped value, for sets the only argument. Args keep their references.
+template <typename Key, bool IsMap, typename ... Args>
+struct KeyConverter
+{
+    static constexpr bool Convertible = false;
+};
 
-    void set_color(bool black)
-    { m_black = black; }
+template <typename Key, typename K, typename V>
+struct KeyConverter<Key, true, K, V>
+{
+    static constexpr bool Convertible = std::is_constructible_v<Key, K>;
+};
 
-    void set_black_color()
-    { m_black = true; }
+template <typename Key, typename K>
+struct KeyConverter<Key, false, K>
+{
+    static constexpr bool Convertible = std::is_constructible_v<Key, K>;
+};
 
-    void set_red_color()
-    { m_black = false; }
+// Element of a tree node, stored in place
+template <typename Key, typename Value, bool Cold>
+class NodeStorage
+{
+public:
+    using ValueType = typename TreeElement<Key, Value>::Type;
 
-    bool is_black() const
-    { return m_black; }
+public:
+    NodeStorage() = default;
 
-    bool is_red() const
-    { return !m_black; }
+    template <typename ... Args>
+    explicit NodeStorage(Args && ... args) :
+        m_value(std::forward<Args>(args)...)
+    { }
 
+public:
     const Key& key() const
-    { return m_value.first; }
+    { return TreeElement<Key, Value>::key(m_value); }
 
     const ValueType& value() const
     { return m_value; }
@@ -73,702 +141,3746 @@ public:
     ValueType& value()
     { return m_value; }
 
-public:
-    TreeNode* uncle() const
-    {
-        const TreeNode* grand_parent = m_parent->m_parent;
-        return (grand_parent->m_left_child == m_parent) ? grand_parent->m_right_child
-                                                        : grand_parent->m_left_child;
-    }
-
-    TreeNode* grandparent() const
-    { return m_parent->m_parent; }
-
-    TreeNode* sibling() const
-    {
-        if (m_parent == nullptr) {
-            return nullptr;
-        }
-
-        return (m_parent->m_right_child == this) ? m_parent->m_left_child
-                                                 : m_parent->m_right_child;
-    }
-
 private:
-    TreeNode* m_parent = nullptr;
-    TreeNode* m_left_child = nullptr;
-    TreeNode* m_right_child = nullptr;
-    bool m_black = false;
-
     ValueType m_value;
 };
 
+// Element of a tree node, stored in a separate cold allocation owned by the tree.
+// The node keeps a copy of the key, so descents never touch the element.
 template <typename Key, typename Value>
-typename TreeNode<Key, Value>* find_min(TreeNode<Key, Value>* node)
+class NodeStorage<Key, Value, true>
 {
-    while (node->left_child() != nullptr) {
-        node = node->left_child();
-    }
+public:
+    using ValueType = typename TreeElement<Key, Value>::Type;
 
-    return node;
-}
+public:
+    explicit NodeStorage(ValueType* value) :
+        m_key(TreeElement<Key, Value>::key(*value)),
+        m_value(value)
+    { }
 
-template <typename Key, typename Value>
-typename TreeNode<Key, Value>* find_max(TreeNode<Key, Value>* node)
-{
-    while (node->right_child() != nullptr) {
-        node = node->right_child();
-    }
+public:
+    const Key& key() const
+    { return m_key; }
 
-    return node;
-}
+    const ValueType& value() const
+    { return *m_value; }
 
+    ValueType& value()
+    { return *m_value; }
 
-template <typename Key, typename Value>
-class BaseIterator
+    ValueType* cold_value() const
+    { return m_value; }
+
+private:
+    Key        m_key;
+    ValueType* m_value;
+};
+
+// Element of a tree node with an InlineKeyLayout. The key is a view of the bytes the tree stores
+// behind the node; the other constructor arguments are those of an element, whose key is ignored.
+template <typename Value>
+class InlineKeyStorage
 {
 public:
-    template <typename K, typename V>
-    friend class RedBlackTree;
+    using ValueType = typename TreeElement<std::string_view, Value>::Type;
 
 public:
-    using RedBlackTree = RedBlackTree<Key, Value>;
-    using TreeNode     = TreeNode<Key, Value>;
-    using ValueType    = typename TreeNode::ValueType;
+    template <typename K, typename V>
+    InlineKeyStorage(std::string_view key, K&&, V&& value) :
+        m_value(key, std::forward<V>(value))
+    { }
 
-public:
-    BaseIterator() = default;
+    template <typename P>
+    InlineKeyStorage(std::string_view key, P&& element) :
+        m_value(key, std::forward<P>(element).second)
+    { }
 
-    explicit BaseIterator(const RedBlackTree* tree, TreeNode* current) :
-        m_tree(tree),
-        m_current(current),
-        m_end(current == nullptr)
+    template <typename ... KeyArgs, typename ... ValueArgs>
+    InlineKeyStorage(std::string_view key, PiecewiseConstructT, std::tuple<KeyArgs...>, std::tuple<ValueArgs...> value_args) :
+        m_value(PiecewiseConstructT(), std::forward_as_tuple(key), std::move(value_args))
     { }
 
 public:
-    const ValueType& operator*() const
-    { return m_current->value(); }
+    const std::string_view& key() const
+    { return m_value.first; }
 
-    const ValueType* operator->() const
-    { return &(m_current->value()); }
+    const ValueType& value() const
+    { return m_value; }
 
-    BaseIterator& operator++()
-    {
-        if (m_current->right_child() != nullptr) {
-            m_current = find_min(m_current->right_child());
-            return *this;
-        }
+    ValueType& value()
+    { return m_value; }
 
-        while (m_current->parent() != nullptr && m_current == m_current->parent()->right_child()) {
-            m_current = m_current->parent();
-        }
+private:
+    ValueType m_value;
+};
 
-        if (m_current->parent()) {
-            m_current = m_current->parent();
-            return *this;
-        }
+template <>
+class InlineKeyStorage<void>
+{
+public:
+    using ValueType = std::string_view;
 
-        m_current = nullptr;
-        m_end = true;
-        return *this;
-    }
+public:
+    template <typename ... Args>
+    explicit InlineKeyStorage(std::string_view key, Args && ...) :
+        m_value(key)
+    { }
 
-    BaseIterator& operator--()
-    {
-        if (m_end) {
-            m_current = m_tree->get_last();
-            m_end = false;
-        }
+public:
+    const std::string_view& key() const
+    { return m_value; }
 
-        if (m_current->left_child() != nullptr) {
-            m_current = find_max(m_current->left_child());
-            return *this;
-        }
+    const ValueType& value() const
+    { return m_value; }
 
-        while (m_current->parent() != nullptr && m_current == m_current->parent()->left_child()) {
-            m_current = m_current->parent();
-        }
+    ValueType& value()
+    { return m_value; }
 
-        if (m_current->parent() != nullptr) {
-            m_current = m_current->parent();
-            return *this;
-        }
+private:
+    ValueType m_value;
+};
 
-        m_current = nullptr;
-        m_end = true;
-        return *this;
-    }
+template <typename Key, typename Value, typename Layout>
+using NodeStorageFor = std::conditional_t<IsInlineKeyLayout<Layout>::value,
+    InlineKeyStorage<Value>,
+    NodeStorage<Key, Value, IsColdValueLayout<Layout, typename TreeElement<Key, Value>::Type>::value>>;
 
-    bool operator==(const BaseIterator& it)
-    { return m_current == it.m_current; }
-    bool operator!=(const BaseIterator& it)
-    { return !operator==(it); }
+// Order-preserving prefix of a key for KeyPrefixLayout: if key_prefix(a) < key_prefix(b) then a < b
+inline uint64_t key_prefix(std::string_view key)
+{
+    unsigned char bytes[sizeof(uint64_t)] = {};
+    std::memcpy(bytes, key.data(), std::min(key.size(), sizeof(bytes)));
 
-protected:
-    const RedBlackTree* m_tree = nullptr;
-    TreeNode* m_current = nullptr;
-    bool      m_end = false;
-};
+    uint64_t prefix = 0;
+    for (unsigned char byte : bytes) {
+        prefix = (prefix << 8) | byte;
+    }
+    return prefix;
+}
 
-template <typename Key, typename Value>
-class Iterator :
-    public BaseIterator<Key, Value>
+// Cached key prefix of a node, empty unless the layout asks for it
+template <bool Enabled>
+class NodeKeyPrefix
+{ };
+
+template <>
+class NodeKeyPrefix<true>
 {
 public:
-    template <typename K, typename V>
-    friend class RedBlackTree;
+    uint64_t prefix() const
+    { return m_prefix; }
 
-public:
-    using RedBlackTree = RedBlackTree<Key, Value>;
-    using BaseIterator<Key, Value>::TreeNode;
-    using BaseIterator<Key, Value>::ValueType;
+protected:
+    void set_prefix(uint64_t prefix)
+    { m_prefix = prefix; }
+
+private:
+    uint64_t m_prefix = 0;
+};
 
+// Comparator of a tree. Empty comparators take no room (empty base optimization).
+template <typename Compare, bool = std::is_empty_v<Compare> && !std::is_final_v<Compare>>
+class CompareHolder
+{
 public:
-    Iterator() = default;
+    CompareHolder() = default;
 
-    explicit Iterator(const RedBlackTree* tree, TreeNode* current) :
-        BaseIterator<Key, Value>(tree, current)
+    explicit CompareHolder(const Compare& compare) :
+        m_compare(compare)
     { }
 
 public:
-    ValueType& operator*()
-    { return this->m_current->value(); }
-
-    ValueType* operator->()
-    { return &(this->m_current->value()); }
-
-    Iterator& operator++()
-    {
-        BaseIterator<Key, Value>::operator++();
-        return *this;
-    }
-
-    Iterator operator++(int)
-    {
-        Iterator it = *this;
-        BaseIterator<Key, Value>::operator++();
-        return it;
-    }
+    const Compare& compare() const
+    { return m_compare; }
 
-    Iterator& operator--()
-    {
-        BaseIterator<Key, Value>::operator--();
-        return *this;
-    }
+    void swap_compare(CompareHolder& other)
+    { std::swap(m_compare, other.m_compare); }
 
-    Iterator operator--(int)
-    {
-        Iterator it = *this;
-        BaseIterator<Key, Value>::operator--();
-        return it;
-    }
+private:
+    Compare m_compare;
 };
 
-template <typename Key, typename Value>
-class ConstIterator :
-    public BaseIterator<Key, Value>
+template <typename Compare>
+class CompareHolder<Compare, true> :
+    private Compare
 {
 public:
-    template <typename K, typename V>
-    friend class RedBlackTree;
+    CompareHolder() = default;
 
-    using BaseIterator<Key, Value>::RedBlackTree;
-    using BaseIterator<Key, Value>::TreeNode;
+    explicit CompareHolder(const Compare& compare) :
+        Compare(compare)
+    { }
 
 public:
-    ConstIterator() = default;
-    explicit ConstIterator(const RedBlackTree* tree, TreeNode* current) :
-        BaseIterator<Key, Value>(tree, current)
+    const Compare& compare() const
+    { return *this; }
+
+    void swap_compare(CompareHolder&)
     { }
-    ConstIterator(const Iterator<Key, Value>& it) :
-        BaseIterator<Key, Value>(it)
+};
+
+// Lookups by other types than the key need a comparator declaring is_transparent. K only makes the
+// check depend on the lookup, so that it can be used for SFINAE.
+template <typename Compare, typename K, typename = void>
+struct IsTransparentCompare :
+    std::false_type
+{ };
+
+template <typename Compare, typename K>
+struct IsTransparentCompare<Compare, K, std::void_t<typename Compare::is_transparent>> :
+    std::true_type
+{ };
+
+// Iterators that can be walked more than once, e.g. to check the order of a range before using it
+template <typename It, typename = void>
+struct IsForwardIterator :
+    std::false_type
+{ };
+
+template <typename It>
+struct IsForwardIterator<It, std::void_t<typename std::iterator_traits<It>::iterator_category>> :
+    std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category>
+{ };
+
+// Key a descent compares with node keys, of any type the comparator accepts. With a KeyPrefixLayout
+// it carries the key prefix too, and most comparisons are settled by the cached prefixes.
+template <typename K, typename Compare, bool Prefixed>
+class SearchKey
+{
+public:
+    SearchKey(const K& key, const Compare& compare) :
+        m_key(key),
+        m_compare(compare)
     { }
 
 public:
-    ConstIterator& operator++()
-    {
-        BaseIterator<Key, Value>::operator++();
-        return *this;
-    }
-    ConstIterator operator++(int)
-    {
-        ConstIterator it = *this;
-        BaseIterator<Key, Value>::operator++();
-        return it;
-    }
+    template <typename Node>
+    bool less(const Node* node) const
+    { return m_compare(m_key, node->key()); }
 
-    ConstIterator& operator--()
-    {
-        BaseIterator<Key, Value>::operator--();
-        return *this;
-    }
-    ConstIterator operator--(int)
-    {
-        ConstIterator it = *this;
-        BaseIterator<Key, Value>::operator--();
-        return it;
-    }
+    template <typename Node>
+    bool greater(const Node* node) const
+    { return m_compare(node->key(), m_key); }
+
+private:
+    const K&       m_key;
+    const Compare& m_compare;
 };
 
-template <typename Key, typename Value>
-class ReverseIterator :
-    public BaseIterator<Key, Value>
+template <typename K, typename Compare>
+class SearchKey<K, Compare, true>
 {
 public:
-    template <typename K, typename V>
-    friend class RedBlackTree;
+    SearchKey(const K& key, const Compare& compare) :
+        m_key(key),
+        m_compare(compare),
+        m_prefix(key_prefix(key))
+    { }
 
 public:
-    using RedBlackTree = RedBlackTree<Key, Value>;
-    using BaseIterator<Key, Value>::TreeNode;
-    using BaseIterator<Key, Value>::ValueType;
+    template <typename Node>
+    bool less(const Node* node) const
+    { return (m_prefix != node->prefix()) ? m_prefix < node->prefix() : m_compare(m_key, node->key()); }
 
-public:
-    ReverseIterator() = default;
+    template <typename Node>
+    bool greater(const Node* node) const
+    { return (m_prefix != node->prefix()) ? m_prefix > node->prefix() : m_compare(node->key(), m_key); }
 
-    explicit ReverseIterator(const RedBlackTree* tree, TreeNode* current) :
-        BaseIterator<Key, Value>(tree, current)
-    { }
+private:
+    const K&       m_key;
+    const Compare& m_compare;
+    uint64_t       m_prefix;
+};
 
+// Links of a tree node as stored by Layout, plus the relatives the balancing code looks at.
+// Node is the most derived type, the one the links point to.
+template <typename Node, typename Layout>
+class NodeLinks :
+    public Layout::template Links<Node>
+{
 public:
-    ValueType& operator*()
-    { return this->m_current->value(); }
-
-    ValueType* operator->()
-    { return &(this->m_current->value()); }
+    // Without parent links the relatives below can't be found from the node, see NodePath
+    static constexpr bool ParentFree = IsParentFreeLayout<Layout>::value;
 
-    ReverseIterator& operator++()
+public:
+    Node* uncle() const
     {
-        BaseIterator<Key, Value>::operator--();
-        return *this;
+        const Node* grand_parent = grandparent();
+        return (grand_parent->left_child() == this->parent()) ? grand_parent->right_child()
+                                                              : grand_parent->left_child();
     }
 
-    ReverseIterator operator++(int)
-    {
-        ReverseIterator it = *this;
-        BaseIterator<Key, Value>::operator--();
-        return it;
-    }
+    Node* grandparent() const
+    { return this->parent()->parent(); }
 
-    ReverseIterator& operator--()
+    Node* sibling() const
     {
-        BaseIterator<Key, Value>::operator++();
-        return *this;
-    }
+        const Node* parent = this->parent();
+        if (parent == nullptr) {
+            return nullptr;
+        }
 
-    ReverseIterator operator--(int)
-    {
-        ReverseIterator it = *this;
-        BaseIterator<Key, Value>::operator++();
-        return it;
+        return (parent->right_child() == as_node()) ? parent->left_child()
+                                                    : parent->right_child();
     }
+
+private:
+    const Node* as_node() const
+    { return static_cast<const Node*>(this); }
 };
 
-template <typename Key, typename Value>
-class ReverseConstIterator :
-    public BaseIterator<Key, Value>
+template <typename Key, typename Value, typename Layout = PlainLayout>
+class TreeNode :
+    public NodeLinks<TreeNode<Key, Value, Layout>, Layout>,
+    public NodeKeyPrefix<IsKeyPrefixLayout<Layout>::value>,
+    public NodeStorageFor<Key, Value, Layout>
 {
 public:
-    template <typename K, typename V>
-    friend class RedBlackTree;
+    using ValueType = typename TreeElement<Key, Value>::Type;
+    using Storage   = NodeStorageFor<Key, Value, Layout>;
 
-    using BaseIterator<Key, Value>::RedBlackTree;
-    using BaseIterator<Key, Value>::TreeNode;
+    static constexpr bool ColdValue = IsColdValueLayout<Layout, ValueType>::value && !IsInlineKeyLayout<Layout>::value;
+    static constexpr bool InlineKey = IsInlineKeyLayout<Layout>::value;
+    static constexpr bool KeyPrefix = IsKeyPrefixLayout<Layout>::value;
 
 public:
-    ReverseConstIterator() = default;
-    explicit ReverseConstIterator(const RedBlackTree* tree, TreeNode* current) :
-        BaseIterator<Key, Value>(tree, current)
+    TreeNode() = default;
+
+    template <typename ... Args>
+    TreeNode(TreeNode* parent, Args && ... args) :
+        Storage(std::forward<Args>(args)...)
+    {
+        this->set_parent(parent);
+        if constexpr (KeyPrefix) {
+            this->set_prefix(key_prefix(this->key()));
+        }
+    }
+};
+
+// Node order used by RedBlackTree::compact()
+enum class CompactOrder
+{
+    BreadthFirst,
+    DepthFirst,
+    VanEmdeBoas
+};
+
+// Which of the elements with equal keys RedBlackTree::bulk_load() keeps, by their order in the input
+enum class DuplicateKeys
+{
+    KeepFirst,
+    KeepLast
+};
+
+// What a BatchOp does to its key
+enum class BatchAction
+{
+    Upsert,     // insert_or_assign() the value
+    Erase
+};
+
+// A change in a batch for Map::apply_batch(). The value of an erasure is not used.
+template <typename Key, typename Value>
+struct BatchOp
+{
+    BatchAction action;
+    Key         key;
+    Value       value;
+};
+
+// Merge for Map::unite() and map_union() that keeps the mapped value of the left map
+struct KeepLeftValue
+{
+    template <typename T, typename U>
+    void operator()(T&, U&&) const
+    { }
+};
+
+// Runs f(0) ... f(count - 1) on a thread each, f(0) on the calling one, and waits for all of them.
+// Then rethrows the first exception any of them threw. Without threads, the calls run one by one.
+template <typename F>
+void run_in_parallel(size_t count, F&& f)
+{
+    std::vector<std::exception_ptr> errors(count);
+    auto task = [&](size_t index) {
+        try {
+            f(index);
+        } catch (...) {
+            errors[index] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(count);
+    for (size_t index = 1; index < count; ++index) {
+        try {
+            threads.emplace_back(task, index);
+        } catch (const std::system_error&) {
+            task(index);
+        }
+    }
+
+    task(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+template <typename Node>
+Node* find_min(Node* node)
+{
+    while (node->left_child() != nullptr) {
+        node = node->left_child();
+    }
+
+    return node;
+}
+
+template <typename Node>
+Node* find_max(Node* node)
+{
+    while (node->right_child() != nullptr) {
+        node = node->right_child();
+    }
+
+    return node;
+}
+
+// Starts loading the node into the cache, so that a descent coming back to it later doesn't stall
+inline void prefetch_node(const void* node)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(static_cast<const char*>(node), _MM_HINT_T0);
+#elif defined(__GNUC__)
+    __builtin_prefetch(node);
+#else
+    (void)node;
+#endif
+}
+
+// The ancestors of a node, from the root of its tree or subtree down to its parent, for nodes without
+// parent links. A red-black tree of n nodes is at most 2 log2(n + 1) deep, and far fewer nodes than
+// size_t counts fit into memory, which leaves room for the level a repair adds while it rotates.
+template <typename Node>
+class NodePath
+{
+public:
+    static constexpr size_t MaxDepth = 2 * 8 * sizeof(size_t);
+
+public:
+    NodePath() = default;
+
+    // Copies only the nodes on the path
+    NodePath(const NodePath& path) :
+        m_depth(path.m_depth)
+    { std::copy(path.m_nodes, path.m_nodes + m_depth, m_nodes); }
+
+    NodePath& operator=(const NodePath& path)
+    {
+        m_depth = path.m_depth;
+        std::copy(path.m_nodes, path.m_nodes + m_depth, m_nodes);
+        return *this;
+    }
+
+public:
+    bool empty() const
+    { return m_depth == 0; }
+
+    size_t depth() const
+    { return m_depth; }
+
+    void clear()
+    { m_depth = 0; }
+
+    void push(Node* node)
+    {
+        assert(m_depth < MaxDepth);
+        m_nodes[m_depth++] = node;
+    }
+
+    Node* pop()
+    { return m_nodes[--m_depth]; }
+
+    // The parent, nullptr for the root
+    Node* top() const
+    { return (m_depth != 0) ? m_nodes[m_depth - 1] : nullptr; }
+
+    // The ancestor `up` levels above the parent, nullptr above the root
+    Node* above(size_t up) const
+    { return (up < m_depth) ? m_nodes[m_depth - 1 - up] : nullptr; }
+
+    Node*& operator[](size_t depth)
+    { return m_nodes[depth]; }
+
+    // Smallest node of the subtree, which becomes the root of the path
+    Node* first(Node* root)
+    {
+        m_depth = 0;
+        if (root == nullptr) {
+            return nullptr;
+        }
+
+        for (; root->left_child() != nullptr; root = root->left_child()) {
+            push(root);
+        }
+        return root;
+    }
+
+    // In-order successor and predecessor of the node the path leads to, whose path it becomes,
+    // nullptr past the ends
+    Node* next(Node* node)
+    {
+        if (node->right_child() != nullptr) {
+            push(node);
+            for (node = node->right_child(); node->left_child() != nullptr; node = node->left_child()) {
+                push(node);
+            }
+            return node;
+        }
+
+        while (!empty() && top()->right_child() == node) {
+            node = pop();
+        }
+        return empty() ? nullptr : pop();
+    }
+
+    Node* previous(Node* node)
+    {
+        if (node->left_child() != nullptr) {
+            push(node);
+            for (node = node->left_child(); node->right_child() != nullptr; node = node->right_child()) {
+                push(node);
+            }
+            return node;
+        }
+
+        while (!empty() && top()->left_child() == node) {
+            node = pop();
+        }
+        return empty() ? nullptr : pop();
+    }
+
+private:
+    Node*  m_nodes[MaxDepth];
+    size_t m_depth = 0;
+};
+
+// Iterators of trees with parent links need no path
+struct NoNodePath
+{ };
+
+template <typename Tree>
+class BaseIterator
+{
+public:
+    friend Tree;
+
+public:
+    using TreeNode  = typename Tree::TreeNode;
+    using ValueType = typename TreeNode::ValueType;
+
+public:
+    BaseIterator() = default;
+
+    explicit BaseIterator(const Tree* tree, TreeNode* current) :
+        m_tree(tree),
+        m_current(current),
+        m_end(current == nullptr)
+    {
+        if constexpr (TreeNode::ParentFree) {
+            if (current != nullptr) {
+                tree->path_to(current, m_path);
+            }
+        }
+    }
+
+public:
+    const ValueType& operator*() const
+    { return m_current->value(); }
+
+    const ValueType* operator->() const
+    { return &(m_current->value()); }
+
+    BaseIterator& operator++()
+    {
+        if constexpr (TreeNode::ParentFree) {
+            m_current = m_path.next(m_current);
+            m_end = (m_current == nullptr);
+            return *this;
+        } else {
+            if (m_current->right_child() != nullptr) {
+                m_current = find_min(m_current->right_child());
+                return *this;
+            }
+
+            while (m_current->parent() != nullptr && m_current == m_current->parent()->right_child()) {
+                m_current = m_current->parent();
+            }
+
+            if (m_current->parent()) {
+                m_current = m_current->parent();
+                return *this;
+            }
+
+            m_current = nullptr;
+            m_end = true;
+            return *this;
+        }
+    }
+
+    BaseIterator& operator--()
+    {
+        if (m_end) {
+            m_current = m_tree->get_last();
+            m_end = false;
+            if constexpr (TreeNode::ParentFree) {
+                m_tree->path_to(m_current, m_path);
+            }
+            return *this;
+        }
+
+        if constexpr (TreeNode::ParentFree) {
+            m_current = m_path.previous(m_current);
+            m_end = (m_current == nullptr);
+            return *this;
+        } else {
+            if (m_current->left_child() != nullptr) {
+                m_current = find_max(m_current->left_child());
+                return *this;
+            }
+
+            while (m_current->parent() != nullptr && m_current == m_current->parent()->left_child()) {
+                m_current = m_current->parent();
+            }
+
+            if (m_current->parent() != nullptr) {
+                m_current = m_current->parent();
+                return *this;
+            }
+
+            m_current = nullptr;
+            m_end = true;
+            return *this;
+        }
+    }
+
+    bool operator==(const BaseIterator& it)
+    { return m_current == it.m_current; }
+    bool operator!=(const BaseIterator& it)
+    { return !operator==(it); }
+
+protected:
+    // Without parent links, the ancestors of the current node
+    using Path = std::conditional_t<TreeNode::ParentFree, NodePath<TreeNode>, NoNodePath>;
+
+    const Tree* m_tree = nullptr;
+    TreeNode* m_current = nullptr;
+    bool      m_end = false;
+    Path      m_path;
+};
+
+template <typename Tree>
+class Iterator :
+    public BaseIterator<Tree>
+{
+public:
+    friend Tree;
+
+public:
+    using typename BaseIterator<Tree>::TreeNode;
+    using typename BaseIterator<Tree>::ValueType;
+
+public:
+    Iterator() = default;
+
+    explicit Iterator(const Tree* tree, TreeNode* current) :
+        BaseIterator<Tree>(tree, current)
+    { }
+
+public:
+    ValueType& operator*()
+    { return this->m_current->value(); }
+
+    ValueType* operator->()
+    { return &(this->m_current->value()); }
+
+    Iterator& operator++()
+    {
+        BaseIterator<Tree>::operator++();
+        return *this;
+    }
+
+    Iterator operator++(int)
+    {
+        Iterator it = *this;
+        BaseIterator<Tree>::operator++();
+        return it;
+    }
+
+    Iterator& operator--()
+    {
+        BaseIterator<Tree>::operator--();
+        return *this;
+    }
+
+    Iterator operator--(int)
+    {
+        Iterator it = *this;
+        BaseIterator<Tree>::operator--();
+        return it;
+    }
+};
+
+template <typename Tree>
+class ConstIterator :
+    public BaseIterator<Tree>
+{
+public:
+    friend Tree;
+
+    using typename BaseIterator<Tree>::TreeNode;
+
+public:
+    ConstIterator() = default;
+    explicit ConstIterator(const Tree* tree, TreeNode* current) :
+        BaseIterator<Tree>(tree, current)
     { }
-    ReverseConstIterator(const ReverseIterator<Key, Value>& it) :
-        BaseIterator<Key, Value>(it)
+    ConstIterator(const Iterator<Tree>& it) :
+        BaseIterator<Tree>(it)
     { }
 
 public:
-    ReverseConstIterator& operator++()
+    ConstIterator& operator++()
     {
-        BaseIterator<Key, Value>::operator--();
+        BaseIterator<Tree>::operator++();
         return *this;
     }
-    ReverseConstIterator operator++(int)
+    ConstIterator operator++(int)
     {
-        ReverseConstIterator it = *this;
-        BaseIterator<Key, Value>::operator--();
+        ConstIterator it = *this;
+        BaseIterator<Tree>::operator++();
+        return it;
+    }
+
+    ConstIterator& operator--()
+    {
+        BaseIterator<Tree>::operator--();
+        return *this;
+    }
+    ConstIterator operator--(int)
+    {
+        ConstIterator it = *this;
+        BaseIterator<Tree>::operator--();
         return it;
     }
+};
+
+template <typename Tree>
+class ReverseIterator :
+    public BaseIterator<Tree>
+{
+public:
+    friend Tree;
+
+public:
+    using typename BaseIterator<Tree>::TreeNode;
+    using typename BaseIterator<Tree>::ValueType;
+
+public:
+    ReverseIterator() = default;
+
+    explicit ReverseIterator(const Tree* tree, TreeNode* current) :
+        BaseIterator<Tree>(tree, current)
+    { }
+
+public:
+    ValueType& operator*()
+    { return this->m_current->value(); }
+
+    ValueType* operator->()
+    { return &(this->m_current->value()); }
+
+    ReverseIterator& operator++()
+    {
+        BaseIterator<Tree>::operator--();
+        return *this;
+    }
+
+    ReverseIterator operator++(int)
+    {
+        ReverseIterator it = *this;
+        BaseIterator<Tree>::operator--();
+        return it;
+    }
+
+    ReverseIterator& operator--()
+    {
+        BaseIterator<Tree>::operator++();
+        return *this;
+    }
+
+    ReverseIterator operator--(int)
+    {
+        ReverseIterator it = *this;
+        BaseIterator<Tree>::operator++();
+        return it;
+    }
+};
+
+template <typename Tree>
+class ReverseConstIterator :
+    public BaseIterator<Tree>
+{
+public:
+    friend Tree;
+
+    using typename BaseIterator<Tree>::TreeNode;
+
+public:
+    ReverseConstIterator() = default;
+    explicit ReverseConstIterator(const Tree* tree, TreeNode* current) :
+        BaseIterator<Tree>(tree, current)
+    { }
+    ReverseConstIterator(const ReverseIterator<Tree>& it) :
+        BaseIterator<Tree>(it)
+    { }
+
+public:
+    ReverseConstIterator& operator++()
+    {
+        BaseIterator<Tree>::operator--();
+        return *this;
+    }
+    ReverseConstIterator operator++(int)
+    {
+        ReverseConstIterator it = *this;
+        BaseIterator<Tree>::operator--();
+        return it;
+    }
+
+    ReverseConstIterator& operator--()
+    {
+        BaseIterator<Tree>::operator++();
+        return *this;
+    }
+    ReverseConstIterator operator--(int)
+    {
+        ReverseConstIterator it = *this;
+        BaseIterator<Tree>::operator++();
+        return it;
+    }
+};
+
+// Where find_or_position() found a key missing: the node to link a new one below and the side.
+// Only the tree that handed it out takes it back, and only while the tree hasn't been modified since;
+// otherwise emplace_at() searches again.
+template <typename Tree>
+class InsertPosition
+{
+public:
+    friend Tree;
+
+    using TreeNode = typename Tree::TreeNode;
+
+public:
+    InsertPosition() = default;
+
+private:
+    explicit InsertPosition(const Tree* tree, size_t version, TreeNode* parent, bool right) :
+        m_tree(tree),
+        m_version(version),
+        m_parent(parent),
+        m_right(right)
+    { }
+
+private:
+    const Tree* m_tree    = nullptr;
+    size_t      m_version = 0;
+    TreeNode*   m_parent  = nullptr;
+    bool        m_right   = false;
+};
+
+// Balancing part of a red-black tree: root, extreme nodes, rotations and the repairs after linking
+// and unlinking a node. Knows nothing about keys or memory, so trees that own their nodes and
+// intrusive trees share it. Node needs the NodeLinks accessors.
+template <typename Node>
+class RedBlackTreeBase
+{
+protected:
+    RedBlackTreeBase() = default;
+
+    RedBlackTreeBase(RedBlackTreeBase&& tree) noexcept :
+        m_root(tree.m_root),
+        m_size(tree.m_size),
+        m_min_node(tree.m_min_node),
+        m_max_node(tree.m_max_node)
+    { tree.reset(); }
+
+    RedBlackTreeBase(const RedBlackTreeBase&) = delete;
+    RedBlackTreeBase& operator=(const RedBlackTreeBase&) = delete;
+
+protected:
+    // Forget all nodes without touching them
+    void reset()
+    {
+        m_root = nullptr;
+        m_size = 0;
+        m_min_node = nullptr;
+        m_max_node = nullptr;
+    }
+
+    void swap_nodes(RedBlackTreeBase& other) noexcept
+    {
+        std::swap(m_root, other.m_root);
+        std::swap(m_size, other.m_size);
+        std::swap(m_min_node, other.m_min_node);
+        std::swap(m_max_node, other.m_max_node);
+    }
+
+    // Hang a fresh node below `parent` on the given side, or make it the root of an empty tree, then rebalance
+    void link_node(Node* parent, bool right, Node* node)
+    {
+        node->set_parent(parent);
+        hang_node(parent, right, node);
+        do_insert_repair(node);
+        ++m_size;
+    }
+
+    // The same for nodes without parent links, below the last node of the path from the root
+    void link_node(NodePath<Node>& path, bool right, Node* node)
+    {
+        hang_node(path.top(), right, node);
+        do_insert_repair(path, node);
+        ++m_size;
+    }
+
+    // Hang `node` and then the detached subtree `right`, of `right_size` nodes and with a black root,
+    // after all nodes of the tree. Their keys must be greater, in that order. O(log n), whatever the sizes.
+    void join_right(Node* node, Node* right, size_t right_size)
+    {
+        Node* right_max = (right != nullptr) ? find_max(right) : node;
+        if (right != nullptr) {
+            right->set_parent(nullptr);
+        }
+
+        m_root = join_subtrees(detached(m_root), node, detached(right)).root;
+        if (m_min_node == nullptr) {
+            m_min_node = node;
+        }
+        m_max_node = right_max;
+        m_size += 1 + right_size;
+    }
+
+    // A subtree that is not part of a tree: its root, black and without a parent, or nullptr, and
+    // its black height, so that joins and splits needn't walk down to find it
+    struct Detached
+    {
+        Node*  root   = nullptr;
+        size_t height = 0;
+    };
+
+    static Detached detached(Node* root)
+    { return Detached{root, black_height(root)}; }
+
+    // A child subtree of a detached subtree's root, detached in turn. A red child is painted black,
+    // which keeps every path's black count equal and makes it as high as its parent.
+    static Detached detach_child(const Detached& subtree, bool right)
+    {
+        Node* child = subtree.root->child(right);
+        if (child == nullptr || child->is_black()) {
+            if (child != nullptr) {
+                child->set_parent(nullptr);
+            }
+            return Detached{child, subtree.height - 1};
+        }
+
+        child->set_parent(nullptr);
+        child->set_black_color();
+        return Detached{child, subtree.height};
+    }
+
+    // Join two detached subtrees and a node whose key lies between theirs into one detached subtree.
+    // The lower one goes below the node at the spine of the higher one that has its black height,
+    // and the colours are repaired from there: O(difference of the black heights). m_root serves as
+    // scratch; the extreme nodes and size are left alone.
+    Detached join_subtrees(const Detached& left, Node* node, const Detached& right)
+    {
+        // The spine walked down, which the repair climbs back without parent links
+        NodePath<Node> path;
+        if (left.height >= right.height) {
+            // Down the right spine to the first black node as high as the right subtree
+            Node* child = left.root;
+            for (size_t height = left.height; child != nullptr && (child->is_red() || height > right.height); child = child->right_child()) {
+                height -= child->is_black() ? 1 : 0;
+                path.push(child);
+            }
+
+            node->set_left_child(child);
+            node->set_right_child(right.root);
+            m_root = left.root;
+            if (path.empty()) {
+                m_root = node;
+            } else {
+                path.top()->set_right_child(node);
+            }
+        } else {
+            Node* child = right.root;
+            for (size_t height = right.height; child != nullptr && (child->is_red() || height > left.height); child = child->left_child()) {
+                height -= child->is_black() ? 1 : 0;
+                path.push(child);
+            }
+
+            node->set_left_child(left.root);
+            node->set_right_child(child);
+            path.top()->set_left_child(node);
+            m_root = right.root;
+        }
+
+        if (node->left_child() != nullptr) {
+            node->left_child()->set_parent(node);
+        }
+        if (node->right_child() != nullptr) {
+            node->right_child()->set_parent(node);
+        }
+        node->set_parent(path.top());
+        node->set_red_color();
+        const bool raised = do_insert_repair(path, node);
+        return Detached{m_root, std::max(left.height, right.height) + (raised ? 1 : 0)};
+    }
+
+    // Join two detached subtrees where all keys of `left` are less, with the largest node of `left`
+    // as the node between them. O(log n)
+    Detached concatenate_subtrees(const Detached& left, const Detached& right)
+    {
+        if (left.root == nullptr || right.root == nullptr) {
+            return (left.root != nullptr) ? left : right;
+        }
+
+        Detached rest;
+        Node* pivot = take_max(left, rest);
+        return join_subtrees(rest, pivot, right);
+    }
+
+    // Takes the largest node out of a detached subtree, leaving the others in `rest`: down the right
+    // spine, then each node on it joins its left subtree with what is left of its right one
+    Node* take_max(const Detached& subtree, Detached& rest)
+    {
+        const Detached left = detach_child(subtree, false);
+        if (subtree.root->right_child() == nullptr) {
+            rest = left;
+            return subtree.root;
+        }
+
+        Detached right_rest;
+        Node* max_node = take_max(detach_child(subtree, true), right_rest);
+        rest = join_subtrees(left, subtree.root, right_rest);
+        return max_node;
+    }
+
+    // Node counts of two detached subtrees holding `total` nodes together, in the time it takes
+    // to walk the smaller one: both are walked a node at a time until one runs out
+    static Pair<size_t, size_t> count_subtrees(Node* first, Node* second, size_t total)
+    {
+        std::vector<Node*> first_pending;
+        std::vector<Node*> second_pending;
+        if (first != nullptr) {
+            first_pending.push_back(first);
+        }
+        if (second != nullptr) {
+            second_pending.push_back(second);
+        }
+
+        size_t count = 0;
+        while (!first_pending.empty() && !second_pending.empty()) {
+            for (std::vector<Node*>* pending : {&first_pending, &second_pending}) {
+                Node* node = pending->back();
+                pending->pop_back();
+                if (node->right_child() != nullptr) {
+                    pending->push_back(node->right_child());
+                }
+                if (node->left_child() != nullptr) {
+                    pending->push_back(node->left_child());
+                }
+            }
+            ++count;
+        }
+
+        return first_pending.empty() ? MakePair(count, total - count) : MakePair(total - count, count);
+    }
+
+    // Black nodes on a path from the node down to a leaf
+    static size_t black_height(const Node* node)
+    {
+        size_t height = 0;
+        for (; node != nullptr; node = node->left_child()) {
+            height += node->is_black() ? 1 : 0;
+        }
+        return height;
+    }
+
+    // Take a node out of the tree and rebalance. The node itself is left alone
+    void unlink_node(Node* node)
+    {
+        if (node == m_min_node) {
+            m_min_node = node->right_child() ? node->right_child()
+                                             : node->parent();
+        }
+
+        if (node == m_max_node) {
+            m_max_node = node->left_child() ? node->left_child()
+                                            : node->parent();
+        }
+
+        node = find_one_non_leaf_child_node(node);
+
+        Node* child_node = node->left_child() ? node->left_child()
+                                              : node->right_child();
+
+        if (node->is_red()) {
+            // Case 1: Node is red. Then both its children are leafs
+            if (node->parent()->right_child() == node) {
+                node->parent()->set_right_child(nullptr);
+            } else {
+                node->parent()->set_left_child(nullptr);
+            }
+        } else if (child_node != nullptr && child_node->is_red()) {
+            // Case 2. Node is black and its child is red
+            if (node->parent() != nullptr) {
+                if (node->parent()->right_child() == node) {
+                    node->parent()->set_right_child(child_node);
+                } else {
+                    node->parent()->set_left_child(child_node);
+                }
+            } else {
+                m_root = child_node;
+            }
+
+            child_node->set_parent(node->parent());
+            child_node->set_black_color();
+        } else {
+            // Case 3. Node is black and its both children are black. Because of RB trees properties they are leafs.
+
+            // First delete the node
+            Node* parent = node->parent();
+            Node* sibling = node->sibling();
+            if (parent != nullptr) {
+                if (parent->right_child() == node) {
+                    parent->set_right_child(child_node);
+                } else {
+                    parent->set_left_child(child_node);
+                }
+            } else {
+                m_root = nullptr;
+            }
+
+            // Now fix the tree
+            do_remove_double_black_repair(child_node, parent, sibling);
+        }
+
+        --m_size;
+    }
+
+    // The same for nodes without parent links, with the path from the root down to the node's parent
+    void unlink_node(NodePath<Node>& path, Node* node)
+    {
+        if (node == m_min_node) {
+            m_min_node = node->right_child() ? node->right_child()
+                                             : path.top();
+        }
+
+        if (node == m_max_node) {
+            m_max_node = node->left_child() ? node->left_child()
+                                            : path.top();
+        }
+
+        swap_with_predecessor(path, node);
+
+        Node* parent = path.top();
+        Node* child_node = node->left_child() ? node->left_child()
+                                              : node->right_child();
+
+        if (node->is_red()) {
+            // Case 1: Node is red. Then both its children are leafs
+            replace_child(parent, node, nullptr);
+        } else if (child_node != nullptr && child_node->is_red()) {
+            // Case 2. Node is black and its child is red
+            replace_child(parent, node, child_node);
+            child_node->set_black_color();
+        } else {
+            // Case 3. Node is black and its both children are black leafs
+            const bool left = (parent != nullptr && parent->left_child() == node);
+            replace_child(parent, node, child_node);
+            do_remove_double_black_repair(path, left);
+        }
+
+        --m_size;
+    }
+
+private:
+    // Below `parent` on the given side, or as the root of an empty tree, red and without children
+    void hang_node(Node* parent, bool right, Node* node)
+    {
+        node->set_left_child(nullptr);
+        node->set_right_child(nullptr);
+        node->set_red_color();
+
+        if (parent == nullptr) {
+            m_root = node;
+            m_min_node = node;
+            m_max_node = node;
+        } else if (right) {
+            parent->set_right_child(node);
+            if (parent == m_max_node) {
+                m_max_node = node;
+            }
+        } else {
+            parent->set_left_child(node);
+            if (parent == m_min_node) {
+                m_min_node = node;
+            }
+        }
+    }
+
+    void lr_rotate(Node* node)
+    {
+        rotate_left(node->parent());
+        ll_rotate(node->left_child());
+    }
+
+    void ll_rotate(Node* node)
+    {
+        node->parent()->set_black_color();
+
+        Node* grandparent = node->grandparent();
+        grandparent->set_red_color();
+        rotate_right(grandparent);
+    }
+
+    void rl_rotate(Node* node)
+    {
+        rotate_right(node->parent());
+        rr_rotate(node->right_child());
+    }
+
+    void rr_rotate(Node* node)
+    {
+        node->parent()->set_black_color();
+
+        Node* grandparent = node->grandparent();
+        grandparent->set_red_color();
+        rotate_left(grandparent);
+    }
+
+    void rotate_left(Node* node)
+    { rotate_left(node, node->parent()); }
+
+    void rotate_right(Node* node)
+    { rotate_right(node, node->parent()); }
+
+    // The parent is passed in for layouts that don't store it
+    void rotate_left(Node* node, Node* parent)
+    {
+        Node* child = node->right_child();
+
+        child->set_parent(parent);
+        replace_child(parent, node, child);
+
+        node->set_right_child(child->left_child());
+        if (node->right_child() != nullptr) {
+            node->right_child()->set_parent(node);
+        }
+
+        child->set_left_child(node);
+        node->set_parent(child);
+    }
+
+    void rotate_right(Node* node, Node* parent)
+    {
+        Node* child = node->left_child();
+
+        child->set_parent(parent);
+        replace_child(parent, node, child);
+
+        node->set_left_child(child->right_child());
+        if (node->left_child() != nullptr) {
+            node->left_child()->set_parent(node);
+        }
+
+        child->set_right_child(node);
+        node->set_parent(child);
+    }
+
+    // Hang `replacement` where `child` hangs below `parent`, nullptr meaning the root
+    void replace_child(Node* parent, Node* child, Node* replacement)
+    {
+        if (parent == nullptr) {
+            m_root = replacement;
+        } else if (parent->left_child() == child) {
+            parent->set_left_child(replacement);
+        } else {
+            parent->set_right_child(replacement);
+        }
+    }
+
+    // Returns whether the root was painted black, which adds one to the tree's black height
+    bool do_insert_repair(Node* node)
+    {
+        Node* parent = node->parent();
+
+        // Case 1. Node is root
+        if (parent == nullptr) {
+            const bool raised = node->is_red();
+            node->set_black_color();
+            return raised;
+        }
+
+        // Case 2. Parent is black
+        if (parent->is_black()) {
+            return false;
+        }
+
+        Node* uncle = node->uncle();
+        Node* grandparent = node->grandparent();
+
+        // Case 3. Parent is red. Uncle is red
+        if (uncle != nullptr && uncle->is_red()) {
+            parent->set_black_color();
+            uncle->set_black_color();
+            grandparent->set_red_color();
+            return do_insert_repair(grandparent);
+        }
+
+        // Case 4. Parent is red. Uncle is black.
+        if (parent == grandparent->left_child()) {
+            // Left Rotate
+            if (node == parent->right_child()) {
+                lr_rotate(node);
+            } else {
+                ll_rotate(node);
+            }
+        } else {
+            // Right Rotate
+            if (node == parent->left_child()) {
+                rl_rotate(node);
+            } else {
+                rr_rotate(node);
+            }
+        }
+        return false;
+    }
+
+    Node* find_one_non_leaf_child_node(Node* node)
+    {
+        if (node->left_child() == nullptr || node->right_child() == nullptr) {
+            return node;
+        }
+
+        Node* child = find_max(node->left_child());
+
+        // Swap the nodes
+        child->set_right_child(node->right_child());
+        child->right_child()->set_parent(child); // right child of node is not null as per condition in the method start
+        node->set_right_child(nullptr); // right child of max_node_left_subtree is nullptr as it is max element in the subtree
+
+        Node* node_left_child = node->left_child();
+        node->set_left_child(child->left_child());
+        if (node->left_child() != nullptr) {
+            node->left_child()->set_parent(node);
+        }
+
+        Node* child_parent = child->parent();
+        if (node->parent() != nullptr) {
+            if (node->parent()->left_child() == node) {
+                node->parent()->set_left_child(child);
+            } else {
+                node->parent()->set_right_child(child);
+            }
+        } else {
+            m_root = child;
+        }
+        child->set_parent(node->parent());
+
+        if (node_left_child == child) {
+            child->set_left_child(node);
+            node->set_parent(child);
+        } else {
+            child->set_left_child(node_left_child);
+            child->left_child()->set_parent(child); // child->left_child() is not nullptr as we went left from node while searching for the child
+
+            node->set_parent(child_parent);
+            node->parent()->set_right_child(node); // We always went right in the left subtree, and it is not the first node
+        }
+
+        bool tmp_color = child->is_black();
+        child->set_color(node->is_black());
+        node->set_color(tmp_color);
+        return node;
+    }
+
+    void do_remove_double_black_repair(Node* node, Node* parent, Node* sibling)
+    {
+        // Case 3.1 Node is root, we are done.
+        if (parent == nullptr) {
+            return;
+        }
+
+        // Case 3.2. Sibling is red
+        if (sibling->is_red()) {
+            parent->set_red_color();
+            sibling->set_black_color();
+            if (node == parent->left_child()) {
+                rotate_left(parent);
+                sibling = parent->right_child();
+            } else {
+                rotate_right(parent);
+                sibling = parent->left_child();
+            }
+
+            // After rotation node has a new black sibling and a red father
+        }
+
+        // Case 3.3. Sibling is black and both sibling children are black
+        if ((sibling->left_child() == nullptr || sibling->left_child()->is_black()) &&
+            (sibling->right_child() == nullptr || sibling->right_child()->is_black())) {
+
+            if (parent->is_black()) {
+                // Case 3.3.1. Parent is black
+
+                // Recolor sibling to red. Now the subtree starting at parent is a valid RB tree, but its black height of every path in it is smaller by one than
+                // black height of any other path in the whole tree. So we have to go upper in the tree and fix it again the same way.
+                sibling->set_red_color();
+                do_remove_double_black_repair(parent, parent->parent(), parent->sibling());
+            } else {
+                // Case 3.3.2. Parent is red
+                parent->set_black_color();
+                sibling->set_red_color();
+            }
+
+            // In both cases we are done here.
+            //
+            // In case 3.3.1 the algorithm will go recursively upward the tree, on each step getting a valid RB subtree of the whole tree.
+            // It will stop when it either reaches the root or reach a case when imbalance will be fixed by rotation/recoloring
+            //
+            // In case 3.3.2 recoloring is enough to have the same RB height in the whole tree.
+            return;
+        }
+
+        // Case 3.4. Node is a left child, sibling is black, its right child is black and left child is red (or symmetrically when node is a right child)
+        if (node == parent->left_child() && (sibling->right_child() == nullptr || sibling->right_child()->is_black()) && (sibling->left_child() != nullptr && sibling->left_child()->is_red())) {
+            // Recolor and rotate around sibling. Now node has a new black sibling and a configuration which will be handled by case 3.5
+            sibling->set_red_color();
+            sibling->left_child()->set_black_color();
+            rotate_right(sibling);
+            sibling = parent->right_child();
+        } else if (node == parent->right_child() && (sibling->left_child() == nullptr || sibling->left_child()->is_black()) && (sibling->right_child() != nullptr && sibling->right_child()->is_red())) {
+            sibling->set_red_color();
+            sibling->right_child()->set_black_color();
+            rotate_left(sibling);
+            sibling = parent->left_child();
+        }
+
+        // Case 3.5. Here sibling is black and its right child is red (when node is a left  child)
+        //                                  or its left  child is red (when node is a right child)
+
+        sibling->set_color(parent->is_black());
+        parent->set_black_color();
+
+        if (node == parent->left_child()) {
+            sibling->right_child()->set_black_color();
+            rotate_left(parent);
+        } else {
+            sibling->left_child()->set_black_color();
+            rotate_right(parent);
+        }
+        // Now black-height is the same in the whole tree, so we are done
+    }
+
+    // do_insert_repair() for a node whose ancestors are on the path, which it climbs as it pops them
+    bool do_insert_repair(NodePath<Node>& path, Node* node)
+    {
+        while (true) {
+            Node* parent = path.top();
+
+            // Case 1. Node is root
+            if (parent == nullptr) {
+                const bool raised = node->is_red();
+                node->set_black_color();
+                return raised;
+            }
+
+            // Case 2. Parent is black
+            if (parent->is_black()) {
+                return false;
+            }
+
+            Node* grandparent = path.above(1);
+            const bool left = (grandparent->left_child() == parent);
+            Node* uncle = grandparent->child(left);
+
+            // Case 3. Parent is red. Uncle is red
+            if (uncle != nullptr && uncle->is_red()) {
+                parent->set_black_color();
+                uncle->set_black_color();
+                grandparent->set_red_color();
+                path.pop();
+                path.pop();
+                node = grandparent;
+                continue;
+            }
+
+            // Case 4. Parent is red. Uncle is black. An inner grandchild first takes its parent's place
+            Node* great_grandparent = path.above(2);
+            if (left) {
+                if (node == parent->right_child()) {
+                    rotate_left(parent, grandparent);
+                    parent = node;
+                }
+                parent->set_black_color();
+                grandparent->set_red_color();
+                rotate_right(grandparent, great_grandparent);
+            } else {
+                if (node == parent->left_child()) {
+                    rotate_right(parent, grandparent);
+                    parent = node;
+                }
+                parent->set_black_color();
+                grandparent->set_red_color();
+                rotate_left(grandparent, great_grandparent);
+            }
+            return false;
+        }
+    }
+
+    // find_one_non_leaf_child_node() for a node whose ancestors are on the path. The path then
+    // leads to the node's new place.
+    void swap_with_predecessor(NodePath<Node>& path, Node* node)
+    {
+        if (node->left_child() == nullptr || node->right_child() == nullptr) {
+            return;
+        }
+
+        const size_t depth = path.depth();
+        Node* parent = path.top();
+        path.push(node);
+        Node* child = node->left_child();
+        for (; child->right_child() != nullptr; child = child->right_child()) {
+            path.push(child);
+        }
+        Node* child_parent = path.top();
+
+        child->set_right_child(node->right_child());
+        node->set_right_child(nullptr);
+
+        Node* node_left_child = node->left_child();
+        node->set_left_child(child->left_child());
+        replace_child(parent, node, child);
+
+        if (node_left_child == child) {
+            child->set_left_child(node);
+        } else {
+            child->set_left_child(node_left_child);
+            child_parent->set_right_child(node);
+        }
+        path[depth] = child;
+
+        bool tmp_color = child->is_black();
+        child->set_color(node->is_black());
+        node->set_color(tmp_color);
+    }
+
+    // do_remove_double_black_repair() for the doubly black place below the last node of the path,
+    // on its left or right. Climbs the path as it pops it.
+    void do_remove_double_black_repair(NodePath<Node>& path, bool left)
+    {
+        // Case 3.1 Node is root, we are done.
+        while (!path.empty()) {
+            Node* parent = path.top();
+            Node* grandparent = path.above(1);
+            Node* sibling = parent->child(left);
+
+            // Case 3.2. Sibling is red. It takes the parent's place, and the parent, red now, ends
+            // the repair below it without climbing further
+            if (sibling->is_red()) {
+                parent->set_red_color();
+                sibling->set_black_color();
+                if (left) {
+                    rotate_left(parent, grandparent);
+                } else {
+                    rotate_right(parent, grandparent);
+                }
+
+                grandparent = sibling;
+                sibling = parent->child(left);
+            }
+
+            // Case 3.3. Sibling is black and both sibling children are black
+            if ((sibling->left_child() == nullptr || sibling->left_child()->is_black()) &&
+                (sibling->right_child() == nullptr || sibling->right_child()->is_black())) {
+                sibling->set_red_color();
+                if (parent->is_red()) {
+                    // Case 3.3.2. Parent is red
+                    parent->set_black_color();
+                    return;
+                }
+
+                // Case 3.3.1. Parent is black: its subtree is a black short, go up
+                path.pop();
+                left = (grandparent != nullptr && grandparent->left_child() == parent);
+                continue;
+            }
+
+            // Case 3.4. The sibling's near child is red and its far child black
+            if (left && (sibling->right_child() == nullptr || sibling->right_child()->is_black())) {
+                sibling->set_red_color();
+                sibling->left_child()->set_black_color();
+                rotate_right(sibling, parent);
+                sibling = parent->right_child();
+            } else if (!left && (sibling->left_child() == nullptr || sibling->left_child()->is_black())) {
+                sibling->set_red_color();
+                sibling->right_child()->set_black_color();
+                rotate_left(sibling, parent);
+                sibling = parent->left_child();
+            }
+
+            // Case 3.5. The sibling's far child is red
+            sibling->set_color(parent->is_black());
+            parent->set_black_color();
+            if (left) {
+                sibling->right_child()->set_black_color();
+                rotate_left(parent, grandparent);
+            } else {
+                sibling->left_child()->set_black_color();
+                rotate_right(parent, grandparent);
+            }
+            return;
+        }
+    }
+
+protected:
+    Node*  m_root = nullptr;
+    size_t m_size = 0;
+
+    Node* m_min_node = nullptr;
+    Node* m_max_node = nullptr;
+};
+
+struct FindCacheStats
+{
+    size_t lookups = 0;
+    size_t hits    = 0;
+};
+
+// The last few nodes find() returned, checked before a descent from the root. Pays off when the
+// same keys are looked up again and again. Off by default: with it on, lookups write to the map,
+// so a map searched from several threads at once must keep it off.
+template <typename Node>
+class FindCache
+{
+public:
+    static constexpr size_t Size = 4;
+
+public:
+    bool enabled() const
+    { return m_enabled; }
+
+    void enable(bool enable)
+    {
+        m_enabled = enable;
+        m_stats = FindCacheStats();
+        flush();
+    }
+
+    const FindCacheStats& stats() const
+    { return m_stats; }
+
+    // Most recent first
+    template <typename Search>
+    Node* find(const Search& search)
+    {
+        ++m_stats.lookups;
+        for (size_t i = 1; i <= Size; ++i) {
+            Node* node = m_nodes[(m_next + Size - i) % Size];
+            if (node != nullptr && !search.less(node) && !search.greater(node)) {
+                ++m_stats.hits;
+                return node;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void remember(Node* node)
+    {
+        m_nodes[m_next] = node;
+        m_next = (m_next + 1) % Size;
+    }
+
+    // The node is going away
+    void forget(const Node* node)
+    {
+        for (auto& cached : m_nodes) {
+            if (cached == node) {
+                cached = nullptr;
+            }
+        }
+    }
+
+    // All nodes moved or went away
+    void flush()
+    {
+        std::fill(std::begin(m_nodes), std::end(m_nodes), nullptr);
+        m_next = 0;
+    }
+
+    void swap(FindCache& other)
+    {
+        std::swap(m_nodes, other.m_nodes);
+        std::swap(m_next, other.m_next);
+        std::swap(m_enabled, other.m_enabled);
+        std::swap(m_stats, other.m_stats);
+    }
+
+private:
+    Node*          m_nodes[Size] = {};
+    size_t         m_next        = 0;
+    bool           m_enabled     = false;
+    FindCacheStats m_stats;
+};
+
+template <typename Key, typename Value, typename Allocator = std::allocator<Pair<const Key, Value>>, typename Layout = PlainLayout,
+          typename Compare = std::less<Key>, typename Index = NoIndex>
+class RedBlackTree :
+    protected RedBlackTreeBase<naive::TreeNode<Key, Value, Layout>>,
+    private CompareHolder<Compare>
+{
+protected:
+    using TreeNode             = naive::TreeNode<Key, Value, Layout>;
+    using Element              = TreeElement<Key, Value>;
+    using CompareType          = Compare;
+    using ValueType            = typename TreeNode::ValueType;
+    using AllocatorType        = Allocator;
+    using LayoutType           = Layout;
+    using Iterator             = naive::Iterator<RedBlackTree>;
+    using ConstIterator        = naive::ConstIterator<RedBlackTree>;
+    using ReverseIterator      = naive::ReverseIterator<RedBlackTree>;
+    using ReverseConstIterator = naive::ReverseConstIterator<RedBlackTree>;
+    using InsertPosition       = naive::InsertPosition<RedBlackTree>;
+
+private:
+    using NodeAllocator       = typename std::allocator_traits<Allocator>::template rebind_alloc<TreeNode>;
+    using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
+
+    // Cold elements of a ColdValueLayout are allocated separately from the nodes
+    using ValueAllocator       = typename std::allocator_traits<Allocator>::template rebind_alloc<ValueType>;
+    using ValueAllocatorTraits = std::allocator_traits<ValueAllocator>;
+
+    // Layouts with index links keep all nodes in one slab. Growing the slab moves the nodes,
+    // so in that mode every insertion may invalidate iterators, like in a vector.
+    static constexpr bool Contiguous = IsContiguousLayout<Layout>::value;
+
+    // Layouts without parent links find the ancestors of a node by its key, and iterators carry them
+    static constexpr bool ParentFree = TreeNode::ParentFree;
+
+    // An index policy other than NoIndex answers lookups by Key instead of the tree
+    static constexpr bool Indexed = !std::is_same_v<Index, NoIndex>;
+    using IndexTable = typename Index::template Table<TreeNode, Allocator>;
+
+    // Keys std::hash can hash may get a membership filter in front of the tree
+    static constexpr bool Hashable = std::is_default_constructible_v<std::hash<Key>>;
+
+    // Descents find_many() keeps in flight, enough to cover the misses a core can have outstanding
+    static constexpr size_t BatchLanes = 16;
+
+    // Elements below which bulk_load() doesn't hand a bucket to another thread
+    static constexpr size_t MinBulkLoadBucket = 1 << 14;
+
+    // Set operations hand a subtree to another thread from this black height on, 1023 nodes or more
+    static constexpr size_t MinForkBlackHeight = 10;
+
+    // erase_if() relinks the remaining nodes into a new tree when at least 1 in this many elements go,
+    // about where that costs less than erasing them one by one
+    static constexpr size_t RebuildEraseFraction = 6;
+
+    struct NoSlab { };
+    using Slab = std::conditional_t<Contiguous, NodeSlab<TreeNode, NodeAllocator>, NoSlab>;
+
+    static_assert(!TreeNode::InlineKey || std::is_same_v<Key, std::string_view>, "Inline keys are std::string_view");
+    static_assert(!TreeNode::InlineKey || !Contiguous, "Inline keys make nodes of different sizes, they can't share a slab");
+    static_assert(!TreeNode::InlineKey || !IsColdValueLayout<Layout, ValueType>::value, "Inline keys and cold elements don't combine");
+    static_assert(!TreeNode::KeyPrefix || std::is_same_v<Compare, std::less<Key>> || std::is_same_v<Compare, std::less<>>,
+                  "Key prefixes follow the byte order of std::less");
+
+    template <typename K>
+    using Search = SearchKey<K, Compare, TreeNode::KeyPrefix>;
+
+    using CompareBase = CompareHolder<Compare>;
+
+    using Base = RedBlackTreeBase<TreeNode>;
+    using Base::m_root;
+    using Base::m_size;
+    using Base::m_min_node;
+    using Base::m_max_node;
+
+protected:
+    RedBlackTree() = default;
+
+    explicit RedBlackTree(const Allocator& allocator) :
+        m_allocator(allocator),
+        m_index(make_index(allocator)),
+        m_filter(allocator)
+    { }
+
+    RedBlackTree(const Compare& compare, const Allocator& allocator) :
+        CompareBase(compare),
+        m_allocator(allocator),
+        m_index(make_index(allocator)),
+        m_filter(allocator)
+    { }
+
+    RedBlackTree(const RedBlackTree& tree) :
+        Base(),
+        CompareBase(tree.compare()),
+        m_allocator(NodeAllocatorTraits::select_on_container_copy_construction(tree.m_allocator)),
+        m_index(make_index(Allocator(m_allocator))),
+        m_filter(tree.m_filter)
+    {
+        m_find_cache.enable(tree.m_find_cache.enabled());
+        do_copy_from(tree);
+    }
+
+    RedBlackTree(RedBlackTree&& tree) noexcept :
+        Base(std::move(tree)),
+        CompareBase(tree.compare()),
+        m_allocator(std::move(tree.m_allocator)),
+        m_slab(std::move(tree.m_slab))
+    {
+        ++tree.m_version;
+        if constexpr (Indexed) {
+            m_index.swap(tree.m_index);
+        }
+        m_find_cache.swap(tree.m_find_cache);
+        m_filter.swap(tree.m_filter);
+    }
+
+    ~RedBlackTree()
+    {
+        clear();
+        if constexpr (Contiguous) {
+            m_slab.release(m_allocator);
+        }
+    }
+
+    RedBlackTree& operator=(const RedBlackTree& tree)
+    {
+        if (&tree != this) {
+            clear();
+            if constexpr (NodeAllocatorTraits::propagate_on_container_copy_assignment::value) {
+                m_allocator = tree.m_allocator;
+            }
+            static_cast<CompareBase&>(*this) = tree;
+            m_filter = tree.m_filter;
+            do_copy_from(tree);
+        }
+        return *this;
+    }
+
+    RedBlackTree& operator=(RedBlackTree&& tree)
+    {
+        if constexpr (!NodeAllocatorTraits::propagate_on_container_move_assignment::value &&
+                      !NodeAllocatorTraits::is_always_equal::value) {
+            if (m_allocator != tree.m_allocator) {
+                // Nodes of the other tree can't be freed with our allocator, so copy them
+                clear();
+                static_cast<CompareBase&>(*this) = tree;
+                m_filter = tree.m_filter;
+                do_copy_from(tree);
+                tree.clear();
+                return *this;
+            }
+        }
+
+        swap(tree);
+        return *this;
+    }
+
+protected:
+    Iterator begin()
+    { return Iterator(this, m_min_node); }
+    Iterator end()
+    { return Iterator(this, nullptr); }
+
+    ConstIterator cbegin() const
+    { return ConstIterator(this, m_min_node); }
+    ConstIterator cend() const
+    { return ConstIterator(this, nullptr); }
+
+    ReverseIterator rbegin()
+    { return ReverseIterator(this, get_last()); }
+    ReverseIterator rend()
+    { return ReverseIterator(this, nullptr); }
+
+    ReverseConstIterator rcbegin() const
+    { return ReverseIterator(this, get_last()); }
+    ReverseConstIterator rcend() const
+    { return ReverseIterator(this, nullptr); }
+
+protected:
+    bool empty() const
+    { return m_size == 0; }
+    size_t size() const
+    { return m_size; }
+
+    // Pre-size the node allocator for `count` elements. Only allocators providing reserve() (e.g. PoolAllocator) react on it
+    void reserve(size_t count)
+    {
+        if constexpr (Contiguous) {
+            if (count > m_slab.capacity()) {
+                reallocate_slab(count);
+            }
+        } else if constexpr (HasReserve<NodeAllocator>::value) {
+            if (count > m_size) {
+                m_allocator.reserve(count - m_size);
+            }
+        }
+    }
+
+    // Return unused node memory. Only allocators providing shrink_to_fit() (e.g. PoolAllocator) react on it
+    void shrink_to_fit()
+    {
+        if constexpr (Contiguous) {
+            // Free slots in the middle of the slab stay, only the unused tail is returned
+            if (m_size == 0) {
+                m_slab.release(m_allocator);
+            } else {
+                reallocate_slab(0);
+            }
+        } else if constexpr (HasShrinkToFit<NodeAllocator>::value) {
+            m_allocator.shrink_to_fit();
+        }
+    }
+
+    Allocator get_allocator() const
+    { return Allocator(m_allocator); }
+
+    Compare key_comp() const
+    { return this->compare(); }
+
+    void enable_find_cache(bool enable)
+    { m_find_cache.enable(enable); }
+
+    bool find_cache_enabled() const
+    { return m_find_cache.enabled(); }
+
+    FindCacheStats find_cache_stats() const
+    { return m_find_cache.stats(); }
+
+    // Put a counting Bloom filter of the keys in front of find() and count(), so that most lookups
+    // of absent keys don't descend. It grows with the tree and costs about 1.2 * -ln(rate) / ln(2)^2
+    // half-bytes per element, e.g. 7 bytes at a 1% false positive rate.
+    void enable_filter(double false_positive_rate)
+    {
+        static_assert(Hashable, "The filter hashes keys with std::hash<Key>");
+        rebuild_filter(2 * m_size, false_positive_rate);
+    }
+
+    void disable_filter()
+    { m_filter.release(); }
+
+    bool filter_enabled() const
+    { return m_filter.enabled(); }
+
+    // Whether the tree holds together: the red-black rules, parent links if any, key order, size, first
+    // and last node, and whether the index finds every node and the filter lets every key through.
+    // Walks every node, for tests and debugging.
+    bool verify() const
+    {
+        if (m_root == nullptr) {
+            return m_size == 0 && m_min_node == nullptr && m_max_node == nullptr;
+        }
+
+        if constexpr (!ParentFree) {
+            if (m_root->parent() != nullptr) {
+                return false;
+            }
+        }
+
+        size_t count = 0;
+        if (!m_root->is_black() || verify_subtree(m_root, count) == 0) {
+            return false;
+        }
+        if (count != m_size || m_min_node != find_min(m_root) || m_max_node != find_max(m_root)) {
+            return false;
+        }
+
+        for (ConstIterator it = cbegin(), next = cbegin(); ++next != cend(); it = next) {
+            if (!this->compare()(it.m_current->key(), next.m_current->key())) {
+                return false;
+            }
+        }
+
+        for (ConstIterator it = cbegin(); it != cend(); ++it) {
+            if constexpr (Indexed) {
+                const TreeNode* node = it.m_current;
+                if (m_index.find(node->key(), [&](const TreeNode* other) { return other == node; }) != node) {
+                    return false;
+                }
+            }
+            if constexpr (Hashable) {
+                if (m_filter.enabled() && !m_filter.may_contain(std::hash<Key>()(it.m_current->key()))) {
+                    return false;
+                }
+            }
+        }
+
+        if constexpr (Indexed) {
+            return m_index.size() == m_size;
+        }
+        return true;
+    }
+
+protected:
+    template <typename ... Args>
+    Pair<Iterator, bool> emplace(Args&& ... args)
+    {
+        if constexpr (Contiguous) {
+            if (m_slab.full()) {
+                // The arguments may refer to an element, so take a copy before all nodes move
+                ValueType value(std::forward<Args>(args)...);
+                prepare_insert(nullptr);
+                return do_emplace(m_root, std::move(value));
+            }
+        }
+
+        return do_emplace(m_root, std::forward<Args>(args)...);
+    }
+
+    template <typename ... Args>
+    Pair<Iterator, bool> emplace_hint(ConstIterator hint, Args && ... args)
+    {
+        if constexpr (Contiguous) {
+            if (m_slab.full()) {
+                ValueType value(std::forward<Args>(args)...);
+                return do_emplace_hint(prepare_insert(hint.m_current), std::move(value));
+            }
+        }
+
+        return do_emplace_hint(hint.m_current, std::forward<Args>(args)...);
+    }
+
+    // Lookup that, for a missing key, also tells where it would be linked. The iterator is end() then,
+    // and emplace_at() with the position inserts the key without searching again.
+    Pair<Iterator, InsertPosition> find_or_position(const Key& key)
+    {
+        const Location location = locate(key);
+        if (location.found) {
+            return MakePair(Iterator(this, location.node), InsertPosition());
+        }
+
+        return MakePair(end(), InsertPosition(this, m_version, location.node, location.right));
+    }
+
+    // The arguments construct an element with the key the position was found for. A position from
+    // another tree or from before a modification is ignored and the key searched for as in emplace()
+    template <typename ... Args>
+    Pair<Iterator, bool> emplace_at(InsertPosition position, Args && ... args)
+    {
+        if (position.m_tree != this || position.m_version != m_version) {
+            return emplace(std::forward<Args>(args)...);
+        }
+
+        if constexpr (Contiguous) {
+            if (m_slab.full()) {
+                ValueType value(std::forward<Args>(args)...);
+                position.m_parent = prepare_insert(position.m_parent);
+                return link_at(position, Element::key(value), std::move(value));
+            }
+        }
+
+        return with_key([&](const Key& key, auto && ... values) {
+            return link_at(position, key, std::forward<decltype(values)>(values)...);
+        }, std::forward<Args>(args)...);
+    }
+
+    // Maps: inserts the element (key, Value(args...)) unless the key is present. Nothing is
+    // constructed for a present key.
+    template <typename K, typename ... Args>
+    Pair<Iterator, bool> try_emplace(K&& key, Args && ... args)
+    {
+        const Location location = locate(key);
+        if (location.found) {
+            return MakePair(Iterator(this, location.node), false);
+        }
+
+        return link_located(location, std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    // Maps: assigns the value to the element with the key, or inserts (key, value)
+    template <typename K, typename V>
+    Pair<Iterator, bool> insert_or_assign(K&& key, V&& value)
+    {
+        const Location location = locate(key);
+        if (location.found) {
+            location.node->value().second = std::forward<V>(value);
+            return MakePair(Iterator(this, location.node), false);
+        }
+
+        return link_located(location, std::forward<K>(key), std::forward<V>(value));
+    }
+
+    // Maps: calls combine(mapped value, value) on the element with the key, or inserts (key, value)
+    template <typename K, typename V, typename Combine>
+    Pair<Iterator, bool> upsert(K&& key, V&& value, Combine&& combine)
+    {
+        const Location location = locate(key);
+        if (location.found) {
+            combine(location.node->value().second, std::forward<V>(value));
+            return MakePair(Iterator(this, location.node), false);
+        }
+
+        return link_located(location, std::forward<K>(key), std::forward<V>(value));
+    }
+
+    // Maps: applies BatchOps sorted by key; those with equal keys take effect in their order. The
+    // first key is searched for from the root, each next one from the node of the one before, climbing
+    // and descending only over the keys between them. A missing key is linked next to the bound found
+    // without searching again.
+    template <typename ForwardIt>
+    void apply_batch(ForwardIt first, ForwardIt last)
+    {
+        assert(is_sorted_batch(first, last));
+
+        TreeNode* position = nullptr;
+        for (; first != last; ++first) {
+            auto&& op = *first;
+            TreeNode* bound = (position != nullptr) ? do_lower_bound_from(position, op.key) : do_lower_bound(op.key);
+            const bool found = (bound != nullptr && !this->compare()(op.key, bound->key()));
+            if (op.action == BatchAction::Erase) {
+                if (found) {
+                    ConstIterator after(this, bound);
+                    ++after;
+                    position = after.m_current;
+                    do_erase(bound);
+                } else if (bound != nullptr) {
+                    position = bound;
+                }
+            } else if (found) {
+                bound->value().second = std::forward<decltype(op)>(op).value;
+                position = bound;
+            } else {
+                Location location{m_max_node, true, false};
+                if (bound != nullptr) {
+                    location = (bound->left_child() == nullptr) ? Location{bound, false, false}
+                                                                : Location{find_max(bound->left_child()), true, false};
+                }
+                position = link_located(location, std::forward<decltype(op)>(op).key,
+                                        std::forward<decltype(op)>(op).value).first.m_current;
+            }
+        }
+    }
+
+    Iterator erase(ConstIterator pos)
+    {
+        TreeNode* node = pos.m_current;
+        ++pos;
+        do_erase(node);
+        return Iterator(this, pos.m_current);
+    }
+
+    void swap(RedBlackTree& other) noexcept
+    {
+        if (&other != this) {
+            if constexpr (NodeAllocatorTraits::propagate_on_container_swap::value) {
+                std::swap(m_allocator, other.m_allocator);
+            }
+            if constexpr (Contiguous) {
+                m_slab.swap(other.m_slab);
+            }
+            this->swap_compare(other);
+            this->swap_nodes(other);
+            ++m_version;
+            ++other.m_version;
+            if constexpr (Indexed) {
+                m_index.swap(other.m_index);
+            }
+            m_find_cache.swap(other.m_find_cache);
+            m_filter.swap(other.m_filter);
+        }
+    }
+
+    // Lookups take a Key or, with a transparent comparator, anything the comparator accepts
+
+    template <typename K>
+    size_t count(const K& key) const
+    { return (do_find(key) != nullptr) ? 1 : 0; }
+
+    template <typename K>
+    ConstIterator find(const K& key) const
+    { return ConstIterator(this, do_find(key)); }
+
+    template <typename K>
+    Iterator find(const K& key)
+    { return Iterator(this, do_find(key)); }
+
+    template <typename K>
+    Pair<Iterator, Iterator> equal_range(const K& key)
+    {
+        auto result = do_equal_range(key);
+        return MakePair(Iterator(this, result.first), Iterator(this, result.second));
+    }
+
+    template <typename K>
+    Pair<ConstIterator, ConstIterator> equal_range(const K& key) const
+    {
+        auto result = do_equal_range(key);
+        return MakePair(ConstIterator(this, result.first), ConstIterator(this, result.second));
+    }
+
+    template <typename K>
+    Iterator lower_bound(const K& key)
+    { return Iterator(this, do_lower_bound(key)); }
+
+    template <typename K>
+    ConstIterator lower_bound(const K& key) const
+    { return ConstIterator(this, do_lower_bound(key)); }
+
+    // Finger searches: like find() and lower_bound(), but starting from `hint` instead of the root.
+    // O(log d) for a result d elements away from the hint.
+
+    template <typename K>
+    Iterator find(ConstIterator hint, const K& key)
+    { return Iterator(this, do_find_from(hint.m_current, key)); }
+
+    template <typename K>
+    ConstIterator find(ConstIterator hint, const K& key) const
+    { return ConstIterator(this, do_find_from(hint.m_current, key)); }
+
+    template <typename K>
+    Iterator lower_bound(ConstIterator hint, const K& key)
+    { return Iterator(this, do_lower_bound_from(hint.m_current, key)); }
+
+    template <typename K>
+    ConstIterator lower_bound(ConstIterator hint, const K& key) const
+    { return ConstIterator(this, do_lower_bound_from(hint.m_current, key)); }
+
+    template <typename K>
+    Iterator upper_bound(const K& key)
+    { return Iterator(this, do_upper_bound(key)); }
+
+    template <typename K>
+    ConstIterator upper_bound(const K& key) const
+    { return ConstIterator(this, do_upper_bound(key)); }
+
+    // Batched lookups: out[i] is find(first[i]), and count_many() is how many of the keys are found.
+    // The descents run interleaved, so the cache misses of different keys overlap.
+
+    template <typename ForwardIt, typename RandomIt>
+    void find_many(ForwardIt first, ForwardIt last, RandomIt out) const
+    { do_find_many(first, last, [&](size_t index, TreeNode* node) { out[index] = ConstIterator(this, node); }); }
+
+    template <typename ForwardIt, typename RandomIt>
+    void find_many(ForwardIt first, ForwardIt last, RandomIt out)
+    { do_find_many(first, last, [&](size_t index, TreeNode* node) { out[index] = Iterator(this, node); }); }
+
+    template <typename ForwardIt>
+    size_t count_many(ForwardIt first, ForwardIt last) const
+    {
+        size_t count = 0;
+        do_find_many(first, last, [&](size_t, TreeNode* node) { count += (node != nullptr) ? 1 : 0; });
+        return count;
+    }
+
+    void clear()
+    {
+        ++m_version;
+        if constexpr (Indexed) {
+            m_index.clear();
+        }
+        m_find_cache.flush();
+        m_filter.clear();
+        if (m_root != nullptr) {
+            do_clear(m_root);
+            m_root = nullptr;
+        }
+        if constexpr (Contiguous) {
+            m_slab.clear();
+        }
+        this->reset();
+    }
+
+    // Replaces the contents with a range sorted by key without equal keys, in linear time: the tree
+    // is built balanced and coloured as it is, without searches or rebalancing. The nodes are
+    // allocated in key order, all at once for contiguous layouts and allocators with reserve().
+    template <typename ForwardIt>
+    void assign_sorted(ForwardIt first, ForwardIt last)
+    {
+        assert(is_sorted_unique(first, last));
+
+        clear();
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        if (count == 0) {
+            return;
+        }
+
+        reserve(count);
+        m_root = build_sorted(first, count, nullptr, 0, last_level(count));
+        m_size = count;
+        m_min_node = find_min(m_root);
+        m_max_node = find_max(m_root);
+        rebuild_index();
+        if constexpr (Hashable) {
+            if (m_filter.enabled()) {
+                rebuild_filter(std::max(2 * m_size, m_filter.capacity()), m_filter.false_positive_rate());
+            }
+        }
+    }
+
+    // Replaces the contents with a range in any order, on up to `threads` threads (0: one per core).
+    // Keys sampled from the range split it into a bucket per thread. Each thread sorts its slice
+    // of the range into the buckets, then sorts one bucket, drops its equal keys and builds it as a
+    // balanced subtree. The subtrees are joined in order at the end. Nodes are built in parallel
+    // with std::allocator only, as other allocators and contiguous slabs aren't thread-safe.
+    template <typename ForwardIt>
+    void bulk_load(ForwardIt first, ForwardIt last, unsigned threads, DuplicateKeys duplicates)
+    {
+        // Elements while they are sorted: the key isn't const, so that they can be moved around
+        using LoadElement = std::conditional_t<std::is_void_v<Value>, Key, Pair<Key, Value>>;
+        constexpr bool ParallelNodes = !Contiguous && std::is_same_v<Allocator, std::allocator<typename Allocator::value_type>>;
+
+        clear();
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        if (count == 0) {
+            return;
+        }
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        const size_t buckets = std::max<size_t>(1, std::min<size_t>(threads, count / MinBulkLoadBucket));
+
+        std::vector<ForwardIt> slices(1, first);
+        for (size_t slice = 1; slice <= buckets; ++slice) {
+            slices.push_back(std::next(slices.back(), count * slice / buckets - count * (slice - 1) / buckets));
+        }
+
+        // Bucket b holds the keys from splitters[b - 1] up to splitters[b], so equal keys share a bucket
+        std::vector<Key> splitters;
+        if (buckets > 1) {
+            const size_t samples = std::min(count, 64 * buckets);
+            ForwardIt sample = first;
+            size_t position = 0;
+            for (size_t index = 0; index < samples; ++index) {
+                std::advance(sample, count * index / samples - position);
+                position = count * index / samples;
+                splitters.emplace_back(element_key(*sample));
+            }
+
+            std::sort(splitters.begin(), splitters.end(), this->compare());
+            for (size_t bucket = 1; bucket < buckets; ++bucket) {
+                splitters[bucket - 1] = std::move(splitters[samples * bucket / buckets]);
+            }
+            splitters.resize(buckets - 1);
+        }
+
+        // pieces[slice][bucket]: what a slice holds of a bucket, in the order of the range
+        std::vector<std::vector<std::vector<LoadElement>>> pieces(buckets, std::vector<std::vector<LoadElement>>(buckets));
+        run_in_parallel(buckets, [&](size_t slice) {
+            for (ForwardIt it = slices[slice]; it != slices[slice + 1]; ++it) {
+                const auto bucket = std::upper_bound(splitters.begin(), splitters.end(), element_key(*it), this->compare());
+                pieces[slice][bucket - splitters.begin()].emplace_back(*it);
+            }
+        });
+
+        // A bucket's first element is a node of its own, which joins the bucket's subtree to the tree
+        struct Subtree
+        {
+            TreeNode* pivot = nullptr;
+            TreeNode* root  = nullptr;
+            size_t    size  = 0;
+        };
+
+        std::vector<std::vector<LoadElement>> sorted(buckets);
+        std::vector<Subtree> subtrees(buckets);
+        auto sort_bucket = [&](size_t bucket) {
+            std::vector<LoadElement>& elements = sorted[bucket];
+            for (size_t slice = 0; slice < buckets; ++slice) {
+                std::vector<LoadElement>& piece = pieces[slice][bucket];
+                if (elements.empty()) {
+                    elements.swap(piece);
+                } else {
+                    elements.insert(elements.end(), std::make_move_iterator(piece.begin()), std::make_move_iterator(piece.end()));
+                    std::vector<LoadElement>().swap(piece);
+                }
+            }
+
+            std::stable_sort(elements.begin(), elements.end(), [&](const LoadElement& lhs, const LoadElement& rhs) {
+                return this->compare()(element_key(lhs), element_key(rhs));
+            });
+            remove_equal_keys(elements, duplicates);
+        };
+
+        auto build_bucket = [&](size_t bucket) {
+            if (sorted[bucket].empty()) {
+                return;
+            }
+
+            Subtree& subtree = subtrees[bucket];
+            auto elements = std::make_move_iterator(sorted[bucket].begin());
+            with_key([&](const Key& key, auto && ... values) {
+                subtree.pivot = create_node(nullptr, key, std::forward<decltype(values)>(values)...);
+                return MakePair(Iterator(this, subtree.pivot), true);
+            }, *elements);
+
+            ++elements;
+            subtree.root = build_sorted(elements, sorted[bucket].size() - 1, nullptr, 0, last_level(sorted[bucket].size() - 1));
+            subtree.size = sorted[bucket].size() - 1;
+            std::vector<LoadElement>().swap(sorted[bucket]);
+        };
+
+        try {
+            run_in_parallel(buckets, [&](size_t bucket) {
+                sort_bucket(bucket);
+                if constexpr (ParallelNodes) {
+                    build_bucket(bucket);
+                }
+            });
+
+            if constexpr (!ParallelNodes) {
+                size_t total = 0;
+                for (const auto& elements : sorted) {
+                    total += elements.size();
+                }
+
+                reserve(total);
+                for (size_t bucket = 0; bucket < buckets; ++bucket) {
+                    build_bucket(bucket);
+                }
+            }
+        } catch (...) {
+            for (Subtree& subtree : subtrees) {
+                if (subtree.pivot != nullptr) {
+                    destroy_node(subtree.pivot);
+                }
+                if (subtree.root != nullptr) {
+                    do_clear(subtree.root);
+                }
+            }
+            throw;
+        }
+
+        for (const Subtree& subtree : subtrees) {
+            if (subtree.pivot != nullptr) {
+                this->join_right(subtree.pivot, subtree.root, subtree.size);
+            }
+        }
+
+        rebuild_index();
+        if constexpr (Hashable) {
+            if (m_filter.enabled()) {
+                rebuild_filter(std::max(2 * m_size, m_filter.capacity()), m_filter.false_positive_rate());
+            }
+        }
+    }
+
+    // Range erasure, split and join cut the tree at the bounds and join the pieces back: O(log n)
+    // for the restructuring, plus the nodes freed. Nodes move to another tree as they are when it
+    // can free them and they aren't kept in a slab, otherwise the elements are moved one by one.
+
+    // Erases the elements from `first` up to `last`
+    Iterator erase(ConstIterator first, ConstIterator last)
+    {
+        if (first != last) {
+            forget_nodes(first.m_current, last.m_current);
+            m_size -= do_clear(cut_range(first.m_current, last.m_current));
+        }
+        return Iterator(this, last.m_current);
+    }
+
+    // Erases the elements with keys from `lower` up to `upper`, returns how many there were
+    template <typename K>
+    size_t erase_range(const K& lower, const K& upper)
+    {
+        if (!this->compare()(lower, upper)) {
+            return 0;
+        }
+
+        const size_t size = m_size;
+        erase(ConstIterator(this, do_lower_bound(lower)), ConstIterator(this, do_lower_bound(upper)));
+        return size - m_size;
+    }
+
+    // Erases the elements pred(element) is true for, calling it once on each in key order, and
+    // returns how many there were. The walk keeps the path on a stack instead of climbing back up
+    // through parents, and sorts the nodes into those that go and those that stay. When few go they
+    // are erased one by one. From 1 in RebuildEraseFraction on, they are freed and the others
+    // relinked into a balanced tree as assign_sorted() builds it, in linear time, instead of
+    // rebalancing after every erasure.
+    template <typename Predicate>
+    size_t erase_if(Predicate& pred)
+    {
+        std::vector<TreeNode*> erased;
+        std::vector<TreeNode*> kept;
+        std::vector<TreeNode*> pending;
+        for (TreeNode* node = m_root; node != nullptr; node = node->left_child()) {
+            pending.push_back(node);
+        }
+
+        while (!pending.empty()) {
+            TreeNode* node = pending.back();
+            pending.pop_back();
+            for (TreeNode* right = node->right_child(); right != nullptr; right = right->left_child()) {
+                pending.push_back(right);
+            }
+
+            if (pred(*Iterator(this, node))) {
+                erased.push_back(node);
+            } else {
+                kept.push_back(node);
+            }
+        }
+
+        if (erased.size() * RebuildEraseFraction < m_size) {
+            for (TreeNode* node : erased) {
+                do_erase(node);
+            }
+            return erased.size();
+        }
+
+        ++m_version;
+        m_find_cache.flush();
+        for (TreeNode* node : erased) {
+            forget_node(node);
+            destroy_node(node);
+        }
+
+        m_root = link_sorted(kept.data(), kept.size(), nullptr, 0, last_level(kept.size()));
+        m_size = kept.size();
+        m_min_node = kept.empty() ? nullptr : kept.front();
+        m_max_node = kept.empty() ? nullptr : kept.back();
+        return erased.size();
+    }
+
+    // Moves the elements from `first` up to `last` into `tree`, which must be empty
+    void move_range(ConstIterator first, ConstIterator last, RedBlackTree& tree)
+    {
+        if (first == last) {
+            return;
+        }
+
+        if (shares_nodes_with(tree)) {
+            forget_nodes(first.m_current, last.m_current);
+            TreeNode* range = cut_range(first.m_current, last.m_current);
+            const size_t count = this->count_subtrees(range, m_root, m_size).first;
+            m_size -= count;
+
+            ++tree.m_version;
+            tree.m_root = range;
+            tree.m_size = count;
+            tree.m_min_node = find_min(range);
+            tree.m_max_node = find_max(range);
+            tree.remember_nodes(tree.m_min_node, count);
+        } else {
+            // Cut the range out before moving from it: the cut searches by the keys at its ends, and
+            // the elements of a set are their keys
+            forget_nodes(first.m_current, last.m_current);
+            TreeNode* range = cut_range(first.m_current, last.m_current);
+            try {
+                NodePath<TreeNode> path;
+                for (TreeNode* node = path.first(range); node != nullptr; node = path.next(node)) {
+                    tree.emplace_hint(tree.cend(), std::move(node->value()));
+                }
+            } catch (...) {
+                m_size -= do_clear(range);
+                throw;
+            }
+            m_size -= do_clear(range);
+        }
+    }
+
+    // Appends the elements of `tree`, whose keys must all be greater than ours, leaving it empty
+    void join(RedBlackTree& tree)
+    {
+        assert(empty() || tree.empty() || this->compare()(m_max_node->key(), tree.m_min_node->key()));
+        if (&tree == this || tree.empty()) {
+            return;
+        }
+
+        if (shares_nodes_with(tree)) {
+            TreeNode* min_node = tree.m_min_node;
+            TreeNode* max_node = tree.m_max_node;
+            TreeNode* root = tree.m_root;
+            const size_t count = tree.m_size;
+            tree.forget_nodes(min_node, nullptr);
+            ++tree.m_version;
+            tree.m_find_cache.flush();
+            tree.reset();
+
+            ++m_version;
+            m_root = this->concatenate_subtrees(Base::detached(m_root), Base::detached(root)).root;
+            if (m_min_node == nullptr) {
+                m_min_node = min_node;
+            }
+            m_max_node = max_node;
+            m_size += count;
+            remember_nodes(min_node, count);
+        } else {
+            for (auto it = tree.cbegin(); it != tree.cend(); ++it) {
+                emplace_hint(cend(), std::move(it.m_current->value()));
+            }
+            tree.clear();
+        }
+    }
+
+    // Set operations with `tree`, which is left empty. When the nodes can move between the trees,
+    // they are join based: the tree is split at the root of the other, the two sides are combined
+    // recursively, on up to `threads` threads (0: one per core), and joined back at the root.
+    // O(m log(n/m + 1)) for sizes m <= n. Otherwise each element of one tree is looked up in the
+    // other with a finger search, on the calling thread. Comparisons and `merge` must not throw;
+    // `merge` may be called on several threads at once.
+
+    // Moves the elements of `tree` here. For a key in both trees, merge(mapped value here, mapped
+    // value there as an rvalue) combines them, for maps
+    template <typename Merge>
+    void unite(RedBlackTree& tree, Merge& merge, unsigned threads)
+    {
+        if (&tree == this) {
+            return;
+        }
+
+        if (shares_nodes_with(tree)) {
+            set_operation(tree, threads, [&](const Detached& own, const Detached& other, SetOperationTask& task, unsigned forks) {
+                return unite_subtrees(own, other, merge, task, forks);
+            });
+            return;
+        }
+
+        TreeNode* position = m_min_node;
+        for (auto it = tree.cbegin(); it != tree.cend(); ++it) {
+            TreeNode* node = it.m_current;
+            position = do_lower_bound_from(position, node->key());
+            if (position != nullptr && !this->compare()(node->key(), position->key())) {
+                if constexpr (!std::is_void_v<Value>) {
+                    merge(position->value().second, std::move(node->value().second));
+                }
+            } else {
+                position = emplace_hint(ConstIterator(this, position), std::move(node->value())).first.m_current;
+            }
+        }
+        tree.clear();
+    }
+
+    // Keeps the elements whose keys are in `tree` too
+    void intersect(RedBlackTree& tree, unsigned threads)
+    {
+        if (&tree == this) {
+            return;
+        }
+
+        if (shares_nodes_with(tree)) {
+            set_operation(tree, threads, [&](const Detached& own, const Detached& other, SetOperationTask& task, unsigned forks) {
+                return intersect_subtrees(own, other, task, forks);
+            });
+            return;
+        }
+
+        TreeNode* position = tree.m_min_node;
+        for (auto it = cbegin(); it != cend(); ) {
+            position = tree.do_lower_bound_from(position, it.m_current->key());
+            if (position == nullptr || this->compare()(it.m_current->key(), position->key())) {
+                it = erase(it);
+            } else {
+                ++it;
+            }
+        }
+        tree.clear();
+    }
+
+    // Erases the elements whose keys are in `tree`
+    void subtract(RedBlackTree& tree, unsigned threads)
+    {
+        if (&tree == this) {
+            clear();
+            return;
+        }
+
+        if (shares_nodes_with(tree)) {
+            set_operation(tree, threads, [&](const Detached& own, const Detached& other, SetOperationTask& task, unsigned forks) {
+                return subtract_subtrees(own, other, task, forks);
+            });
+            return;
+        }
+
+        TreeNode* position = m_min_node;
+        for (auto it = tree.cbegin(); it != tree.cend() && m_root != nullptr; ++it) {
+            position = do_lower_bound_from(position, it.m_current->key());
+            if (position != nullptr && !this->compare()(it.m_current->key(), position->key())) {
+                position = erase(ConstIterator(this, position)).m_current;
+            }
+        }
+        tree.clear();
+    }
+
+    // Fills an empty tree from a range: with assign_sorted() if it can be walked twice and is sorted
+    // without equal keys, element by element otherwise
+    template <typename InputIt>
+    void assign_range(InputIt first, InputIt last)
+    {
+        if constexpr (IsForwardIterator<InputIt>::value) {
+            if (is_sorted_unique(first, last)) {
+                assign_sorted(first, last);
+                return;
+            }
+        }
+
+        for (; first != last; ++first) {
+            emplace_hint(cend(), *first);
+        }
+    }
+
+    // Black height of the subtree plus one, counting its nodes, or 0 if it breaks a red-black rule
+    // or a parent link
+    static size_t verify_subtree(const TreeNode* node, size_t& count)
+    {
+        if (node == nullptr) {
+            return 1;
+        }
+
+        ++count;
+        for (const TreeNode* child : {node->left_child(), node->right_child()}) {
+            if (child == nullptr) {
+                continue;
+            }
+            if constexpr (!ParentFree) {
+                if (child->parent() != node) {
+                    return 0;
+                }
+            }
+            if (node->is_red() && child->is_red()) {
+                return 0;
+            }
+        }
+
+        const size_t left = verify_subtree(node->left_child(), count);
+        const size_t right = verify_subtree(node->right_child(), count);
+        if (left == 0 || left != right) {
+            return 0;
+        }
+        return left + (node->is_black() ? 1 : 0);
+    }
+
+    // Whether every element's key is less than the next one's
+    template <typename ForwardIt>
+    bool is_sorted_unique(ForwardIt first, ForwardIt last) const
+    {
+        if (first == last) {
+            return true;
+        }
+
+        for (ForwardIt next = std::next(first); next != last; first = next, ++next) {
+            if (!this->compare()(element_key(*first), element_key(*next))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Whether no BatchOp's key is less than the one before
+    template <typename ForwardIt>
+    bool is_sorted_batch(ForwardIt first, ForwardIt last) const
+    {
+        if (first == last) {
+            return true;
+        }
+
+        for (ForwardIt next = std::next(first); next != last; first = next, ++next) {
+            if (this->compare()((*next).key, (*first).key)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Move the nodes into fresh memory laid out in the given order, so that a descent touches few
+    // cache lines: van Emde Boas keeps every small subtree together, breadth-first keeps the top
+    // levels together and depth-first puts each left child next to its parent. Contiguous layouts
+    // get a slab without holes, PoolAllocator hands out a fresh block, other allocators are asked
+    // for the nodes one after another. Keys, colours and shape stay the same. Invalidates iterators.
+    void compact(CompactOrder order = CompactOrder::VanEmdeBoas)
+    {
+        ++m_version;
+        m_find_cache.flush();
+        if (m_root == nullptr) {
+            shrink_to_fit();
+            return;
+        }
+
+        std::vector<TreeNode*> old_nodes;
+        old_nodes.reserve(m_size);
+        switch (order) {
+        case CompactOrder::BreadthFirst:
+            breadth_first_order(old_nodes);
+            break;
+        case CompactOrder::DepthFirst:
+            depth_first_order(m_root, old_nodes);
+            break;
+        case CompactOrder::VanEmdeBoas:
+            van_emde_boas_order(m_root, subtree_height(m_root), old_nodes);
+            break;
+        }
+
+        Slab old_slab;
+        if constexpr (Contiguous) {
+            old_slab.swap(m_slab);
+            m_slab.reallocate(m_allocator, m_size, Layout::MaxNodes);
+        } else if constexpr (HasReserveContiguous<NodeAllocator>::value) {
+            m_allocator.reserve_contiguous(m_size);
+        }
+
+        // All memory is taken before the first element moves, so that once one has, nothing can fail.
+        // If an element is copied instead and that throws, the old nodes are still as they were.
+        std::vector<TreeNode*> new_nodes;
+        std::vector<Pair<TreeNode*, TreeNode*>> relocations;
+        new_nodes.reserve(m_size);
+        relocations.reserve(m_size);
+        size_t constructed = 0;
+        try {
+            for (TreeNode* node : old_nodes) {
+                new_nodes.push_back(allocate_duplicate(node));
+            }
+            for (; constructed < m_size; ++constructed) {
+                construct_duplicate(new_nodes[constructed], old_nodes[constructed]);
+            }
+        } catch (...) {
+            for (size_t i = 0; i < new_nodes.size(); ++i) {
+                if (i < constructed) {
+                    NodeAllocatorTraits::destroy(m_allocator, new_nodes[i]);
+                }
+                deallocate_node(new_nodes[i], node_count(old_nodes[i]));
+            }
+            if constexpr (Contiguous) {
+                m_slab.release(m_allocator);
+                m_slab.swap(old_slab);
+            }
+            throw;
+        }
+
+        // Link the new nodes the way the old ones are linked
+        for (size_t i = 0; i < m_size; ++i) {
+            relocations.push_back(MakePair(old_nodes[i], new_nodes[i]));
+        }
+
+        auto by_old_node = [](const Pair<TreeNode*, TreeNode*>& relocation, TreeNode* node) {
+            return std::less<TreeNode*>()(relocation.first, node);
+        };
+        std::sort(relocations.begin(), relocations.end(),
+            [&](const auto& lhs, const auto& rhs) { return by_old_node(lhs, rhs.first); });
+
+        auto relocated = [&](TreeNode* node) -> TreeNode* {
+            if (node == nullptr) {
+                return nullptr;
+            }
+            return std::lower_bound(relocations.begin(), relocations.end(), node, by_old_node)->second;
+        };
+
+        for (size_t i = 0; i < m_size; ++i) {
+            TreeNode* node = new_nodes[i];
+            node->set_color(old_nodes[i]->is_black());
+
+            node->set_left_child(relocated(old_nodes[i]->left_child()));
+            if (node->left_child() != nullptr) {
+                node->left_child()->set_parent(node);
+            }
+
+            node->set_right_child(relocated(old_nodes[i]->right_child()));
+            if (node->right_child() != nullptr) {
+                node->right_child()->set_parent(node);
+            }
+        }
+
+        m_root = relocated(m_root);
+        m_min_node = relocated(m_min_node);
+        m_max_node = relocated(m_max_node);
+        rebuild_index();
+
+        for (TreeNode* node : old_nodes) {
+            if constexpr (Contiguous) {
+                NodeAllocatorTraits::destroy(m_allocator, node);
+            } else {
+                release_node(node);
+            }
+        }
+
+        if constexpr (Contiguous) {
+            old_slab.clear();
+            old_slab.release(m_allocator);
+        }
+    }
+
+private:
+    template <typename ... Args>
+    Pair<Iterator, bool> do_emplace(TreeNode* node, Args && ... args)
+    {
+        return with_key([&](const Key& key, auto && ... values) {
+            return emplace_located(do_locate(node, key), key, std::forward<decltype(values)>(values)...);
+        }, std::forward<Args>(args)...);
+    }
+
+    // The element goes right before `hint`, nullptr meaning at the end
+    template <typename ... Args>
+    Pair<Iterator, bool> do_emplace_hint(TreeNode* hint, Args && ... args)
+    {
+        return with_key([&](const Key& key, auto && ... values) {
+            return emplace_located(do_locate_hint(hint, key), key, std::forward<decltype(values)>(values)...);
+        }, std::forward<Args>(args)...);
+    }
+
+    // Calls f(key, args...) with the key of the element and arguments that construct it, before
+    // anything is allocated. The key is picked from the arguments, or else built alone from the
+    // first of them. Only when neither works is the element constructed first and passed on.
+    template <typename F, typename ... Args>
+    Pair<Iterator, bool> with_key(F&& f, Args && ... args)
+    {
+        constexpr bool IsMap = !std::is_void_v<Value>;
+        using Extractor = KeyExtractor<Key, IsMap, std::remove_cv_t<std::remove_reference_t<Args>>...>;
+        if constexpr (Extractor::Extractable) {
+            return f(Extractor::extract(args...), std::forward<Args>(args)...);
+        } else if constexpr (KeyConverter<Key, IsMap, Args...>::Convertible) {
+            return with_converted_key(std::forward<F>(f), std::forward<Args>(args)...);
+        } else {
+            ValueType value(std::forward<Args>(args)...);
+            const auto& key = Element::key(value);
+            return f(key, std::move(value));
+        }
+    }
+
+    // The element is constructed from the key, moved in, and the other arguments
+    template <typename F, typename K, typename ... Args>
+    Pair<Iterator, bool> with_converted_key(F&& f, K&& k, Args && ... args)
+    {
+        Key key(std::forward<K>(k));
+        if constexpr (std::is_void_v<Value>) {
+            return f(key, std::move(key));
+        } else {
+            return f(key, PiecewiseConstructT(), std::forward_as_tuple(std::move(key)),
+                     std::forward_as_tuple(std::forward<Args>(args)...));
+        }
+    }
+
+    template <typename ... Args>
+    Pair<Iterator, bool> link_at(const InsertPosition& position, const Key& key, Args && ... args)
+    {
+        assert(position.m_parent == nullptr ||
+               (position.m_right ? this->compare()(position.m_parent->key(), key) : this->compare()(key, position.m_parent->key())));
+        return link_new_node(position.m_parent, position.m_right, key, std::forward<Args>(args)...);
+    }
+
+    // The node with the key or, if there's none, the node to link it below and the side
+    struct Location
+    {
+        TreeNode* node;
+        bool      right;
+        bool      found;
+    };
+
+    // Searches the subtree of `node`
+    Location do_locate(TreeNode* node, const Key& key) const
+    {
+        // One comparison per level: an equal key can only be the last node we went right from
+        const Search<Key> search(key, this->compare());
+        TreeNode* candidate = nullptr;
+        TreeNode* parent = nullptr;
+        bool right = false;
+        while (node != nullptr) {
+            right = !search.less(node);
+            if (right) {
+                candidate = node;
+            }
+
+            parent = node;
+            node = node->child(right);
+        }
+
+        if (candidate != nullptr && !search.greater(candidate)) {
+            return Location{candidate, false, true};
+        }
+
+        return Location{parent, right, false};
+    }
+
+    // Where the key goes if it belongs right before `hint` (nullptr for the end), i.e. after the
+    // hint's predecessor. Then the two nodes are adjacent and one of them has a free child on the
+    // side facing the other, so the key is linked with no descent: appending a greater key than
+    // all costs one comparison. A key that belongs elsewhere is searched for from the root.
+    Location do_locate_hint(TreeNode* hint, const Key& key) const
+    {
+        if constexpr (ParentFree) {
+            // The neighbours of the hint are a descent away
+            return do_locate(m_root, key);
+        }
+
+        const Search<Key> search(key, this->compare());
+        if (hint == nullptr) {
+            if (m_max_node == nullptr) {
+                return Location{nullptr, false, false};
+            }
+
+            if (search.greater(m_max_node)) {
+                return Location{m_max_node, true, false};
+            }
+        } else if (search.less(hint)) {
+            if (hint == m_min_node) {
+                return Location{hint, false, false};
+            }
+
+            ConstIterator before(this, hint);
+            --before;
+            if (search.greater(before.m_current)) {
+                return (before.m_current->right_child() == nullptr) ? Location{before.m_current, true, false}
+                                                                    : Location{hint, false, false};
+            }
+        } else if (!search.greater(hint)) {
+            return Location{hint, false, true};
+        } else {
+            // Right after the hint, as when the hint is the element inserted last
+            ConstIterator after(this, hint);
+            ++after;
+            if (after.m_current == nullptr || search.less(after.m_current)) {
+                return (hint->right_child() == nullptr) ? Location{hint, true, false}
+                                                        : Location{after.m_current, false, false};
+            }
+        }
+
+        return do_locate(m_root, key);
+    }
 
-    ReverseConstIterator& operator--()
+    template <typename ... Args>
+    Pair<Iterator, bool> emplace_located(const Location& location, const Key& key, Args && ... args)
     {
-        BaseIterator<Key, Value>::operator++();
-        return *this;
+        if (location.found) {
+            return MakePair(Iterator(this, location.node), false);
+        }
+
+        return link_new_node(location.node, location.right, key, std::forward<Args>(args)...);
     }
-    ReverseConstIterator operator--(int)
+
+    // Links the element (key, Value(args...)) where locate() found the key missing
+    template <typename K, typename ... Args>
+    Pair<Iterator, bool> link_located(const Location& location, K&& key, Args && ... args)
     {
-        ReverseConstIterator it = *this;
-        BaseIterator<Key, Value>::operator++();
-        return it;
+        if constexpr (Contiguous) {
+            if (m_slab.full()) {
+                // The arguments may refer to an element, so build the new one before all nodes move
+                ValueType value(PiecewiseConstructT(), std::forward_as_tuple(std::forward<K>(key)),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+                TreeNode* parent = prepare_insert(location.node);
+                return link_new_node(parent, location.right, Element::key(value), std::move(value));
+            }
+        }
+
+        return link_new_node(location.node, location.right, key, PiecewiseConstructT(),
+                             std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
     }
-};
 
-template <typename Key, typename Value>
-class RedBlackTree
-{
-protected:
-    RedBlackTree() = default;
+    // do_locate() from the root; the hash index answers for keys that are present
+    Location locate(const Key& key) const
+    {
+        if constexpr (Indexed) {
+            if (TreeNode* node = do_find(key)) {
+                return Location{node, false, true};
+            }
+        }
 
-    RedBlackTree(const RedBlackTree& tree) :
-        m_root(do_copy(nullptr, tree.m_root)),
-        m_size(tree.m_size),
-        m_min_node(tree.m_min_node),
-        m_max_node(tree.m_max_node)
-    { }
+        return do_locate(m_root, key);
+    }
 
-    RedBlackTree(RedBlackTree&& tree) noexcept :
-        m_root(tree.m_root),
-        m_size(tree.m_size),
-        m_min_node(tree.m_min_node),
-        m_max_node(tree.m_max_node)
+    template <typename ... Args>
+    Pair<Iterator, bool> link_new_node(TreeNode* parent, bool right, const Key& key, Args && ... args)
     {
-        tree.m_root = nullptr;
-        tree.m_size = 0;
-        tree.m_min_node = nullptr;
-        tree.m_max_node = nullptr;
+        ++m_version;
+        if constexpr (Indexed) {
+            m_index.reserve(m_size + 1);
+        }
+
+        TreeNode* node = create_node(parent, key, std::forward<Args>(args)...);
+        if constexpr (ParentFree) {
+            NodePath<TreeNode> path;
+            if (parent != nullptr) {
+                path_to(parent, path);
+                path.push(parent);
+            }
+            this->link_node(path, right, node);
+        } else {
+            this->link_node(parent, right, node);
+        }
+        if constexpr (Indexed) {
+            m_index.insert(node);
+        }
+        filter_insert(node);
+        return MakePair(Iterator(this, node), true);
     }
 
-    ~RedBlackTree()
+    void do_erase(TreeNode* node)
     {
-        clear();
+        ++m_version;
+        forget_node(node);
+        m_find_cache.forget(node);
+        if constexpr (ParentFree) {
+            NodePath<TreeNode> path;
+            path_to(node, path);
+            this->unlink_node(path, node);
+        } else {
+            this->unlink_node(node);
+        }
+        destroy_node(node);
     }
 
-    RedBlackTree& operator=(const RedBlackTree& tree)
+    // Without parent links: the path from the root down to the node's parent, found by its key
+    void path_to(const TreeNode* node, NodePath<TreeNode>& path) const
     {
-        clear();
-        m_root = do_copy(nullptr, tree.m_root);
-        m_size = tree.m_size;
-        return *this;
+        const Search<Key> search(node->key(), this->compare());
+        path.clear();
+        for (TreeNode* ancestor = m_root; ancestor != node; ancestor = ancestor->child(!search.less(ancestor))) {
+            path.push(ancestor);
+        }
     }
 
-    RedBlackTree& operator=(RedBlackTree&& tree)
+    // Drop the node's entries in the index and the filter
+    void forget_node(const TreeNode* node)
     {
-        swap(tree);
-        return *this;
+        if constexpr (Indexed) {
+            m_index.erase(node);
+        }
+        if constexpr (Hashable) {
+            if (m_filter.enabled()) {
+                m_filter.erase(std::hash<Key>()(node->key()));
+            }
+        }
     }
 
-protected:
-    using TreeNode             = TreeNode<Key, Value>;
-    using ValueType            = typename TreeNode::ValueType;
-    using Iterator             = Iterator<Key, Value>;
-    using ConstIterator        = ConstIterator<Key, Value>;
-    using ReverseIterator      = ReverseIterator<Key, Value>;
-    using ReverseConstIterator = ReverseConstIterator<Key, Value>;
-
-protected:
-    Iterator begin()
-    { return Iterator(this, m_min_node); }
-    Iterator end()
-    { return Iterator(this, nullptr); }
+    // The same for the nodes from `first` up to `last`, before they leave the tree
+    void forget_nodes(TreeNode* first, TreeNode* last)
+    {
+        if (Indexed || m_filter.enabled()) {
+            for (ConstIterator it(this, first); it.m_current != last; ++it) {
+                forget_node(it.m_current);
+            }
+        }
+    }
 
-    ConstIterator cbegin() const
-    { return ConstIterator(this, m_min_node); }
-    ConstIterator cend() const
-    { return ConstIterator(this, nullptr); }
+    // Enter `count` nodes from `first` on, which just joined the tree and are counted in m_size,
+    // into the index and the filter
+    void remember_nodes(TreeNode* first, size_t count)
+    {
+        if constexpr (Indexed) {
+            m_index.reserve(m_size);
+        }
 
-    ReverseIterator rbegin()
-    { return ReverseIterator(this, get_last()); }
-    ReverseIterator rend()
-    { return ReverseIterator(this, nullptr); }
+        bool filtered = false;
+        if constexpr (Hashable) {
+            if (m_filter.enabled()) {
+                if (m_size > m_filter.capacity()) {
+                    rebuild_filter(2 * m_size, m_filter.false_positive_rate());
+                } else {
+                    filtered = true;
+                }
+            }
+        }
 
-    ReverseConstIterator rcbegin() const
-    { return ReverseIterator(this, get_last()); }
-    ReverseConstIterator rcend() const
-    { return ReverseIterator(this, nullptr); }
+        if (Indexed || filtered) {
+            ConstIterator it(this, first);
+            for (size_t index = 0; index < count; ++index, ++it) {
+                if constexpr (Indexed) {
+                    m_index.insert(it.m_current);
+                }
+                if constexpr (Hashable) {
+                    if (filtered) {
+                        m_filter.insert(std::hash<Key>()(it.m_current->key()));
+                    }
+                }
+            }
+        }
+    }
 
-protected:
-    bool empty() const
-    { return m_size == 0; }
-    size_t size() const
-    { return m_size; }
+    // Nodes can move to the tree as they are if its allocator frees them and no slab holds them
+    bool shares_nodes_with(const RedBlackTree& tree) const
+    { return !Contiguous && (NodeAllocatorTraits::is_always_equal::value || m_allocator == tree.m_allocator); }
 
-protected:
-    template <typename ... Args>
-    Pair<Iterator, bool> emplace(Args&& ... args)
+    // Takes the nodes from `first` up to `last` (nullptr: to the end) out of the tree, as a detached
+    // subtree. Splits at `first` and at `last` and joins the outer parts: O(log n). The caller
+    // updates m_size and the index and filter entries.
+    TreeNode* cut_range(TreeNode* first, TreeNode* last)
     {
-        auto result = do_emplace(m_root, std::forward<Args>(args)...);
-        if (result.second) {
-            do_insert_repair(result.first.m_current);
-            ++m_size;
+        ++m_version;
+        m_find_cache.flush();
+
+        Joiner joiner;
+        decltype(auto) lower = first->key();
+        SplitParts head = split_subtree(joiner, Base::detached(m_root), Search<Key>(lower, this->compare()));
+        if (last == nullptr) {
+            m_root = head.less.root;
+        } else {
+            decltype(auto) upper = last->key();
+            SplitParts tail = split_subtree(joiner, head.greater, Search<Key>(upper, this->compare()));
+            head.greater = tail.less;
+            m_root = joiner.join_subtrees(head.less, last, tail.greater).root;
         }
 
-        return result;
+        m_min_node = (m_root != nullptr) ? find_min(m_root) : nullptr;
+        m_max_node = (m_root != nullptr) ? find_max(m_root) : nullptr;
+        return joiner.join_subtrees(Detached(), first, head.greater).root;
     }
 
-    template <typename ... Args>
-    Pair<Iterator, bool> emplace_hint(ConstIterator hint, Args && ... args)
+    using Detached = typename Base::Detached;
+
+    // Balancing state of its own, for joins of detached subtrees outside the tree. Joins rotate
+    // through m_root, so joins that run at the same time need one each.
+    struct Joiner :
+        Base
     {
-        TreeNode* node = hint.m_current;
-        ValueType value(std::forward<Args>(args)...);
+        using Base::join_subtrees;
+        using Base::concatenate_subtrees;
+    };
 
-        // Go up the tree while we're in the left  subtree and the key is greather than parent's
-        //                   or we're in the right subtree and the key is less     than parent's
-        while (node != m_root && (
-            (node->parent()->left_child() == node && value.first > node->parent()->value().first) ||
-            (node->parent()->right_child() == node && value.first < node->parent()->value().first)))
-        {
-            node = node->parent();
+    // What a task of a set operation took out of the trees: the roots of detached subtrees to free,
+    // and, for an index or filter to enter them into, the nodes of the other tree that were kept
+    struct SetOperationTask
+    {
+        Joiner                 joiner;
+        std::vector<TreeNode*> dropped_own;
+        std::vector<TreeNode*> dropped_other;
+        std::vector<TreeNode*> adopted;
+        bool                   record_adopted = false;
+    };
+
+    // Runs operation(own root, other root, task, forks) on the detached trees, then frees what it
+    // dropped, on several threads for std::allocator, and takes the result
+    template <typename Operation>
+    void set_operation(RedBlackTree& tree, unsigned threads, Operation&& operation)
+    {
+        constexpr bool ParallelNodes = std::is_same_v<Allocator, std::allocator<typename Allocator::value_type>>;
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        unsigned forks = 0;
+        while ((1u << forks) < threads) {
+            ++forks;
         }
 
-        auto result = do_emplace(node, std::move(value));
-        if (result.second) {
-            do_insert_repair(result.first.m_current);
-            ++m_size;
+        const bool tracked = Indexed || m_filter.enabled();
+        const size_t total = m_size + tree.m_size;
+        const Detached own = Base::detached(m_root);
+        const Detached other = Base::detached(tree.m_root);
+        ++tree.m_version;
+        if constexpr (Indexed) {
+            tree.m_index.clear();
+        }
+        tree.m_find_cache.flush();
+        tree.m_filter.clear();
+        tree.reset();
+
+        ++m_version;
+        m_find_cache.flush();
+        SetOperationTask task;
+        task.record_adopted = tracked;
+        m_root = operation(own, other, task, forks).root;
+        m_min_node = (m_root != nullptr) ? find_min(m_root) : nullptr;
+        m_max_node = (m_root != nullptr) ? find_max(m_root) : nullptr;
+
+        if (tracked) {
+            NodePath<TreeNode> path;
+            for (TreeNode* root : task.dropped_own) {
+                for (TreeNode* node = path.first(root); node != nullptr; node = path.next(node)) {
+                    forget_node(node);
+                }
+            }
         }
 
-        return result;
+        task.dropped_own.insert(task.dropped_own.end(), task.dropped_other.begin(), task.dropped_other.end());
+        const size_t workers = ParallelNodes ? std::max<size_t>(1, std::min<size_t>(threads, task.dropped_own.size())) : 1;
+        std::vector<size_t> freed(workers);
+        run_in_parallel(workers, [&](size_t worker) {
+            for (size_t index = worker; index < task.dropped_own.size(); index += workers) {
+                freed[worker] += do_clear(task.dropped_own[index]);
+            }
+        });
+
+        m_size = total;
+        for (size_t count : freed) {
+            m_size -= count;
+        }
+        remember_adopted(task.adopted);
     }
 
-    Iterator erase(ConstIterator pos)
+    // Enter nodes that joined the tree from another one into the index and the filter
+    void remember_adopted(const std::vector<TreeNode*>& nodes)
     {
-        TreeNode* node = pos.m_current;
-        ++pos;
-        do_erase(node);
-        return Iterator(this, pos.m_current);
+        if constexpr (Indexed) {
+            m_index.reserve(m_size);
+            for (TreeNode* node : nodes) {
+                m_index.insert(node);
+            }
+        }
+        if constexpr (Hashable) {
+            if (m_filter.enabled()) {
+                if (m_size > m_filter.capacity()) {
+                    rebuild_filter(2 * m_size, m_filter.false_positive_rate());
+                } else {
+                    for (TreeNode* node : nodes) {
+                        m_filter.insert(std::hash<Key>()(node->key()));
+                    }
+                }
+            }
+        }
     }
 
-    void swap(RedBlackTree& other) noexcept
+    // Runs f(task, 0) and f(task of its own, 1), on two threads if `fork`, then hands what the
+    // second task took out to the first
+    template <typename F>
+    static void fork_join(SetOperationTask& task, bool fork, F&& f)
     {
-        if (&other != this) {
-            std::swap(m_root, other.m_root);
-            std::swap(m_size, other.m_size);
-            std::swap(m_min_node, other.m_min_node);
-            std::swap(m_max_node, other.m_max_node);
+        if (!fork) {
+            f(task, 0);
+            f(task, 1);
+            return;
         }
+
+        SetOperationTask forked;
+        forked.record_adopted = task.record_adopted;
+        run_in_parallel(2, [&](size_t side) { f((side == 0) ? task : forked, side); });
+        task.dropped_own.insert(task.dropped_own.end(), forked.dropped_own.begin(), forked.dropped_own.end());
+        task.dropped_other.insert(task.dropped_other.end(), forked.dropped_other.begin(), forked.dropped_other.end());
+        task.adopted.insert(task.adopted.end(), forked.adopted.begin(), forked.adopted.end());
     }
 
-    size_t count(const Key& key) const
+    // Whether the subtrees are worth handing one side to another thread
+    static bool worth_forking(unsigned forks, const Detached& own, const Detached& other)
+    { return forks > 0 && own.height + other.height >= 2 * MinForkBlackHeight; }
+
+    // A node taken out alone becomes a subtree of its own
+    static TreeNode* isolate(TreeNode* node)
     {
-        TreeNode* node = m_root;
+        node->set_parent(nullptr);
+        node->set_left_child(nullptr);
+        node->set_right_child(nullptr);
+        return node;
+    }
 
-        while (node != nullptr) {
-            if (key == node->key()) {
-                return 1;
+    template <typename Merge>
+    Detached unite_subtrees(const Detached& own, const Detached& other, Merge& merge, SetOperationTask& task, unsigned forks) const
+    {
+        if (own.root == nullptr || other.root == nullptr) {
+            if (other.root != nullptr && task.record_adopted) {
+                NodePath<TreeNode> path;
+                for (TreeNode* node = path.first(other.root); node != nullptr; node = path.next(node)) {
+                    task.adopted.push_back(node);
+                }
             }
+            return (own.root != nullptr) ? own : other;
+        }
 
-            node = (key < node->key()) ? node->left_child()
-                                       : node->right_child();
+        const Detached left = Base::detach_child(own, false);
+        const Detached right = Base::detach_child(own, true);
+        const bool fork = worth_forking(forks, own, other);
+        SplitParts parts = split_subtree(task.joiner, other, Search<Key>(own.root->key(), this->compare()));
+        if (parts.equal != nullptr) {
+            if constexpr (!std::is_void_v<Value>) {
+                merge(own.root->value().second, std::move(parts.equal->value().second));
+            }
+            task.dropped_other.push_back(isolate(parts.equal));
         }
 
-        return 0;
+        Detached results[2];
+        fork_join(task, fork, [&](SetOperationTask& side_task, size_t side) {
+            results[side] = (side == 0) ? unite_subtrees(left, parts.less, merge, side_task, fork ? forks - 1 : forks)
+                                        : unite_subtrees(right, parts.greater, merge, side_task, fork ? forks - 1 : forks);
+        });
+        return task.joiner.join_subtrees(results[0], own.root, results[1]);
     }
 
-    ConstIterator find(const Key& key) const
-    { return ConstIterator(this, do_find(key)); }
+    Detached intersect_subtrees(const Detached& own, const Detached& other, SetOperationTask& task, unsigned forks) const
+    {
+        if (own.root == nullptr || other.root == nullptr) {
+            if (own.root != nullptr) {
+                task.dropped_own.push_back(own.root);
+            }
+            if (other.root != nullptr) {
+                task.dropped_other.push_back(other.root);
+            }
+            return Detached();
+        }
 
-    Iterator find(const Key& key)
-    { return Iterator(this, do_find(key)); }
+        const Detached left = Base::detach_child(own, false);
+        const Detached right = Base::detach_child(own, true);
+        const bool fork = worth_forking(forks, own, other);
+        SplitParts parts = split_subtree(task.joiner, other, Search<Key>(own.root->key(), this->compare()));
 
-    Pair<Iterator, Iterator> equal_range(const Key& key)
-    {
-        auto result = do_equal_range(key);
-        return MakePair(Iterator(this, result.first), Iterator(this, result.second));
-    }
+        Detached results[2];
+        fork_join(task, fork, [&](SetOperationTask& side_task, size_t side) {
+            results[side] = (side == 0) ? intersect_subtrees(left, parts.less, side_task, fork ? forks - 1 : forks)
+                                        : intersect_subtrees(right, parts.greater, side_task, fork ? forks - 1 : forks);
+        });
 
-    Pair<ConstIterator, ConstIterator> equal_range(const Key& key) const
-    {
-        auto result = do_equal_range(key);
-        return MakePair(ConstIterator(this, result.first), ConstIterator(this, result.second));
-    }
+        if (parts.equal != nullptr) {
+            task.dropped_other.push_back(isolate(parts.equal));
+            return task.joiner.join_subtrees(results[0], own.root, results[1]);
+        }
 
-    Iterator lower_bound(const Key& key)
-    { return Iterator(this, do_lower_bound(key)); }
+        task.dropped_own.push_back(isolate(own.root));
+        return task.joiner.concatenate_subtrees(results[0], results[1]);
+    }
 
-    ConstIterator lower_bound(const Key& key) const
-    { return ConstIterator(this, do_lower_bound(key)); }
+    Detached subtract_subtrees(const Detached& own, const Detached& other, SetOperationTask& task, unsigned forks) const
+    {
+        if (own.root == nullptr || other.root == nullptr) {
+            if (other.root != nullptr) {
+                task.dropped_other.push_back(other.root);
+            }
+            return own;
+        }
 
-    Iterator upper_bound(const Key& key)
-    { return Iterator(this, do_upper_bound(key)); }
+        const Detached left = Base::detach_child(other, false);
+        const Detached right = Base::detach_child(other, true);
+        const bool fork = worth_forking(forks, own, other);
+        SplitParts parts = split_subtree(task.joiner, own, Search<Key>(other.root->key(), this->compare()));
 
-    ConstIterator upper_bound(const Key& key) const
-    { return ConstIterator(this, do_upper_bound(key)); }
+        Detached results[2];
+        fork_join(task, fork, [&](SetOperationTask& side_task, size_t side) {
+            results[side] = (side == 0) ? subtract_subtrees(parts.less, left, side_task, fork ? forks - 1 : forks)
+                                        : subtract_subtrees(parts.greater, right, side_task, fork ? forks - 1 : forks);
+        });
 
-    void clear()
-    {
-        if (m_root != nullptr) {
-            do_clear(m_root);
-            m_root = nullptr;
+        task.dropped_other.push_back(isolate(other.root));
+        if (parts.equal != nullptr) {
+            task.dropped_own.push_back(isolate(parts.equal));
         }
-        m_size = 0;
-        m_min_node = nullptr;
-        m_max_node = nullptr;
+        return task.joiner.concatenate_subtrees(results[0], results[1]);
     }
 
-private:
-    template <typename ... Args>
-    Pair<Iterator, bool> do_emplace(TreeNode* node, Args && ... args)
+    // Detached subtrees of the nodes with keys less and greater than a key, and the node with the
+    // key, if any, with its links left as they were
+    struct SplitParts
+    {
+        Detached  less;
+        TreeNode* equal = nullptr;
+        Detached  greater;
+    };
+
+    // Splits a detached subtree at the search key. Down the path to the key, each node joins its
+    // subtree on the far side to the part it belongs to. The joins' costs are differences of black
+    // heights that add up to O(log n).
+    template <typename K>
+    SplitParts split_subtree(Joiner& joiner, const Detached& subtree, const Search<K>& search) const
     {
-        using _In_place_key_extractor = typename std::_In_place_key_extract_map<Key, std::remove_cv_t<std::remove_reference_t<Args>>...>;
-        if constexpr (_In_place_key_extractor::_Extractable) {
-            const auto& key = _In_place_key_extractor::_Extract(args...);
-            return do_emplace_with_key(node, key, std::forward<Args>(args)...);
+        TreeNode* node = subtree.root;
+        if (node == nullptr) {
+            return SplitParts();
         }
 
-        ValueType value(std::forward<Args>(args)...);
-        const auto& key = value.first;
-        return do_emplace_with_key(node, key, std::move(value));
+        const Detached left = Base::detach_child(subtree, false);
+        const Detached right = Base::detach_child(subtree, true);
+        if (search.greater(node)) {
+            SplitParts parts = split_subtree(joiner, right, search);
+            parts.less = joiner.join_subtrees(left, node, parts.less);
+            return parts;
+        }
+
+        if (search.less(node)) {
+            SplitParts parts = split_subtree(joiner, left, search);
+            parts.greater = joiner.join_subtrees(parts.greater, node, right);
+            return parts;
+        }
+
+        return SplitParts{left, node, right};
     }
 
-    template <typename ... Args>
-    Pair<Iterator, bool> do_emplace_with_key(TreeNode* node, const Key& key, Args && ... args)
+    template <typename K>
+    TreeNode* do_find(const K& key) const
     {
-        if (m_root == nullptr) {
-            m_root = new TreeNode(nullptr, std::forward<Args>(args)...);
-            m_min_node = m_root;
-            m_max_node = m_root;
-            return MakePair(Iterator(this, m_root), true);
+        if constexpr (Indexed && std::is_same_v<K, Key>) {
+            return m_index.find(key, [&](const TreeNode* node) {
+                return !this->compare()(key, node->key()) && !this->compare()(node->key(), key);
+            });
         }
 
-        while (true) {
-            if (key < node->key()) {
-                if (node->left_child() == nullptr) {
-                    node->left_child() = new TreeNode(node, std::forward<Args>(args)...);
-                    if (key < m_min_node->key()) {
-                        m_min_node = node->left_child();
-                    }
-                    return MakePair(Iterator(this, node->left_child()), true);
-                }
+        if (filter_rejects(key)) {
+            return nullptr;
+        }
+
+        TreeNode* node = m_root;
+        TreeNode* candidate = nullptr;
+        const Search<K> search(key, this->compare());
+
+        if (m_find_cache.enabled()) {
+            if (TreeNode* cached = m_find_cache.find(search)) {
+                return cached;
+            }
+        }
+
+        // Find the last node not greater than the key, then check it once for equality
+        while (node != nullptr) {
+            if (search.less(node)) {
                 node = node->left_child();
-            } else if (key > node->key()) {
-                if (node->right_child() == nullptr) {
-                    node->right_child() = new TreeNode(node, std::forward<Args>(args)...);
-                    if (key > m_max_node->key()) {
-                        m_max_node = node->right_child();
-                    }
-                    return MakePair(Iterator(this, node->right_child()), true);
-                }
-                node = node->right_child();
             } else {
-                break;
+                candidate = node;
+                node = node->right_child();
             }
         }
 
-        return MakePair(Iterator(this, node), false);
+        if (candidate == nullptr || search.greater(candidate)) {
+            return nullptr;
+        }
+
+        if (m_find_cache.enabled()) {
+            m_find_cache.remember(candidate);
+        }
+        return candidate;
     }
 
-    void do_erase(TreeNode* node)
+    template <typename K>
+    TreeNode* do_find_from(TreeNode* hint, const K& key) const
     {
-        if (node == m_min_node) {
-            m_min_node = node->right_child() ? node->right_child()
-                                             : node->parent();
+        TreeNode* node = do_lower_bound_from(hint, key);
+        return (node != nullptr && !Search<K>(key, this->compare()).less(node)) ? node : nullptr;
+    }
+
+    // Only lookups by Key itself can be filtered, other key types may hash differently
+    template <typename K>
+    bool filter_rejects(const K& key) const
+    {
+        if constexpr (Hashable && std::is_same_v<K, Key>) {
+            return m_filter.enabled() && !m_filter.may_contain(std::hash<Key>()(key));
+        } else {
+            return false;
         }
+    }
 
-        if (node == m_max_node) {
-            m_max_node = node->left_child() ? node->left_child()
-                                            : node->parent();
+    void filter_insert(const TreeNode* node)
+    {
+        if constexpr (Hashable) {
+            if (m_filter.enabled()) {
+                if (m_size > m_filter.capacity()) {
+                    rebuild_filter(2 * m_size, m_filter.false_positive_rate());
+                } else {
+                    m_filter.insert(std::hash<Key>()(node->key()));
+                }
+            }
         }
+    }
 
-        node = find_one_non_leaf_child_node(node);
+    static IndexTable make_index(const Allocator& allocator)
+    {
+        if constexpr (Indexed) {
+            return IndexTable(allocator);
+        } else {
+            return IndexTable();
+        }
+    }
 
-        TreeNode* child_node = node->left_child() ? node->left_child()
-                                                  : node->right_child();
+    // Nodes moved: enter them again. The table has room for all of them already
+    void rebuild_index()
+    {
+        if constexpr (Indexed) {
+            m_index.clear();
+            m_index.reserve(m_size);
+            for (auto it = cbegin(); it != cend(); ++it) {
+                m_index.insert(it.m_current);
+            }
+        }
+    }
 
-        if (node->is_red()) {
-            // Case 1: Node is red. Then both its children are leafs
-            if (node->parent()->right_child() == node) {
-                node->parent()->right_child() = nullptr;
-            } else {
-                node->parent()->left_child() = nullptr;
+    void rebuild_filter(size_t capacity, double false_positive_rate)
+    {
+        m_filter.reset(capacity, false_positive_rate);
+        for (auto it = cbegin(); it != cend(); ++it) {
+            m_filter.insert(std::hash<Key>()(it.m_current->key()));
+        }
+    }
+
+    // The do_find() descent for up to BatchLanes keys at a time. Each step moves every lane one level
+    // down and prefetches the node it goes to, which is only read when the other lanes had their turn.
+    // A finished lane reports its key's index and node and takes the next key.
+    template <typename ForwardIt, typename F>
+    void do_find_many(ForwardIt first, ForwardIt last, F&& found) const
+    {
+        using K = typename std::iterator_traits<ForwardIt>::value_type;
+        static_assert(std::is_same<K, Key>::value || IsTransparentCompare<Compare, K>::value,
+                      "Lookups by other types than Key need a transparent comparator");
+
+        if constexpr (Indexed && std::is_same_v<K, Key>) {
+            for (size_t index = 0; first != last; ++first, ++index) {
+                found(index, do_find(*first));
             }
-        } else if (child_node != nullptr && child_node->is_red()) {
-            // Case 2. Node is black and its child is red
-            if (node->parent() != nullptr) {
-                if (node->parent()->right_child() == node) {
-                    node->parent()->right_child() = child_node;
-                } else {
-                    node->parent()->left_child() = child_node;
-                }
-            } else {
-                m_root = child_node;
+            return;
+        }
+
+        struct Lane
+        {
+            ForwardIt key;
+            size_t    index;
+            TreeNode* node;
+            TreeNode* candidate;
+        };
+
+        // Keys the filter rejects are answered right away
+        size_t index = 0;
+        auto skip_rejected = [&] {
+            for (; first != last && filter_rejects(*first); ++first) {
+                found(index++, nullptr);
             }
+        };
+
+        Lane lanes[BatchLanes];
+        size_t active = 0;
+        for (skip_rejected(); active < BatchLanes && first != last; skip_rejected()) {
+            lanes[active++] = Lane{first, index++, m_root, nullptr};
+            ++first;
+        }
+
+        while (active > 0) {
+            for (size_t i = 0; i < active;) {
+                Lane& lane = lanes[i];
+                const Search<K> search(*lane.key, this->compare());
+
+                if (lane.node != nullptr) {
+                    if (search.less(lane.node)) {
+                        lane.node = lane.node->left_child();
+                    } else {
+                        lane.candidate = lane.node;
+                        lane.node = lane.node->right_child();
+                    }
+
+                    if (lane.node != nullptr) {
+                        prefetch_node(lane.node);
+                    }
+                    ++i;
+                    continue;
+                }
 
-            child_node->parent() = node->parent();
-            child_node->set_black_color();
-        } else {
-            // Case 3. Node is black and its both children are black. Because of RB trees properties they are leafs.
+                const bool equal = lane.candidate != nullptr && !search.greater(lane.candidate);
+                found(lane.index, equal ? lane.candidate : nullptr);
 
-            // First delete the node
-            TreeNode* parent = node->parent();
-            TreeNode* sibling = node->sibling();
-            if (parent != nullptr) {
-                if (parent->right_child() == node) {
-                    parent->right_child() = child_node;
+                skip_rejected();
+                if (first != last) {
+                    lane = Lane{first, index++, m_root, nullptr};
+                    ++first;
+                    ++i;
                 } else {
-                    parent->left_child() = child_node;
+                    lane = lanes[--active];
                 }
-            } else {
-                m_root = nullptr;
             }
-
-            // Now fix the tree
-            do_remove_double_black_repair(child_node, parent, sibling);
         }
-
-        --m_size;
-        delete node;
     }
 
-    TreeNode* do_find(const Key& key) const
+    template <typename K>
+    Pair<TreeNode*, TreeNode*> do_equal_range(const K& key) const
     {
         TreeNode* node = m_root;
+        TreeNode* candidate = nullptr;
+        TreeNode* second = nullptr;
+        const Search<K> search(key, this->compare());
+
+        // Keys are unique: the range is the equal node, if any, up to the upper bound
         while (node != nullptr) {
-            if (key == node->key()) {
-                return node;
+            if (search.less(node)) {
+                second = node;
+                node = node->left_child();
+            } else {
+                candidate = node;
+                node = node->right_child();
             }
-
-            node = (key < node->key()) ? node->left_child()
-                                       : node->right_child();
         }
 
-        return nullptr;
+        const bool found = candidate != nullptr && !search.greater(candidate);
+        return MakePair(found ? candidate : second, second);
     }
 
-    Pair<TreeNode*, TreeNode*> do_equal_range(const Key& key) const
+    template <typename K>
+    TreeNode* do_lower_bound(const K& key) const
+    { return descend_lower_bound(m_root, nullptr, Search<K>(key, this->compare())); }
+
+    // Climb from the hint to the nearest ancestor on the other side of the key, then descend into the
+    // subtree between them. Only the ancestors where the path turns are compared with the key.
+    template <typename K>
+    TreeNode* do_lower_bound_from(TreeNode* hint, const K& key) const
     {
-        TreeNode* node = m_root;
-        TreeNode* first = nullptr;
-        TreeNode* second = nullptr;
+        if constexpr (ParentFree) {
+            // Nothing to climb: descend from the root
+            return do_lower_bound(key);
+        } else {
+            TreeNode* node = (hint != nullptr) ? hint : m_max_node;
+            if (node == nullptr) {
+                return nullptr;
+            }
 
-        while (node != nullptr) {
-            if (key <= node->key()) {
-                if (key < node->key()) {
-                    second = node;
+            const Search<K> search(key, this->compare());
+            if (search.greater(node)) {
+                // The bound is right of node: past its right subtree, the first larger ancestor is the
+                // parent of the top of the right spine node is on
+                TreeNode* top = node;
+                while (true) {
+                    while (top->parent() != nullptr && top->parent()->right_child() == top) {
+                        top = top->parent();
+                    }
+
+                    TreeNode* parent = top->parent();
+                    if (parent == nullptr || !search.greater(parent)) {
+                        return descend_lower_bound(node->right_child(), parent, search);
+                    }
+                    node = parent;
+                    top = parent;
                 }
-                first = node;
-                node = node->left_child();
-            } else {
-                node = node->right_child();
+            }
+
+            // Node is a bound, a smaller one would be in its left subtree or left of the left spine it is on
+            TreeNode* top = node;
+            while (true) {
+                while (top->parent() != nullptr && top->parent()->left_child() == top) {
+                    top = top->parent();
+                }
+
+                TreeNode* parent = top->parent();
+                if (parent == nullptr || search.greater(parent)) {
+                    return descend_lower_bound(node->left_child(), node, search);
+                }
+                node = parent;
+                top = parent;
             }
         }
+    }
 
-        node = (second != nullptr) ? second->left_child()
-                                   : m_root;
+    template <typename Search>
+    static TreeNode* descend_lower_bound(TreeNode* node, TreeNode* bound, const Search& search)
+    {
         while (node != nullptr) {
-            if (key < node->key()) {
-                second = node;
+            if (!search.greater(node)) {
+                bound = node;
                 node = node->left_child();
             } else {
                 node = node->right_child();
             }
         }
 
-        return MakePair(first, second);
+        return bound;
     }
 
-    TreeNode* do_lower_bound(const Key& key) const
+    template <typename K>
+    TreeNode* do_upper_bound(const K& key) const
     {
         TreeNode* node = m_root;
         TreeNode* bound = nullptr;
+        const Search<K> search(key, this->compare());
 
         while (node != nullptr) {
-            if (key <= node->key()) {
+            if (search.less(node)) {
                 bound = node;
                 node = node->left_child();
             } else {
@@ -779,21 +3891,34 @@ private:
         return bound;
     }
 
-    TreeNode* do_upper_bound(const Key& key) const
+    void do_copy_from(const RedBlackTree& tree)
     {
-        TreeNode* node = m_root;
-        TreeNode* bound = nullptr;
+        if constexpr (Indexed) {
+            m_index.reserve(tree.m_size);
+        }
 
-        while (node != nullptr) {
-            if (key < node->key()) {
-                bound = node;
-                node = node->left_child();
-            } else {
-                node = node->right_child();
+        if constexpr (Contiguous) {
+            if constexpr (Slab::TriviallyRelocatable && !TreeNode::ColdValue) {
+                // Links are relative, so the copied slab is a valid tree as it is
+                m_slab.copy_from(m_allocator, tree.m_slab, Layout::MaxNodes);
+                m_root = m_slab.node_at(tree.m_slab.index_of(tree.m_root));
+                m_min_node = m_slab.node_at(tree.m_slab.index_of(tree.m_min_node));
+                m_max_node = m_slab.node_at(tree.m_slab.index_of(tree.m_max_node));
+                m_size = tree.m_size;
+                rebuild_index();
+                return;
+            }
+
+            if (m_slab.capacity() < tree.m_size) {
+                reallocate_slab(tree.m_size);
             }
         }
 
-        return bound;
+        m_root = do_copy(nullptr, tree.m_root);
+        m_size = tree.m_size;
+        m_min_node = (m_root != nullptr) ? find_min(m_root) : nullptr;
+        m_max_node = (m_root != nullptr) ? find_max(m_root) : nullptr;
+        rebuild_index();
     }
 
     TreeNode* do_copy(TreeNode* parent, TreeNode* source_node)
@@ -801,291 +3926,394 @@ private:
         TreeNode* node = nullptr;
 
         if (source_node != nullptr) {
-            node = new TreeNode(parent, source_node->value().first, source_node->value().second);
+            node = create_node(parent, source_node->key(), source_node->value());
             node->set_color(source_node->is_black());
-            node->left_child() = do_copy(node, source_node->left_child());
-            node->right_child() = do_copy(node, source_node->right_child());
+            node->set_left_child(do_copy(node, source_node->left_child()));
+            node->set_right_child(do_copy(node, source_node->right_child()));
         }
 
         return node;
     }
 
-    void do_clear(TreeNode* node)
+    // Balanced subtree of the next `count` elements, taken in order. If an element can't be
+    // constructed, the nodes built so far are destroyed.
+    template <typename ForwardIt>
+    TreeNode* build_sorted(ForwardIt& first, size_t count, TreeNode* parent, size_t depth, size_t red_depth)
     {
-        if (node->left_child() != nullptr) {
-            do_clear(node->left_child());
+        if (count == 0) {
+            return nullptr;
         }
 
-        if (node->right_child() != nullptr) {
-            do_clear(node->right_child());
+        const size_t left_count = (count - 1) / 2;
+        TreeNode* left = build_sorted(first, left_count, nullptr, depth + 1, red_depth);
+        TreeNode* node = nullptr;
+        try {
+            with_key([&](const Key& key, auto && ... values) {
+                node = create_node(parent, key, std::forward<decltype(values)>(values)...);
+                return MakePair(Iterator(this, node), true);
+            }, *first);
+
+            node->set_color(depth == 0 || depth != red_depth);
+            node->set_left_child(left);
+            if (left != nullptr) {
+                left->set_parent(node);
+            }
+
+            ++first;
+            node->set_right_child(build_sorted(first, count - 1 - left_count, node, depth + 1, red_depth));
+        } catch (...) {
+            if (node != nullptr) {
+                do_clear(node);
+            } else if (left != nullptr) {
+                do_clear(left);
+            }
+            throw;
         }
 
-        delete node;
+        return node;
     }
 
-private:
-    void lr_rotate(TreeNode* node)
+    // Links the nodes, which are in key order, into a balanced subtree shaped and coloured as
+    // build_sorted() builds it
+    static TreeNode* link_sorted(TreeNode* const* nodes, size_t count, TreeNode* parent, size_t depth, size_t red_depth)
     {
-        rotate_left(node->parent());
-        ll_rotate(node->left_child());
+        if (count == 0) {
+            return nullptr;
+        }
+
+        const size_t left_count = (count - 1) / 2;
+        TreeNode* node = nodes[left_count];
+        node->set_parent(parent);
+        node->set_color(depth == 0 || depth != red_depth);
+        node->set_left_child(link_sorted(nodes, left_count, node, depth + 1, red_depth));
+        node->set_right_child(link_sorted(nodes + left_count + 1, count - 1 - left_count, node, depth + 1, red_depth));
+        return node;
     }
 
-    void ll_rotate(TreeNode* node)
+    // Depth of the last level of a balanced tree of `count` nodes. build_sorted() fills all levels
+    // above it and colours its nodes red, all others black.
+    static size_t last_level(size_t count)
     {
-        node->parent()->set_black_color();
+        size_t depth = 0;
+        for (; count > 1; count /= 2) {
+            ++depth;
+        }
+        return depth;
+    }
 
-        TreeNode* grandparent = node->grandparent();
-        grandparent->set_red_color();
-        rotate_right(grandparent);
+    // Sorted elements: keeps one of each run of equal keys, the first or the last one
+    template <typename Elements>
+    void remove_equal_keys(Elements& elements, DuplicateKeys duplicates) const
+    {
+        if (duplicates == DuplicateKeys::KeepFirst) {
+            elements.erase(std::unique(elements.begin(), elements.end(), [&](const auto& kept, const auto& next) {
+                return !this->compare()(element_key(kept), element_key(next));
+            }), elements.end());
+        } else {
+            auto kept = std::unique(elements.rbegin(), elements.rend(), [&](const auto& kept, const auto& previous) {
+                return !this->compare()(element_key(previous), element_key(kept));
+            });
+            elements.erase(elements.begin(), kept.base());
+        }
     }
 
-    void rl_rotate(TreeNode* node)
+    // The key of an element, or of anything with the key as member `first`
+    template <typename T>
+    static const auto& element_key(const T& element)
     {
-        rotate_right(node->parent());
-        rr_rotate(node->right_child());
+        if constexpr (std::is_void_v<Value>) {
+            return element;
+        } else {
+            return element.first;
+        }
     }
 
-    void rr_rotate(TreeNode* node)
+    // Frees a subtree, returns how many nodes it had
+    size_t do_clear(TreeNode* node)
     {
-        node->parent()->set_black_color();
+        if (node == nullptr) {
+            return 0;
+        }
 
-        TreeNode* grandparent = node->grandparent();
-        grandparent->set_red_color();
-        rotate_left(grandparent);
+        const size_t count = 1 + do_clear(node->left_child()) + do_clear(node->right_child());
+        destroy_node(node);
+        return count;
     }
 
-    void rotate_left(TreeNode* node)
+    template <typename ... Args>
+    TreeNode* create_node(TreeNode* parent, const Key& key, Args && ... args)
     {
-        TreeNode* child = node->right_child();
+        if constexpr (TreeNode::InlineKey) {
+            const size_t count = inline_node_count(key.size());
+            TreeNode* node = NodeAllocatorTraits::allocate(m_allocator, count);
+            char* bytes = reinterpret_cast<char*>(node + 1);
+            if (!key.empty()) {
+                std::memcpy(bytes, key.data(), key.size());
+            }
 
-        child->parent() = node->parent();
-        if (node->parent() != nullptr) {
-            if (node == node->parent()->left_child()) {
-                node->parent()->left_child() = child;
-            } else {
-                node->parent()->right_child() = child;
+            try {
+                NodeAllocatorTraits::construct(m_allocator, node, parent, std::string_view(bytes, key.size()), std::forward<Args>(args)...);
+            } catch (...) {
+                NodeAllocatorTraits::deallocate(m_allocator, node, count);
+                throw;
+            }
+            return node;
+        } else if constexpr (TreeNode::ColdValue) {
+            ValueAllocator allocator(m_allocator);
+            ValueType* value = ValueAllocatorTraits::allocate(allocator, 1);
+            try {
+                ValueAllocatorTraits::construct(allocator, value, std::forward<Args>(args)...);
+            } catch (...) {
+                ValueAllocatorTraits::deallocate(allocator, value, 1);
+                throw;
+            }
+
+            try {
+                return construct_node(parent, value);
+            } catch (...) {
+                ValueAllocatorTraits::destroy(allocator, value);
+                ValueAllocatorTraits::deallocate(allocator, value, 1);
+                throw;
             }
         } else {
-            m_root = child;
+            return construct_node(parent, std::forward<Args>(args)...);
         }
+    }
 
-        node->right_child() = child->left_child();
-        if (node->right_child() != nullptr) {
-            node->right_child()->parent() = node;
+    void destroy_node(TreeNode* node)
+    {
+        if constexpr (TreeNode::ColdValue) {
+            ValueAllocator allocator(m_allocator);
+            ValueType* value = node->cold_value();
+            ValueAllocatorTraits::destroy(allocator, value);
+            ValueAllocatorTraits::deallocate(allocator, value, 1);
         }
 
-        child->left_child() = node;
-        node->parent() = child;
+        release_node(node);
     }
 
-    void rotate_right(TreeNode* node)
+    // Destroys the node but not its cold element
+    void release_node(TreeNode* node)
     {
-        TreeNode* child = node->left_child();
+        const size_t count = node_count(node);
+        NodeAllocatorTraits::destroy(m_allocator, node);
+        deallocate_node(node, count);
+    }
 
-        child->parent() = node->parent();
-        if (node->parent() != nullptr) {
-            if (node == node->parent()->left_child()) {
-                node->parent()->left_child() = child;
-            } else {
-                node->parent()->right_child() = child;
-            }
+    // Node slots taken by a node with an inline key of `size` bytes
+    static size_t inline_node_count(size_t size)
+    { return 1 + (size + sizeof(TreeNode) - 1) / sizeof(TreeNode); }
+
+    static size_t node_count(const TreeNode* node)
+    {
+        if constexpr (TreeNode::InlineKey) {
+            return inline_node_count(node->key().size());
         } else {
-            m_root = child;
+            return 1;
         }
+    }
 
-        node->left_child() = child->right_child();
-        if (node->left_child() != nullptr) {
-            node->left_child()->parent() = node;
+    // Memory for a node like `node`, with nothing constructed in it
+    TreeNode* allocate_duplicate(const TreeNode* node)
+    {
+        if constexpr (TreeNode::InlineKey) {
+            return NodeAllocatorTraits::allocate(m_allocator, node_count(node));
+        } else {
+            return allocate_node();
         }
+    }
 
-        child->right_child() = node;
-        node->parent() = child;
+    // Constructs an unlinked node with the same element in memory from allocate_duplicate(). A cold
+    // element is shared with the original node, an element stored in place is moved unless moving
+    // could throw.
+    void construct_duplicate(TreeNode* slot, TreeNode* node)
+    {
+        if constexpr (TreeNode::ColdValue) {
+            NodeAllocatorTraits::construct(m_allocator, slot, nullptr, node->cold_value());
+        } else if constexpr (TreeNode::InlineKey) {
+            const std::string_view key = node->key();
+            char* bytes = reinterpret_cast<char*>(slot + 1);
+            if (!key.empty()) {
+                std::memcpy(bytes, key.data(), key.size());
+            }
+            NodeAllocatorTraits::construct(m_allocator, slot, nullptr, std::string_view(bytes, key.size()),
+                                           std::move_if_noexcept(node->value()));
+        } else {
+            NodeAllocatorTraits::construct(m_allocator, slot, nullptr, std::move_if_noexcept(node->value()));
+        }
     }
 
-    void do_insert_repair(TreeNode* node)
+    void breadth_first_order(std::vector<TreeNode*>& order) const
     {
-        TreeNode* parent = node->parent();
+        order.push_back(m_root);
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (order[i]->left_child() != nullptr) {
+                order.push_back(order[i]->left_child());
+            }
+            if (order[i]->right_child() != nullptr) {
+                order.push_back(order[i]->right_child());
+            }
+        }
+    }
 
-        // Case 1. Node is root
-        if (parent == nullptr) {
-            node->set_black_color();
-            return;
+    static void depth_first_order(TreeNode* node, std::vector<TreeNode*>& order)
+    {
+        if (node != nullptr) {
+            order.push_back(node);
+            depth_first_order(node->left_child(), order);
+            depth_first_order(node->right_child(), order);
         }
+    }
 
-        // Case 2. Parent is black
-        if (parent->is_black()) {
+    // Lays out the top half of the levels first, then every subtree hanging below it, each of them
+    // recursively in the same way
+    static void van_emde_boas_order(TreeNode* node, size_t height, std::vector<TreeNode*>& order)
+    {
+        if (node == nullptr) {
             return;
         }
 
-        TreeNode* uncle = node->uncle();
-        TreeNode* grandparent = node->grandparent();
-
-        // Case 3. Parent is red. Uncle is red
-        if (uncle != nullptr && uncle->is_red()) {
-            parent->set_black_color();
-            uncle->set_black_color();
-            grandparent->set_red_color();
-            do_insert_repair(grandparent);
+        if (height == 1) {
+            order.push_back(node);
             return;
         }
 
-        // Case 4. Parent is red. Uncle is black.
-        if (parent == grandparent->left_child()) {
-            // Left Rotate
-            if (node == parent->right_child()) {
-                lr_rotate(node);
-            } else {
-                ll_rotate(node);
-            }
-        } else {
-            // Right Rotate
-            if (node == parent->left_child()) {
-                rl_rotate(node);
-            } else {
-                rr_rotate(node);
-            }
+        const size_t top_height = height / 2;
+        van_emde_boas_order(node, top_height, order);
+
+        std::vector<TreeNode*> bottom_roots;
+        collect_at_depth(node, top_height, bottom_roots);
+        for (TreeNode* bottom_root : bottom_roots) {
+            van_emde_boas_order(bottom_root, height - top_height, order);
         }
     }
 
-    TreeNode* find_one_non_leaf_child_node(TreeNode* node)
+    static void collect_at_depth(TreeNode* node, size_t depth, std::vector<TreeNode*>& nodes)
     {
-        if (node->left_child() == nullptr || node->right_child() == nullptr) {
-            return node;
+        if (node == nullptr) {
+            return;
         }
 
-        TreeNode* child = find_max(node->left_child());
+        if (depth == 0) {
+            nodes.push_back(node);
+            return;
+        }
 
-        // Swap the nodes
-        child->right_child() = node->right_child();
-        child->right_child()->parent() = child; // right child of node is not null as per condition in the method start
-        node->right_child() = nullptr; // right child of max_node_left_subtree is nullptr as it is max element in the subtree
+        collect_at_depth(node->left_child(), depth - 1, nodes);
+        collect_at_depth(node->right_child(), depth - 1, nodes);
+    }
 
-        TreeNode* node_left_child = node->left_child();
-        node->left_child() = child->left_child();
-        if (node->left_child() != nullptr) {
-            node->left_child()->parent() = node;
+    static size_t subtree_height(TreeNode* node)
+    {
+        if (node == nullptr) {
+            return 0;
         }
 
-        TreeNode* child_parent = child->parent();
-        if (node->parent() != nullptr) {
-            if (node->parent()->left_child() == node) {
-                node->parent()->left_child() = child;
-            } else {
-                node->parent()->right_child() = child;
-            }
-        } else {
-            m_root = child;
+        return 1 + std::max(subtree_height(node->left_child()), subtree_height(node->right_child()));
+    }
+
+    template <typename ... Args>
+    TreeNode* construct_node(Args && ... args)
+    {
+        TreeNode* node = allocate_node();
+        try {
+            NodeAllocatorTraits::construct(m_allocator, node, std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate_node(node);
+            throw;
         }
-        child->parent() = node->parent();
+        return node;
+    }
 
-        if (node_left_child == child) {
-            child->left_child() = node;
-            node->parent() = child;
+    TreeNode* allocate_node()
+    {
+        if constexpr (Contiguous) {
+            return m_slab.allocate();
         } else {
-            child->left_child() = node_left_child;
-            child->left_child()->parent() = child; // child->left_child() is not nullptr as we went left from node while searching for the child
-
-            node->parent() = child_parent;
-            node->parent()->right_child() = node; // We always went right in the left subtree, and it is not the first node
+            return NodeAllocatorTraits::allocate(m_allocator, 1);
         }
-
-        bool tmp_color = child->is_black();
-        child->set_color(node->is_black());
-        node->set_color(tmp_color);
-        return node;
     }
 
-    void do_remove_double_black_repair(TreeNode* node, TreeNode* parent, TreeNode* sibling)
+    void deallocate_node(TreeNode* node, size_t count = 1)
     {
-        // Case 3.1 Node is root, we are done.
-        if (parent == nullptr) {
-            return;
+        if constexpr (Contiguous) {
+            m_slab.deallocate(node);
+        } else {
+            NodeAllocatorTraits::deallocate(m_allocator, node, count);
         }
+    }
 
-        // Case 3.2. Sibling is red
-        if (sibling->is_red()) {
-            parent->set_red_color();
-            sibling->set_black_color();
-            if (node == parent->left_child()) {
-                rotate_left(parent);
-                sibling = parent->right_child();
-            } else {
-                rotate_right(parent);
-                sibling = parent->left_child();
+    // Contiguous layouts: make room for one more node before descending, as growing the slab moves
+    // all nodes. Returns where `node` lives afterwards.
+    TreeNode* prepare_insert(TreeNode* node)
+    {
+        if constexpr (Contiguous) {
+            if (m_slab.full()) {
+                const size_t index = m_slab.index_of(node);
+                reallocate_slab(std::max<size_t>(16, m_slab.capacity() * 2));
+                return m_slab.node_at(index);
             }
-
-            // After rotation node has a new black sibling and a red father
         }
+        return node;
+    }
 
-        // Case 3.3. Sibling is black and both sibling children are black
-        if ((sibling->left_child() == nullptr || sibling->left_child()->is_black()) &&
-            (sibling->right_child() == nullptr || sibling->right_child()->is_black())) {
-
-            if (parent->is_black()) {
-                // Case 3.3.1. Parent is black
+    void reallocate_slab(size_t capacity)
+    {
+        if constexpr (Contiguous) {
+            ++m_version;
+            m_find_cache.flush();
+            const size_t root = m_slab.index_of(m_root);
+            const size_t min_node = m_slab.index_of(m_min_node);
+            const size_t max_node = m_slab.index_of(m_max_node);
+
+            m_slab.reallocate(m_allocator, std::min(capacity, Layout::MaxNodes), Layout::MaxNodes);
+
+            m_root = m_slab.node_at(root);
+            m_min_node = m_slab.node_at(min_node);
+            m_max_node = m_slab.node_at(max_node);
+            rebuild_index();
+        }
+    }
 
-                // Recolor sibling to red. Now the subtree starting at parent is a valid RB tree, but its black height of every path in it is smaller by one than
-                // black height of any other path in the whole tree. So we have to go upper in the tree and fix it again the same way.
-                sibling->set_red_color();
-                do_remove_double_black_repair(parent, parent->parent(), parent->sibling());
-            } else {
-                // Case 3.3.2. Parent is red
-                parent->set_black_color();
-                sibling->set_red_color();
-            }
+private:
+    template <typename T, typename = void>
+    struct HasReserve : std::false_type { };
 
-            // In both cases we are done here.
-            //
-            // In case 3.3.1 the algorithm will go recursively upward the tree, on each step getting a valid RB subtree of the whole tree.
-            // It will stop when it either reaches the root or reach a case when imbalance will be fixed by rotation/recoloring
-            //
-            // In case 3.3.2 recoloring is enough to have the same RB height in the whole tree.
-            return;
-        }
+    template <typename T>
+    struct HasReserve<T, std::void_t<decltype(std::declval<T&>().reserve(size_t()))>> : std::true_type { };
 
-        // Case 3.4. Node is a left child, sibling is black, its right child is black and left child is red (or symmetrically when node is a right child)
-        if (node == parent->left_child() && (sibling->right_child() == nullptr || sibling->right_child()->is_black()) && (sibling->left_child() != nullptr && sibling->left_child()->is_red())) {
-            // Recolor and rotate around sibling. Now node has a new black sibling and a configuration which will be handled by case 3.5
-            sibling->set_red_color();
-            sibling->left_child()->set_black_color();
-            rotate_right(sibling);
-            sibling = node->sibling();
-        } else if (node == parent->right_child() && (sibling->left_child() == nullptr || sibling->left_child()->is_black()) && (sibling->right_child() != nullptr && sibling->right_child()->is_red())) {
-            sibling->set_red_color();
-            sibling->right_child()->set_black_color();
-            rotate_left(sibling);
-            sibling = node->sibling();
-        }
+    template <typename T, typename = void>
+    struct HasShrinkToFit : std::false_type { };
 
-        // Case 3.5. Here sibling is black and its right child is red (when node is a left  child)
-        //                                  or its left  child is red (when node is a right child)
+    template <typename T>
+    struct HasShrinkToFit<T, std::void_t<decltype(std::declval<T&>().shrink_to_fit())>> : std::true_type { };
 
-        sibling->set_color(parent->is_black());
-        parent->set_black_color();
+    template <typename T, typename = void>
+    struct HasReserveContiguous : std::false_type { };
 
-        if (node == parent->left_child()) {
-            sibling->right_child()->set_black_color();
-            rotate_left(parent);
-        } else {
-            sibling->left_child()->set_black_color();
-            rotate_right(parent);
-        }
-        // Now black-height is the same in the whole tree, so we are done
-    }
+    template <typename T>
+    struct HasReserveContiguous<T, std::void_t<decltype(std::declval<T&>().reserve_contiguous(size_t()))>> : std::true_type { };
 
 private:
-    template <typename K, typename V>
+    template <typename T>
     friend class BaseIterator;
 
+    friend InsertPosition;
+
     TreeNode* get_last() const
     { return m_max_node; }
 
 private:
-    TreeNode* m_root = nullptr;
-    size_t    m_size = 0;
+    NodeAllocator m_allocator;
+    Slab          m_slab;
+    IndexTable    m_index;
+
+    mutable FindCache<TreeNode> m_find_cache;
+
+    // Changes whenever nodes are linked, unlinked or moved, so that stale insert positions are noticed
+    size_t m_version = 0;
 
-    TreeNode* m_min_node = nullptr;
-    TreeNode* m_max_node = nullptr;
+    CountingBloomFilter<Allocator> m_filter;
 };
 
 } /*namespace naive*/
\ No newline at end of file
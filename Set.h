@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+
+#include "RedBlackTree.h"
+
+namespace naive {
+
+// Ordered set of unique keys. Nodes store the key alone, there is no mapped value to pad for.
+// Keys can't be modified through iterators, so Iterator and ConstIterator are the same type.
+template <typename Key, typename Allocator = std::allocator<Key>, typename Layout = PlainLayout, typename Compare = std::less<Key>>
+class Set :
+    public RedBlackTree<Key, void, Allocator, Layout, Compare>
+{
+public:
+    using Tree                 = RedBlackTree<Key, void, Allocator, Layout, Compare>;
+    using ValueType            = typename Tree::ValueType;
+    using AllocatorType        = typename Tree::AllocatorType;
+    using CompareType          = typename Tree::CompareType;
+    using Iterator             = typename Tree::ConstIterator;
+    using ConstIterator        = typename Tree::ConstIterator;
+    using ReverseIterator      = typename Tree::ReverseConstIterator;
+    using ReverseConstIterator = typename Tree::ReverseConstIterator;
+    using InsertPosition       = typename Tree::InsertPosition;
+
+private:
+    // Lookups by other types than Key need a transparent comparator
+    template <typename K>
+    using EnableTransparent = std::enable_if_t<IsTransparentCompare<Compare, K>::value>;
+
+    // Erasing by such a key must not be picked for erasing at an iterator
+    template <typename K>
+    using EnableTransparentErase = std::enable_if_t<IsTransparentCompare<Compare, K>::value &&
+                                                    !std::is_convertible<const K&, ConstIterator>::value>;
+
+public:
+    // Construct, destruct, assign
+    Set() = default;
+
+    explicit Set(const Allocator& allocator) :
+        Tree(allocator)
+    { }
+
+    explicit Set(const Compare& compare, const Allocator& allocator = Allocator()) :
+        Tree(compare, allocator)
+    { }
+
+    Set(const Set& set) :
+        Tree(set)
+    { }
+
+    Set(Set&& set) :
+        Tree(std::move(set))
+    { }
+
+    // Sorted input without equal keys is recognized and built from in linear time
+    template<class InputIt>
+    Set(InputIt first, InputIt last, const Allocator& allocator = Allocator()) :
+        Tree(allocator)
+    { Tree::assign_range(first, last); }
+
+    Set(std::initializer_list<ValueType> init, const Allocator& allocator = Allocator()) :
+        Tree(allocator)
+    { Tree::assign_range(init.begin(), init.end()); }
+
+    ~Set() = default;
+
+    Set& operator=(const Set& set)
+    {
+        Tree::operator=(set);
+        return *this;
+    }
+
+    Set& operator=(Set&& set)
+    {
+        Tree::operator=(std::move(set));
+        return *this;
+    }
+
+    Set& operator=(std::initializer_list<ValueType> ilist)
+    {
+        clear();
+        Tree::assign_range(ilist.begin(), ilist.end());
+        return *this;
+    }
+
+    // Builds the set from a range sorted by key without equal keys, in linear time
+    template <class ForwardIt>
+    static Set from_sorted(ForwardIt first, ForwardIt last, const Allocator& allocator = Allocator())
+    {
+        Set set(allocator);
+        set.assign_sorted(first, last);
+        return set;
+    }
+
+    // Replaces the contents with a range sorted by key without equal keys, in linear time
+    template <class ForwardIt>
+    void assign_sorted(ForwardIt first, ForwardIt last)
+    { Tree::assign_sorted(first, last); }
+
+    // Replaces the contents with a range in any order, sorting it and building the tree on up to
+    // `threads` threads (0: one per core). Of elements with equal keys, the first or the last one
+    // in the range is kept.
+    template <class ForwardIt>
+    void bulk_load(ForwardIt first, ForwardIt last, unsigned threads = 0, DuplicateKeys duplicates = DuplicateKeys::KeepFirst)
+    { Tree::bulk_load(first, last, threads, duplicates); }
+
+public:
+    // Iterators
+
+    Iterator begin() const
+    { return Tree::cbegin(); }
+    Iterator end() const
+    { return Tree::cend(); }
+
+    ConstIterator cbegin() const
+    { return Tree::cbegin(); }
+    ConstIterator cend() const
+    { return Tree::cend(); }
+
+    ReverseIterator rbegin() const
+    { return Tree::rcbegin(); }
+    ReverseIterator rend() const
+    { return Tree::rcend(); }
+
+    ReverseConstIterator rcbegin() const
+    { return Tree::rcbegin(); }
+    ReverseConstIterator rcend() const
+    { return Tree::rcend(); }
+
+public:
+    // Capacity
+
+    bool empty() const
+    { return Tree::empty(); }
+
+    size_t size() const
+    { return Tree::size(); }
+
+    void reserve(size_t count)
+    { Tree::reserve(count); }
+
+    void shrink_to_fit()
+    { Tree::shrink_to_fit(); }
+
+    AllocatorType get_allocator() const
+    { return Tree::get_allocator(); }
+
+    CompareType key_comp() const
+    { return Tree::key_comp(); }
+
+    // Let find() and count() check the last few found elements before searching the tree.
+    // Lookups then modify the container: don't turn it on for one searched by several threads.
+    void enable_find_cache(bool enable = true)
+    { Tree::enable_find_cache(enable); }
+
+    bool find_cache_enabled() const
+    { return Tree::find_cache_enabled(); }
+
+    FindCacheStats find_cache_stats() const
+    { return Tree::find_cache_stats(); }
+
+    // Reject most lookups of absent keys with a counting Bloom filter of the keys instead of a
+    // descent. Needs std::hash<Key>; the filter is kept up to date by every modification.
+    void enable_filter(double false_positive_rate = 0.01)
+    { Tree::enable_filter(false_positive_rate); }
+
+    void disable_filter()
+    { Tree::disable_filter(); }
+
+    bool filter_enabled() const
+    { return Tree::filter_enabled(); }
+
+    // Checks the tree's invariants and the filter entries, walking every element
+    bool verify() const
+    { return Tree::verify(); }
+
+public:
+    // Modifiers
+
+    void clear()
+    { Tree::clear(); }
+
+    Pair<Iterator, bool> insert(const ValueType& value)
+    { return emplace(value); }
+
+    Pair<Iterator, bool> insert(ValueType&& value)
+    { return emplace(std::move(value)); }
+
+    Iterator insert(ConstIterator hint, const ValueType& value)
+    { return emplace_hint(hint, value); }
+
+    Iterator insert(ConstIterator hint, ValueType&& value)
+    { return emplace_hint(hint, std::move(value)); }
+
+    template<class InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        while (first != last) {
+            insert(*first);
+            ++first;
+        }
+    }
+
+    void insert(std::initializer_list<ValueType> ilist)
+    { insert(ilist.begin(), ilist.end()); }
+
+    template <typename ... Args>
+    Pair<Iterator, bool> emplace(Args && ... args)
+    {
+        auto result = Tree::emplace(std::forward<Args>(args)...);
+        return MakePair(Iterator(result.first), result.second);
+    }
+
+    // Inserts without a search when the element belongs right before the hint, e.g. appending
+    // increasing keys with end() as the hint. Otherwise the hint is ignored.
+    template <typename ... Args>
+    Iterator emplace_hint(ConstIterator hint, Args && ... args)
+    { return Tree::emplace_hint(hint, std::forward<Args>(args)...).first; }
+
+    // Lookup that, for a missing key, returns end() and where emplace_at() can link it without searching again
+    Pair<Iterator, InsertPosition> find_or_position(const Key& key)
+    {
+        auto result = Tree::find_or_position(key);
+        return MakePair(Iterator(result.first), result.second);
+    }
+
+    // The element must be the key the position was found for. After a modification the position
+    // is not used and the key is searched for again.
+    template <typename ... Args>
+    Pair<Iterator, bool> emplace_at(InsertPosition position, Args && ... args)
+    {
+        auto result = Tree::emplace_at(position, std::forward<Args>(args)...);
+        return MakePair(Iterator(result.first), result.second);
+    }
+
+    Iterator erase(ConstIterator pos)
+    { return Tree::erase(pos); }
+
+    // Cuts the range out of the tree and joins the rest back: O(log n), plus freeing the elements
+    Iterator erase(ConstIterator first, ConstIterator last)
+    { return Tree::erase(first, last); }
+
+    size_t erase(const Key& key)
+    {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+
+        erase(it);
+        return 1;
+    }
+
+    // Heterogeneous erasure, e.g. by std::string_view with std::less<>
+    template <typename K, typename = EnableTransparentErase<K>>
+    size_t erase(const K& key)
+    {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+
+        erase(it);
+        return 1;
+    }
+
+    // Erases the elements with keys from `lower` up to, not including, `upper`. Returns how many
+    // there were. O(log n) plus freeing them; to free them later, or on another thread, cut() the
+    // range instead and drop the result when convenient.
+    size_t erase(const Key& lower, const Key& upper)
+    { return Tree::erase_range(lower, upper); }
+
+    // Erases the elements for which pred(element) is true and returns how many there were, see
+    // also erase_if(set, pred). Rebuilds the tree in linear time when many of them go.
+    template <typename Predicate>
+    size_t erase_if(Predicate pred)
+    { return Tree::erase_if(pred); }
+
+    // Moves the elements with keys from `key` on into the returned set. O(log n) plus a walk of
+    // the smaller part, to count it. Elements of contiguous layouts, and of sets whose allocators
+    // compare unequal, are moved one by one.
+    Set split(const Key& key)
+    {
+        Set set(key_comp(), get_allocator());
+        Tree::move_range(lower_bound(key), end(), set);
+        return set;
+    }
+
+    // Moves the elements with keys from `lower` up to, not including, `upper` into the returned
+    // set, in the time split() takes
+    Set cut(const Key& lower, const Key& upper)
+    {
+        Set set(key_comp(), get_allocator());
+        if (key_comp()(lower, upper)) {
+            Tree::move_range(lower_bound(lower), lower_bound(upper), set);
+        }
+        return set;
+    }
+
+    // Appends the elements of `set`, whose keys must all be greater than those here, leaving it
+    // empty. O(log n) when its nodes can be taken over, see split().
+    void join(Set& set)
+    { Tree::join(set); }
+
+    // Set operations, leaving `set` empty. When the sets share an allocator and the layout isn't
+    // contiguous, the nodes move between them and the work is O(m log(n/m + 1)) for sizes m <= n,
+    // split over up to `threads` threads (0: one per core). Otherwise each key is looked up in the
+    // other set with a finger search. Comparisons must not throw.
+
+    void unite(Set& set, unsigned threads = 0)
+    {
+        KeepLeftValue merge;
+        Tree::unite(set, merge, threads);
+    }
+
+    void intersect(Set& set, unsigned threads = 0)
+    { Tree::intersect(set, threads); }
+
+    void subtract(Set& set, unsigned threads = 0)
+    { Tree::subtract(set, threads); }
+
+    void swap(Set& other) noexcept
+    { Tree::swap(other); }
+
+    void compact(CompactOrder order = CompactOrder::VanEmdeBoas)
+    { Tree::compact(order); }
+
+public:
+    // Lookup
+
+    size_t count(const Key& key) const
+    { return Tree::count(key); }
+
+    ConstIterator find(const Key& key) const
+    { return Tree::find(key); }
+
+    Pair<ConstIterator, ConstIterator> equal_range(const Key& key) const
+    { return Tree::equal_range(key); }
+
+    ConstIterator lower_bound(const Key& key) const
+    { return Tree::lower_bound(key); }
+
+    ConstIterator upper_bound(const Key& key) const
+    { return Tree::upper_bound(key); }
+
+    // Finger search, starting from an element close to the key rather than from the root
+
+    ConstIterator find(ConstIterator hint, const Key& key) const
+    { return Tree::find(hint, key); }
+
+    ConstIterator lower_bound(ConstIterator hint, const Key& key) const
+    { return Tree::lower_bound(hint, key); }
+
+    // Heterogeneous lookup, e.g. by std::string_view in a Set<std::string, ..., std::less<>>
+
+    template <typename K, typename = EnableTransparent<K>>
+    size_t count(const K& key) const
+    { return Tree::count(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator find(const K& key) const
+    { return Tree::find(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    Pair<ConstIterator, ConstIterator> equal_range(const K& key) const
+    { return Tree::equal_range(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator lower_bound(const K& key) const
+    { return Tree::lower_bound(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator upper_bound(const K& key) const
+    { return Tree::upper_bound(key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator find(ConstIterator hint, const K& key) const
+    { return Tree::find(hint, key); }
+
+    template <typename K, typename = EnableTransparent<K>>
+    ConstIterator lower_bound(ConstIterator hint, const K& key) const
+    { return Tree::lower_bound(hint, key); }
+
+    // Batched lookup of many keys, of Key or of a type the transparent comparator accepts.
+    // out[i] is find(first[i]); the descents are interleaved to overlap their cache misses.
+
+    template <typename ForwardIt, typename RandomIt>
+    void find_many(ForwardIt first, ForwardIt last, RandomIt out) const
+    { Tree::find_many(first, last, out); }
+
+    // How many of the keys are in the container
+    template <typename ForwardIt>
+    size_t count_many(ForwardIt first, ForwardIt last) const
+    { return Tree::count_many(first, last); }
+};
+
+template<typename Key, typename Allocator, typename Layout, typename Compare>
+bool operator==(const Set<Key, Allocator, Layout, Compare>& lhs, const Set<Key, Allocator, Layout, Compare>& rhs)
+{
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+
+    auto lit  = lhs.cbegin();
+    auto lend = lhs.cend();
+    auto rit  = rhs.cbegin();
+
+    for(; lit != lend; ++lit, ++rit) {
+        if (*lit != *rit){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template<typename Key, typename Allocator, typename Layout, typename Compare>
+bool operator!=(const Set<Key, Allocator, Layout, Compare>& lhs, const Set<Key, Allocator, Layout, Compare>& rhs)
+{
+    return !operator==(lhs, rhs);
+}
+
+template<typename Key, typename Allocator, typename Layout, typename Compare>
+bool operator<(const Set<Key, Allocator, Layout, Compare>& lhs, const Set<Key, Allocator, Layout, Compare>& rhs)
+{
+    return std::lexicographical_compare(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend());
+}
+
+template<typename Key, typename Allocator, typename Layout, typename Compare>
+bool operator<=(const Set<Key, Allocator, Layout, Compare>& lhs, const Set<Key, Allocator, Layout, Compare>& rhs)
+{
+    return !operator<(rhs, lhs);
+}
+
+template<typename Key, typename Allocator, typename Layout, typename Compare>
+bool operator>(const Set<Key, Allocator, Layout, Compare>& lhs, const Set<Key, Allocator, Layout, Compare>& rhs)
+{
+    return operator<(rhs, lhs);
+}
+
+template<typename Key, typename Allocator, typename Layout, typename Compare>
+bool operator>=(const Set<Key, Allocator, Layout, Compare>& lhs, const Set<Key, Allocator, Layout, Compare>& rhs)
+{
+    return !operator<(lhs, rhs);
+}
+
+template<typename Key, typename Allocator, typename Layout, typename Compare>
+void swap(Set<Key, Allocator, Layout, Compare>& lhs, Set<Key, Allocator, Layout, Compare>& rhs)
+{
+    lhs.swap(rhs);
+}
+
+template<typename Key, typename Allocator, typename Layout, typename Compare, typename Predicate>
+size_t erase_if(Set<Key, Allocator, Layout, Compare>& set, Predicate pred)
+{
+    return set.erase_if(pred);
+}
+
+} /*namespace naive*/
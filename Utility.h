@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <tuple>
 #include <type_traits>
 
@@ -142,11 +143,27 @@ Pair<T1, T2>::Pair(Tuple1& Val1, Tuple2& Val2, std::index_sequence<Indexes1...>,
 {
 }
 
+// What MakePair stores for an argument: its decayed type, or T& for a std::reference_wrapper<T>
+template <typename T>
+struct _UnwrapReference
+{
+    using Type = T;
+};
+
+template <typename T>
+struct _UnwrapReference<std::reference_wrapper<T>>
+{
+    using Type = T&;
+};
+
+template <typename T>
+using UnwrapRefDecay = typename _UnwrapReference<std::decay_t<T>>::Type;
+
 template<typename T1, typename T2>
-Pair<typename std::_Unrefwrap_t<T1>, typename std::_Unrefwrap_t<T2>>
+Pair<UnwrapRefDecay<T1>, UnwrapRefDecay<T2>>
 MakePair(T1 && v, T2 && u)
 {
-    using MyPair = Pair<typename std::_Unrefwrap_t<T1>, typename std::_Unrefwrap_t<T2>>;
+    using MyPair = Pair<UnwrapRefDecay<T1>, UnwrapRefDecay<T2>>;
     return MyPair(std::forward<T1>(v), std::forward<T2>(u));
 }
 
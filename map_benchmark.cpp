@@ -0,0 +1,1414 @@
+#include "IntrusiveMap.h"
+#include "Map.h"
+#include "NodePool.h"
+#include "Set.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace naive;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+double measure_ns(size_t operations, F&& f)
+{
+    auto start = Clock::now();
+    f();
+    auto finish = Clock::now();
+    return std::chrono::duration<double, std::nano>(finish - start).count() / operations;
+}
+
+std::vector<uint64_t> random_keys(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<uint64_t> keys(count);
+    for (auto& key : keys) {
+        key = rng();
+    }
+    return keys;
+}
+
+// Keep the map at a steady size while erasing the oldest and inserting a new key on every step
+template <typename MapType>
+double churn(MapType& map, size_t size, size_t steps)
+{
+    auto keys = random_keys(size + steps, 1);
+    for (size_t i = 0; i < size; ++i) {
+        map.emplace(keys[i], i);
+    }
+
+    return measure_ns(steps, [&] {
+        for (size_t i = 0; i < steps; ++i) {
+            map.erase(keys[i]);
+            map.emplace(keys[size + i], i);
+        }
+    });
+}
+
+void benchmark_allocator()
+{
+    using PooledMap = Map<uint64_t, uint64_t, PoolAllocator<Pair<const uint64_t, uint64_t>>>;
+
+    std::printf("allocator: erase + insert, ns per step\n");
+    for (size_t size : {1000, 100000, 1000000}) {
+        const size_t steps = 2000000;
+
+        Map<uint64_t, uint64_t> plain;
+        PooledMap pooled;
+        PooledMap reserved;
+        reserved.reserve(size + 1);
+
+        std::printf("  size %8zu  new/delete %7.1f  pool %7.1f  pool+reserve %7.1f\n", size,
+            churn(plain, size, steps), churn(pooled, size, steps), churn(reserved, size, steps));
+    }
+}
+
+// Counts the bytes held by a container
+size_t g_allocated_bytes = 0;
+
+template <typename T>
+struct CountingAllocator
+{
+    using value_type = T;
+
+    CountingAllocator() = default;
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&)
+    { }
+
+    T* allocate(size_t n)
+    {
+        g_allocated_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        g_allocated_bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>&) const
+    { return true; }
+
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>&) const
+    { return false; }
+};
+
+template <typename Layout>
+void report_layout(const char* name, size_t size)
+{
+    using Allocator = CountingAllocator<Pair<const uint64_t, uint32_t>>;
+    using MapType   = Map<uint64_t, uint32_t, Allocator, Layout>;
+
+    MapType map;
+    auto keys = random_keys(size, 2);
+    map.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        map.emplace(keys[i], static_cast<uint32_t>(i));
+    }
+
+    const double bytes = static_cast<double>(g_allocated_bytes) / map.size();
+    const double payload = sizeof(Pair<const uint64_t, uint32_t>);
+
+    uint64_t found = 0;
+    const double lookup = measure_ns(size, [&] {
+        for (size_t i = 0; i < size; ++i) {
+            found += map.count(keys[i]);
+        }
+    });
+
+    std::printf("  %-18s node %3zu bytes  %6.1f bytes/element  overhead %5.1f  lookup %6.1f ns  (%llu)\n",
+        name, sizeof(TreeNode<uint64_t, uint32_t, Layout>), bytes, bytes - payload, lookup,
+        static_cast<unsigned long long>(found));
+}
+
+void benchmark_layout()
+{
+    std::printf("layout: Map<uint64_t, uint32_t>, payload %zu bytes, allocator overhead not included\n", sizeof(Pair<const uint64_t, uint32_t>));
+    for (size_t size : {1000, 1000000}) {
+        std::printf(" size %zu\n", size);
+        report_layout<PlainLayout>("PlainLayout", size);
+        report_layout<PackedColorLayout>("PackedColorLayout", size);
+        report_layout<ParentFreeLayout>("ParentFreeLayout", size);
+        report_layout<IndexLayout>("IndexLayout", size);
+    }
+}
+
+struct Record
+{
+    char bytes[200];
+};
+
+template <typename Layout>
+void report_cold_values(const char* name, size_t size)
+{
+    using MapType = Map<uint64_t, Record, PoolAllocator<Pair<const uint64_t, Record>>, Layout>;
+
+    MapType map;
+    auto keys = random_keys(size, 3);
+    for (size_t i = 0; i < size; ++i) {
+        map.emplace(keys[i], Record());
+    }
+
+    auto probes = random_keys(size, 4);
+    for (size_t i = 0; i < size; i += 2) {
+        probes[i] = keys[i];
+    }
+
+    uint64_t found = 0;
+    const double lookup = measure_ns(size, [&] {
+        for (uint64_t key : probes) {
+            found += map.count(key);
+        }
+    });
+
+    std::printf("  %-28s node %3zu bytes  lookup %6.1f ns  (%llu)\n", name,
+        sizeof(TreeNode<uint64_t, Record, Layout>), lookup, static_cast<unsigned long long>(found));
+}
+
+void benchmark_cold_values()
+{
+    std::printf("cold values: Map<uint64_t, 200-byte record>, half of the lookups hit\n");
+    for (size_t size : {10000, 1000000}) {
+        std::printf(" size %zu\n", size);
+        report_cold_values<PlainLayout>("PlainLayout", size);
+        report_cold_values<ColdValueLayout<>>("ColdValueLayout", size);
+        report_cold_values<AutoColdValueLayout<PackedColorLayout>>("AutoColdValueLayout<Packed>", size);
+    }
+}
+
+template <typename MapType>
+double lookup_ns(const MapType& map, const std::vector<uint64_t>& probes)
+{
+    uint64_t found = 0;
+    const double result = measure_ns(probes.size(), [&] {
+        for (uint64_t key : probes) {
+            found += map.count(key);
+        }
+    });
+    return (found != 0) ? result : 0.0;
+}
+
+void benchmark_compact()
+{
+    const size_t size = 500000;
+    const size_t steps = 2000000;
+
+    std::printf("compact: Map<uint64_t, uint64_t>, %zu elements, lookup ns after %zu erase + insert steps\n", size, steps);
+
+    const char* names[] = {"BreadthFirst", "DepthFirst", "VanEmdeBoas"};
+    for (CompactOrder order : {CompactOrder::BreadthFirst, CompactOrder::DepthFirst, CompactOrder::VanEmdeBoas}) {
+        Map<uint64_t, uint64_t> map;
+        auto keys = random_keys(size + steps, 5);
+        for (size_t i = 0; i < size; ++i) {
+            map.emplace(keys[i], i);
+        }
+
+        std::vector<uint64_t> probes(keys.begin(), keys.begin() + size);
+        const double fresh = lookup_ns(map, probes);
+
+        std::mt19937_64 rng(6);
+        for (size_t i = 0; i < steps; ++i) {
+            // Erase a random live key and insert a new one
+            const size_t victim = rng() % size;
+            map.erase(probes[victim]);
+            probes[victim] = keys[size + i];
+            map.emplace(probes[victim], i);
+        }
+        const double churned = lookup_ns(map, probes);
+
+        const double compaction = measure_ns(1, [&] { map.compact(order); });
+        const double compacted = lookup_ns(map, probes);
+
+        std::printf("  %-12s  fresh %6.1f  churned %6.1f  compacted %6.1f  (compact() took %.1f ms)\n",
+            names[static_cast<int>(order)], fresh, churned, compacted, compaction / 1e6);
+    }
+}
+
+struct Session :
+    IntrusiveMapHook<Session>
+{
+    uint64_t id;
+    uint64_t payload;
+};
+
+struct SessionId
+{
+    const uint64_t& operator()(const Session& session) const
+    { return session.id; }
+};
+
+void benchmark_intrusive()
+{
+    const size_t steps = 2000000;
+
+    std::printf("intrusive: erase + insert of pooled objects, ns per step\n");
+    for (size_t size : {1000, 100000, 1000000}) {
+        auto keys = random_keys(size + steps, 7);
+
+        // Both containers index the same objects; Map needs a node per object, IntrusiveMap none
+        std::vector<Session> sessions(size);
+        Map<uint64_t, Session*> map;
+        IntrusiveMap<uint64_t, Session, SessionId> intrusive;
+        for (size_t i = 0; i < size; ++i) {
+            sessions[i].id = keys[i];
+            map.emplace(keys[i], &sessions[i]);
+            intrusive.insert(sessions[i]);
+        }
+
+        const double mapped = measure_ns(steps, [&] {
+            for (size_t i = 0; i < steps; ++i) {
+                map.erase(keys[i]);
+                map.emplace(keys[size + i], &sessions[i % size]);
+            }
+        });
+
+        const double linked = measure_ns(steps, [&] {
+            for (size_t i = 0; i < steps; ++i) {
+                Session& session = sessions[i % size];
+                intrusive.erase(session);
+                session.id = keys[size + i];
+                intrusive.insert(session);
+            }
+        });
+
+        std::printf("  size %8zu  Map %7.1f  IntrusiveMap %7.1f\n", size, mapped, linked);
+    }
+}
+
+struct Empty
+{ };
+
+// Bytes held per id after inserting `size` ids with `insert_id`
+template <typename Container, typename F>
+double bytes_per_id(size_t size, F&& insert_id)
+{
+    Container container;
+    container.reserve(size);
+    for (uint64_t key : random_keys(size, 8)) {
+        insert_id(container, key);
+    }
+
+    return static_cast<double>(g_allocated_bytes) / container.size();
+}
+
+template <typename Layout>
+void report_set(const char* name, size_t size)
+{
+    using MapType = Map<uint64_t, Empty, CountingAllocator<Pair<const uint64_t, Empty>>, Layout>;
+    using SetType = Set<uint64_t, CountingAllocator<uint64_t>, Layout>;
+
+    const double map_bytes = bytes_per_id<MapType>(size, [](MapType& map, uint64_t key) { map.emplace(key, Empty()); });
+    const double set_bytes = bytes_per_id<SetType>(size, [](SetType& set, uint64_t key) { set.insert(key); });
+
+    std::printf("  %-18s Map<uint64_t, Empty> %5.1f bytes/id  Set<uint64_t> %5.1f bytes/id\n", name, map_bytes, set_bytes);
+}
+
+void benchmark_set()
+{
+    const size_t size = 1000000;
+
+    std::printf("set: %zu ids, allocator overhead not included\n", size);
+    report_set<PlainLayout>("PlainLayout", size);
+    report_set<PackedColorLayout>("PackedColorLayout", size);
+    report_set<ParentFreeLayout>("ParentFreeLayout", size);
+    report_set<IndexLayout>("IndexLayout", size);
+}
+
+// Keys longer than the small string buffer, so every std::string key has a heap block of its own
+std::vector<std::string> random_names(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<std::string> names(count);
+    for (auto& name : names) {
+        name = "config/section_" + std::to_string(rng() % 1000) + "/entry_" + std::to_string(rng());
+    }
+    return names;
+}
+
+template <typename MapType, typename Probe>
+void report_string_keys(const char* name, const std::vector<std::string>& names, const std::vector<Probe>& probes)
+{
+    MapType map;
+    const double insert = measure_ns(names.size(), [&] {
+        for (size_t i = 0; i < names.size(); ++i) {
+            map.emplace(names[i], i);
+        }
+    });
+
+    uint64_t found = 0;
+    const double lookup = measure_ns(probes.size(), [&] {
+        for (const auto& probe : probes) {
+            found += map.count(probe);
+        }
+    });
+
+    std::printf("  %-40s insert %6.1f ns  lookup %6.1f ns  (%llu)\n", name, insert, lookup, static_cast<unsigned long long>(found));
+}
+
+void benchmark_string_keys()
+{
+    std::printf("string keys: keys of about %zu bytes, every lookup hits\n", random_names(1000, 9)[0].size());
+    for (size_t size : {10000, 1000000}) {
+        auto names = random_names(size, 9);
+        std::vector<std::string> probes(names.rbegin(), names.rend());
+        std::vector<std::string_view> views(probes.begin(), probes.end());
+
+        std::printf(" size %zu\n", size);
+        report_string_keys<Map<std::string, uint64_t>>("Map<std::string>", names, probes);
+        report_string_keys<Map<std::string_view, uint64_t, std::allocator<Pair<const std::string_view, uint64_t>>, InlineKeyLayout<>>>(
+            "Map<std::string_view, InlineKeyLayout>", names, views);
+    }
+}
+
+std::vector<std::string> url_keys(size_t count, uint64_t seed)
+{
+    static const char* hosts[] = {"api", "cdn", "www", "static", "auth", "mail", "shop", "docs"};
+
+    std::mt19937_64 rng(seed);
+    std::vector<std::string> keys(count);
+    for (auto& key : keys) {
+        key = std::string(hosts[rng() % 8]) + ".example.com/v" + std::to_string(rng() % 3) +
+              "/items/" + std::to_string(rng() % 100000000);
+    }
+    return keys;
+}
+
+std::vector<std::string> path_keys(size_t count, uint64_t seed)
+{
+    static const char* roots[] = {"/usr/lib/", "/usr/share/", "/var/log/", "/home/user/", "/opt/app/", "/etc/"};
+
+    std::mt19937_64 rng(seed);
+    std::vector<std::string> keys(count);
+    for (auto& key : keys) {
+        key = std::string(roots[rng() % 6]) + "module_" + std::to_string(rng() % 10000) + "/file_" +
+              std::to_string(rng() % 100000) + ".dat";
+    }
+    return keys;
+}
+
+// Keys that differ in their first bytes and share a long tail
+std::vector<std::string> id_keys(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<std::string> keys(count);
+    for (auto& key : keys) {
+        key = std::to_string(rng()) + "/attributes/long/shared/tail";
+    }
+    return keys;
+}
+
+template <typename Layout>
+void report_key_prefix(const char* name, const std::vector<std::string>& keys)
+{
+    Map<std::string, uint64_t, std::allocator<Pair<const std::string, uint64_t>>, Layout> map;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        map.emplace(keys[i], i);
+    }
+
+    std::vector<std::string> probes(keys.rbegin(), keys.rend());
+    uint64_t found = 0;
+    const double lookup = measure_ns(probes.size(), [&] {
+        for (const auto& probe : probes) {
+            found += map.count(probe);
+        }
+    });
+
+    std::printf("    %-16s lookup %6.1f ns  (%llu)\n", name, lookup, static_cast<unsigned long long>(found));
+}
+
+void benchmark_key_prefix()
+{
+    const size_t size = 1000000;
+
+    // The first 8 bytes of URL-like and path-like keys take only a handful of values, so the cached
+    // prefix settles the top levels only; id-like keys differ right away
+    const Pair<const char*, std::vector<std::string>> families[] = {
+        {"URL-like", url_keys(size, 10)},
+        {"path-like", path_keys(size, 11)},
+        {"id-like", id_keys(size, 12)},
+    };
+
+    std::printf("key prefix: Map<std::string, uint64_t>, %zu keys, every lookup hits\n", size);
+    for (const auto& family : families) {
+        std::printf("  %s, e.g. %s\n", family.first, family.second[0].c_str());
+        report_key_prefix<PlainLayout>("PlainLayout", family.second);
+        report_key_prefix<KeyPrefixLayout<>>("KeyPrefixLayout", family.second);
+    }
+}
+
+
+// Incoming keys are views into a request buffer; std::less<Key> needs a std::string built for each of them
+template <typename MapType, typename MakeKey>
+void report_transparent(const char* name, const std::vector<std::string>& keys, MakeKey&& make_key)
+{
+    const size_t rounds = 20;
+
+    MapType map;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        map.emplace(keys[i], i);
+    }
+
+    std::vector<std::string_view> probes(keys.rbegin(), keys.rend());
+    uint64_t found = 0;
+    const double lookup = measure_ns(probes.size() * rounds, [&] {
+        for (size_t round = 0; round < rounds; ++round) {
+            for (auto probe : probes) {
+                found += map.count(make_key(probe));
+            }
+        }
+    });
+
+    std::printf("  %-42s lookup %6.1f ns  (%llu)\n", name, lookup, static_cast<unsigned long long>(found));
+}
+
+void benchmark_transparent()
+{
+    using Allocator = std::allocator<Pair<const std::string, uint64_t>>;
+
+    const size_t size = 10000;
+    auto keys = url_keys(size, 13);
+
+    std::printf("transparent lookup: Map<std::string, uint64_t>, %zu keys, probed by std::string_view\n", size);
+    report_transparent<Map<std::string, uint64_t>>("std::less<std::string>, std::string(view)", keys,
+        [](std::string_view view) { return std::string(view); });
+    report_transparent<Map<std::string, uint64_t, Allocator, PlainLayout, std::less<>>>("std::less<>, view", keys,
+        [](std::string_view view) { return view; });
+}
+
+
+uint64_t comparisons = 0;
+
+struct CountingLess
+{
+    bool operator()(const std::string& lhs, const std::string& rhs) const
+    {
+        ++comparisons;
+        return lhs < rhs;
+    }
+};
+
+template <typename F>
+double comparisons_per_operation(size_t operations, F&& f)
+{
+    comparisons = 0;
+    f();
+    return static_cast<double>(comparisons) / operations;
+}
+
+void benchmark_comparisons()
+{
+    using CountingMap = Map<std::string, uint64_t, std::allocator<Pair<const std::string, uint64_t>>, PlainLayout, CountingLess>;
+
+    std::printf("comparisons: Map<std::string, uint64_t>, comparator calls per operation, half of the lookups hit\n");
+    for (size_t size : {1000, 1000000}) {
+        auto keys = random_names(2 * size, 14);
+        std::vector<std::string> probes(keys.rbegin(), keys.rend());
+
+        CountingMap map;
+        const double insert = comparisons_per_operation(size, [&] {
+            for (size_t i = 0; i < size; ++i) {
+                map.emplace(keys[i], i);
+            }
+        });
+
+        uint64_t found = 0;
+        const double find = comparisons_per_operation(probes.size(), [&] {
+            for (const auto& probe : probes) {
+                found += (map.find(probe) != map.end()) ? 1 : 0;
+            }
+        });
+
+        const double lower_bound = comparisons_per_operation(probes.size(), [&] {
+            for (const auto& probe : probes) {
+                found += (map.lower_bound(probe) != map.end()) ? 1 : 0;
+            }
+        });
+
+        const double equal_range = comparisons_per_operation(probes.size(), [&] {
+            for (const auto& probe : probes) {
+                auto range = map.equal_range(probe);
+                found += (range.first != range.second) ? 1 : 0;
+            }
+        });
+
+        std::printf("  size %-8zu emplace %5.1f  find %5.1f  lower_bound %5.1f  equal_range %5.1f  (%llu)\n",
+                    size, insert, find, lower_bound, equal_range, static_cast<unsigned long long>(found));
+    }
+}
+
+
+// Probes come in batches, as from the build side of a join; half of them hit
+void benchmark_batch_lookup()
+{
+    const size_t size = 4000000;
+    const size_t probes_count = 1 << 20;
+
+    auto keys = random_keys(size, 15);
+    Map<uint64_t, uint64_t> map;
+    for (size_t i = 0; i < size; ++i) {
+        map.emplace(keys[i], i);
+    }
+
+    auto misses = random_keys(probes_count / 2, 16);
+    std::vector<uint64_t> probes(misses.begin(), misses.end());
+    probes.insert(probes.end(), keys.begin(), keys.begin() + probes_count / 2);
+    std::shuffle(probes.begin(), probes.end(), std::mt19937_64(17));
+
+    uint64_t found = 0;
+    const double one_by_one = measure_ns(probes.size(), [&] {
+        for (const auto& probe : probes) {
+            found += map.count(probe);
+        }
+    });
+
+    std::printf("batch lookup: Map<uint64_t, uint64_t>, %zu keys, %zu probes\n", size, probes.size());
+    std::printf("  count              %6.1f ns/key  (%llu)\n", one_by_one, static_cast<unsigned long long>(found));
+    for (size_t batch : {1, 4, 16, 64, 256, 1024}) {
+        found = 0;
+        const double batched = measure_ns(probes.size(), [&] {
+            for (size_t i = 0; i < probes.size(); i += batch) {
+                found += map.count_many(probes.begin() + i, probes.begin() + std::min(i + batch, probes.size()));
+            }
+        });
+
+        std::printf("  count_many, %4zu   %6.1f ns/key  (%llu)\n", batch, batched, static_cast<unsigned long long>(found));
+    }
+}
+
+
+// Ranks 0..count-1 drawn with probability proportional to 1 / (rank + 1)^skew
+std::vector<size_t> zipf_ranks(size_t count, size_t draws, double skew, uint64_t seed)
+{
+    std::vector<double> cdf(count);
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += 1.0 / std::pow(static_cast<double>(i + 1), skew);
+        cdf[i] = sum;
+    }
+
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::vector<size_t> ranks(draws);
+    for (auto& rank : ranks) {
+        rank = std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin(), count - 1);
+    }
+    return ranks;
+}
+
+template <typename MapType>
+void report_locality(const char* name, MapType& map, const std::vector<uint64_t>& probes)
+{
+    uint64_t found = 0;
+    const double plain = measure_ns(probes.size(), [&] {
+        for (const auto& probe : probes) {
+            found += map.count(probe);
+        }
+    });
+
+    map.enable_find_cache(true);
+    const double cached = measure_ns(probes.size(), [&] {
+        for (const auto& probe : probes) {
+            found += map.count(probe);
+        }
+    });
+    const auto stats = map.find_cache_stats();
+    map.enable_find_cache(false);
+
+    // Each lookup starts from the previous result
+    auto hint = map.cbegin();
+    const double finger = measure_ns(probes.size(), [&] {
+        for (const auto& probe : probes) {
+            auto it = map.lower_bound(hint, probe);
+            found += (it != map.cend() && it->first == probe) ? 1 : 0;
+            hint = it;
+        }
+    });
+
+    std::printf("  %-22s find %6.1f ns  cached %6.1f ns (%4.1f%% hits)  finger %6.1f ns  (%llu)\n", name, plain, cached,
+                100.0 * stats.hits / stats.lookups, finger, static_cast<unsigned long long>(found));
+}
+
+void benchmark_locality()
+{
+    const size_t size = 1000000;
+    const size_t lookups = 2000000;
+
+    auto keys = random_keys(size, 18);
+    Map<uint64_t, uint64_t> map;
+    for (size_t i = 0; i < size; ++i) {
+        map.emplace(keys[i], i);
+    }
+
+    std::vector<uint64_t> sorted;
+    for (const auto& element : map) {
+        sorted.push_back(element.first);
+    }
+
+    std::printf("locality: Map<uint64_t, uint64_t>, %zu keys, %zu lookups\n", size, lookups);
+
+    // Popular keys are scattered over the whole key range
+    for (double skew : {0.8, 0.99, 1.2}) {
+        auto ranks = zipf_ranks(size, lookups, skew, 19);
+        std::vector<uint64_t> probes(lookups);
+        for (size_t i = 0; i < lookups; ++i) {
+            probes[i] = keys[ranks[i]];
+        }
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "zipf %.2f", skew);
+        report_locality(name, map, probes);
+    }
+
+    // A walk over neighbouring keys, with Zipf distributed steps
+    auto steps = zipf_ranks(100, lookups, 0.99, 20);
+    std::mt19937_64 rng(21);
+    std::vector<uint64_t> probes(lookups);
+    size_t position = size / 2;
+    for (size_t i = 0; i < lookups; ++i) {
+        position = (rng() % 2 != 0) ? (position + steps[i]) % size : (position + size - steps[i]) % size;
+        probes[i] = sorted[position];
+    }
+    report_locality("zipf 0.99 neighbours", map, probes);
+}
+
+
+// 80% of the lookups miss
+template <typename MapType, typename KeyType>
+void report_filter(MapType& map, const std::vector<KeyType>& probes)
+{
+    for (double rate : {0.0, 0.1, 0.01, 0.001}) {
+        if (rate == 0.0) {
+            map.disable_filter();
+        } else {
+            map.enable_filter(rate);
+        }
+
+        uint64_t found = 0;
+        const double lookup = measure_ns(probes.size(), [&] {
+            for (const auto& probe : probes) {
+                found += map.count(probe);
+            }
+        });
+
+        if (rate == 0.0) {
+            std::printf("    no filter      lookup %6.1f ns  (%llu)\n", lookup, static_cast<unsigned long long>(found));
+        } else {
+            std::printf("    filter %-6.3f  lookup %6.1f ns  (%llu)\n", rate, lookup, static_cast<unsigned long long>(found));
+        }
+    }
+}
+
+void benchmark_filter()
+{
+    const size_t size = 1000000;
+    const size_t lookups = 1000000;
+
+    std::printf("filter: %zu keys, %zu lookups of which 80%% miss\n", size, lookups);
+    {
+        auto keys = random_keys(size + lookups, 22);
+        Map<uint64_t, uint64_t> map;
+        for (size_t i = 0; i < size; ++i) {
+            map.emplace(keys[i], i);
+        }
+
+        std::vector<uint64_t> probes(keys.begin() + size, keys.begin() + size + lookups * 8 / 10);
+        probes.insert(probes.end(), keys.begin(), keys.begin() + lookups * 2 / 10);
+        std::shuffle(probes.begin(), probes.end(), std::mt19937_64(23));
+
+        std::printf("  Map<uint64_t, uint64_t>\n");
+        report_filter(map, probes);
+    }
+    {
+        auto keys = url_keys(size + lookups, 24);
+        Map<std::string, uint64_t> map;
+        for (size_t i = 0; i < size; ++i) {
+            map.emplace(keys[i], i);
+        }
+
+        std::vector<std::string> probes(keys.begin() + size, keys.begin() + size + lookups * 8 / 10);
+        probes.insert(probes.end(), keys.begin(), keys.begin() + lookups * 2 / 10);
+        std::shuffle(probes.begin(), probes.end(), std::mt19937_64(25));
+
+        std::printf("  Map<std::string, uint64_t>, URL-like keys\n");
+        report_filter(map, probes);
+    }
+}
+
+
+template <typename MapType, typename KeyType>
+void report_hash_index(const char* name, const std::vector<KeyType>& keys, const std::vector<KeyType>& probes)
+{
+    const size_t allocated = g_allocated_bytes;
+    MapType map;
+    const double insert = measure_ns(keys.size(), [&] {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            map.emplace(keys[i], i);
+        }
+    });
+    const double bytes = static_cast<double>(g_allocated_bytes - allocated) / map.size();
+
+    uint64_t found = 0;
+    const double find = measure_ns(probes.size(), [&] {
+        for (const auto& probe : probes) {
+            found += (map.find(probe) != map.end()) ? 1 : 0;
+        }
+    });
+
+    const double lower_bound = measure_ns(probes.size(), [&] {
+        for (const auto& probe : probes) {
+            found += (map.lower_bound(probe) != map.end()) ? 1 : 0;
+        }
+    });
+
+    const double erase = measure_ns(keys.size(), [&] {
+        for (const auto& key : keys) {
+            map.erase(key);
+        }
+    });
+
+    std::printf("    %-10s %5.1f bytes/element  insert %6.1f ns  find %6.1f ns  lower_bound %6.1f ns  erase %6.1f ns  (%llu)\n",
+                name, bytes, insert, find, lower_bound, erase, static_cast<unsigned long long>(found));
+}
+
+void benchmark_hash_index()
+{
+    std::printf("hash index: Map vs IndexedMap, half of the lookups hit\n");
+    for (size_t size : {1000, 1000000}) {
+        {
+            using Allocator = CountingAllocator<Pair<const uint64_t, uint64_t>>;
+
+            auto keys = random_keys(2 * size, 26);
+            std::vector<uint64_t> probes(keys.begin(), keys.end());
+            keys.resize(size);
+            std::shuffle(probes.begin(), probes.end(), std::mt19937_64(27));
+
+            std::printf("  uint64_t keys, size %zu\n", size);
+            report_hash_index<Map<uint64_t, uint64_t, Allocator>>("Map", keys, probes);
+            report_hash_index<IndexedMap<uint64_t, uint64_t, std::hash<uint64_t>, Allocator>>("IndexedMap", keys, probes);
+        }
+        {
+            using Allocator = CountingAllocator<Pair<const std::string, uint64_t>>;
+
+            auto keys = random_names(2 * size, 28);
+            std::vector<std::string> probes(keys.begin(), keys.end());
+            keys.resize(size);
+            std::shuffle(probes.begin(), probes.end(), std::mt19937_64(29));
+
+            std::printf("  std::string keys, size %zu (string bytes not counted)\n", size);
+            report_hash_index<Map<std::string, uint64_t, Allocator>>("Map", keys, probes);
+            report_hash_index<IndexedMap<std::string, uint64_t, std::hash<std::string>, Allocator>>("IndexedMap", keys, probes);
+        }
+    }
+}
+
+
+// Look a key up and insert it if it's missing, the value is only built then
+void benchmark_insert_position()
+{
+    using StringMap = Map<std::string, uint64_t, std::allocator<Pair<const std::string, uint64_t>>, PlainLayout, CountingLess>;
+
+    std::printf("insert position: Map<std::string, uint64_t>, every key is requested twice\n");
+    for (size_t size : {10000, 1000000}) {
+        auto keys = random_names(size, 30);
+
+        // The first request for a key misses and inserts, the second one hits
+        std::vector<std::string> requests(keys.begin(), keys.end());
+        requests.insert(requests.end(), keys.begin(), keys.end());
+        std::shuffle(requests.begin(), requests.end(), std::mt19937_64(31));
+
+        StringMap twice;
+        uint64_t built = 0;
+        comparisons = 0;
+        const double find_emplace = measure_ns(requests.size(), [&] {
+            for (const auto& key : requests) {
+                if (twice.find(key) == twice.end()) {
+                    twice.emplace(key, built++);
+                }
+            }
+        });
+        const double find_emplace_comparisons = static_cast<double>(comparisons) / requests.size();
+
+        StringMap once;
+        built = 0;
+        comparisons = 0;
+        const double position = measure_ns(requests.size(), [&] {
+            for (const auto& key : requests) {
+                auto result = once.find_or_position(key);
+                if (result.first == once.end()) {
+                    once.emplace_at(result.second, key, built++);
+                }
+            }
+        });
+        const double position_comparisons = static_cast<double>(comparisons) / requests.size();
+
+        std::printf(" size %zu\n", size);
+        std::printf("  find + emplace                 %6.1f ns  %5.1f comparisons per request\n", find_emplace, find_emplace_comparisons);
+        std::printf("  find_or_position + emplace_at  %6.1f ns  %5.1f comparisons per request  (%llu)\n",
+                    position, position_comparisons, static_cast<unsigned long long>(built));
+    }
+}
+
+// Counters updated in place: operator[] used to build and destroy a Value per call
+template <typename MapType, typename Add>
+void report_aggregation(const char* name, const std::vector<uint64_t>& updates, Add&& add)
+{
+    using Value = decltype(MapType::ValueType::second);
+
+    MapType emplaced;
+    const double emplace = measure_ns(updates.size(), [&] {
+        for (uint64_t key : updates) {
+            add(emplaced.emplace(key, Value()).first->second, key);
+        }
+    });
+
+    MapType indexed;
+    const double subscript = measure_ns(updates.size(), [&] {
+        for (uint64_t key : updates) {
+            add(indexed[key], key);
+        }
+    });
+
+    std::printf("  %-28s emplace(key, Value()) %6.1f ns  operator[] %6.1f ns\n", name, emplace, subscript);
+}
+
+void benchmark_aggregation()
+{
+    using Histogram = std::array<uint64_t, 32>;
+
+    for (size_t size : {1000, 100000}) {
+        std::printf("aggregation: 4M updates of %zu counters, m[key] += x\n", size);
+        auto keys = random_keys(size, 41);
+        std::vector<uint64_t> updates(4000000);
+        std::mt19937_64 random(43);
+        for (uint64_t& update : updates) {
+            update = keys[random() % keys.size()];
+        }
+
+        report_aggregation<Map<uint64_t, uint64_t>>("uint64_t", updates,
+            [](uint64_t& count, uint64_t) { ++count; });
+        report_aggregation<Map<uint64_t, Histogram>>("std::array<uint64_t, 32>", updates,
+            [](Histogram& histogram, uint64_t key) { ++histogram[key % histogram.size()]; });
+    }
+}
+
+// Time series: keys arrive in increasing order, now and then one arrives late
+template <typename MapType>
+double append_ns(const std::vector<uint64_t>& keys, bool hinted)
+{
+    MapType map;
+    return measure_ns(keys.size(), [&] {
+        for (uint64_t key : keys) {
+            if (hinted) {
+                map.emplace_hint(map.end(), key, key);
+            } else {
+                map.emplace(key, key);
+            }
+        }
+    });
+}
+
+void benchmark_sequential()
+{
+    std::printf("sequential: 1M inserts of increasing keys\n");
+    for (double late : {0.0, 0.01}) {
+        std::vector<uint64_t> keys(1000000);
+        std::mt19937_64 random(47);
+        uint64_t time = 1000000000;
+        for (uint64_t& key : keys) {
+            time += 1 + random() % 1000;
+            key = time;
+            if (random() % 10000 < late * 10000) {
+                key -= 1 + random() % 500000;
+            }
+        }
+
+        std::printf(" %.0f%% late keys\n", late * 100);
+        std::printf("  Map emplace                    %6.1f ns\n", append_ns<Map<uint64_t, uint64_t>>(keys, false));
+        std::printf("  Map emplace_hint(end())        %6.1f ns\n", append_ns<Map<uint64_t, uint64_t>>(keys, true));
+        std::printf("  std::map emplace_hint(end())   %6.1f ns\n", append_ns<std::map<uint64_t, uint64_t>>(keys, true));
+    }
+}
+
+// Loading a snapshot that is sorted already
+template <typename MapType>
+void report_bulk_load(const char* name, const std::vector<Pair<uint64_t, uint64_t>>& snapshot)
+{
+    size_t sink = 0;
+    const double inserts = measure_ns(snapshot.size(), [&] {
+        MapType map;
+        for (const auto& element : snapshot) {
+            map.insert(element);
+        }
+        sink += map.size();
+    });
+
+    const double range = measure_ns(snapshot.size(), [&] {
+        MapType map(snapshot.begin(), snapshot.end());
+        sink += map.size();
+    });
+
+    const double sorted = measure_ns(snapshot.size(), [&] {
+        auto map = MapType::from_sorted(snapshot.begin(), snapshot.end());
+        sink += map.size();
+    });
+
+    std::printf("  %-18s insert %6.1f ns  range constructor %6.1f ns  from_sorted %6.1f ns  (%zu)\n",
+                name, inserts, range, sorted, sink / 3);
+}
+
+void benchmark_bulk_load()
+{
+    const size_t size = 5000000;
+    std::printf("bulk load: %zu sorted elements, per element, including destruction\n", size);
+
+    std::vector<Pair<uint64_t, uint64_t>> snapshot;
+    snapshot.reserve(size);
+    for (uint64_t key : random_keys(size, 53)) {
+        snapshot.emplace_back(key, key);
+    }
+    std::sort(snapshot.begin(), snapshot.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    snapshot.erase(std::unique(snapshot.begin(), snapshot.end(), [](const auto& lhs, const auto& rhs) { return lhs.first == rhs.first; }),
+                   snapshot.end());
+
+    using A = std::allocator<Pair<const uint64_t, uint64_t>>;
+    report_bulk_load<Map<uint64_t, uint64_t>>("PlainLayout", snapshot);
+    report_bulk_load<Map<uint64_t, uint64_t, A, IndexLayout>>("IndexLayout", snapshot);
+
+    size_t sink = 0;
+    const double std_range = measure_ns(snapshot.size(), [&] {
+        std::map<uint64_t, uint64_t> map;
+        for (const auto& element : snapshot) {
+            map.emplace_hint(map.end(), element.first, element.second);
+        }
+        sink += map.size();
+    });
+    std::printf("  %-18s emplace_hint(end()) %6.1f ns  (%zu)\n", "std::map", std_range, sink);
+}
+
+// Rebuilding from a dump in no particular order, with some keys repeated
+void benchmark_parallel_load()
+{
+    const size_t size = 4000000;
+    std::printf("parallel load: %zu unsorted elements, per element, including destruction (%u cores)\n",
+                size, std::thread::hardware_concurrency());
+
+    std::vector<Pair<uint64_t, uint64_t>> dump;
+    dump.reserve(size);
+    std::mt19937_64 random(59);
+    for (size_t i = 0; i < size; ++i) {
+        dump.emplace_back(random() % (size * 4), i);
+    }
+
+    size_t sink = 0;
+    const double inserts = measure_ns(dump.size(), [&] {
+        Map<uint64_t, uint64_t> map;
+        for (const auto& element : dump) {
+            map.insert(element);
+        }
+        sink += map.size();
+    });
+    std::printf("  Map insert                 %6.1f ns\n", inserts);
+
+    const double std_inserts = measure_ns(dump.size(), [&] {
+        std::map<uint64_t, uint64_t> map;
+        for (const auto& element : dump) {
+            map.emplace(element.first, element.second);
+        }
+        sink += map.size();
+    });
+    std::printf("  std::map emplace           %6.1f ns\n", std_inserts);
+
+    for (unsigned threads : {1, 2, 4, 8, 16}) {
+        const double bulk = measure_ns(dump.size(), [&] {
+            Map<uint64_t, uint64_t> map;
+            map.bulk_load(dump.begin(), dump.end(), threads);
+            sink += map.size();
+        });
+        std::printf("  Map bulk_load, %2u threads  %6.1f ns\n", threads, bulk);
+    }
+    std::printf("  (%zu)\n", sink / 7);
+}
+
+// Retention: a map keyed by time drops everything older than a cutoff, then takes in as many new
+// elements. Only the drops are timed; `drop` erases the keys below the cutoff and returns the
+// time the freeing, if left for later, takes on top.
+template <typename MapType, typename Drop>
+void report_retention(const char* name, size_t size, double fraction, Drop&& drop)
+{
+    const size_t rounds = 8;
+    const size_t dropped = static_cast<size_t>(size * fraction);
+    MapType map;
+    uint64_t time = 0;
+    for (; time < size; ++time) {
+        map.emplace_hint(map.end(), time * 10, time);
+    }
+
+    double drops = 0;
+    double deferred = 0;
+    for (size_t round = 0; round < rounds; ++round) {
+        const uint64_t cutoff = (time - size + dropped) * 10;
+        drops += measure_ns(1, [&] { deferred += drop(map, cutoff); });
+        for (size_t i = 0; i < dropped; ++i, ++time) {
+            map.emplace_hint(map.end(), time * 10, time);
+        }
+    }
+
+    std::printf("  %-28s %8.2f ms per drop  %6.1f ns per element", name, drops / rounds / 1e6, drops / rounds / dropped);
+    if (deferred > 0) {
+        std::printf("  (+%.1f ns freeing later)", deferred / rounds / dropped);
+    }
+    std::printf("\n");
+}
+
+void benchmark_retention()
+{
+    const size_t size = 2000000;
+    std::printf("retention: %zu elements keyed by time, dropping the oldest\n", size);
+    using TimeMap = Map<uint64_t, uint64_t>;
+    for (double fraction : {0.01, 0.1, 0.5}) {
+        std::printf(" %.0f%% dropped per round\n", fraction * 100);
+        report_retention<TimeMap>("Map erase, one at a time", size, fraction, [](TimeMap& map, uint64_t cutoff) {
+            for (auto it = map.begin(), last = map.lower_bound(cutoff); it != last; ) {
+                it = map.erase(it);
+            }
+            return 0.0;
+        });
+        report_retention<TimeMap>("Map erase(lower, upper)", size, fraction, [](TimeMap& map, uint64_t cutoff) {
+            map.erase(0, cutoff);
+            return 0.0;
+        });
+        report_retention<TimeMap>("Map cut, freed later", size, fraction, [](TimeMap& map, uint64_t cutoff) {
+            TimeMap old = map.cut(0, cutoff);
+            return measure_ns(1, [&] { old.clear(); });
+        });
+        report_retention<std::map<uint64_t, uint64_t>>("std::map erase(first, last)", size, fraction, [](auto& map, uint64_t cutoff) {
+            map.erase(map.begin(), map.lower_bound(cutoff));
+            return 0.0;
+        });
+    }
+}
+
+// Set operations of a map with a smaller one, on copies made before the clock starts. The best
+// of three runs, as the state of the heap the copies leave behind varies
+template <typename Operation>
+double set_operation_ms(const Map<uint64_t, uint64_t>& large, const Map<uint64_t, uint64_t>& small, Operation&& operation)
+{
+    double best = 0;
+    for (int run = 0; run < 3; ++run) {
+        Map<uint64_t, uint64_t> lhs(large);
+        Map<uint64_t, uint64_t> rhs(small);
+        const double ms = measure_ns(1, [&] { operation(lhs, rhs); }) / 1e6;
+        best = (run == 0) ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+void benchmark_set_operations()
+{
+    const size_t size = 2000000;
+    std::printf("set operations: %zu random keys with a map of size / ratio, ms (%u cores)\n", size, std::thread::hardware_concurrency());
+
+    using TimeMap = Map<uint64_t, uint64_t>;
+    auto add = [](uint64_t& value, uint64_t&& other) { value += other; };
+    TimeMap large;
+    for (uint64_t key : random_keys(size, 61)) {
+        large.emplace(key % (size * 4), key);
+    }
+
+    for (size_t ratio : {1, 10, 1000}) {
+        TimeMap small;
+        for (uint64_t key : random_keys(size / ratio, 67)) {
+            small.emplace(key % (size * 4), key);
+        }
+
+        std::printf(" ratio %zu\n", ratio);
+        std::printf("  %-12s %10s", "", "per key");
+        for (unsigned threads : {1, 2, 4, 8}) {
+            std::printf("  %2u threads", threads);
+        }
+        std::printf("\n");
+
+        std::printf("  %-12s %10.1f", "union", set_operation_ms(large, small, [&](TimeMap& lhs, TimeMap& rhs) {
+            for (auto it = rhs.begin(); it != rhs.end(); ++it) {
+                lhs.upsert((*it).first, std::move((*it).second), add);
+            }
+            rhs.clear();
+        }));
+        for (unsigned threads : {1, 2, 4, 8}) {
+            std::printf("  %10.1f", set_operation_ms(large, small, [&](TimeMap& lhs, TimeMap& rhs) { lhs.unite(rhs, add, threads); }));
+        }
+
+        std::printf("\n  %-12s %10.1f", "intersection", set_operation_ms(large, small, [&](TimeMap& lhs, TimeMap& rhs) {
+            for (auto it = lhs.begin(); it != lhs.end(); ) {
+                if (rhs.count((*it).first) == 0) {
+                    it = lhs.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            rhs.clear();
+        }));
+        for (unsigned threads : {1, 2, 4, 8}) {
+            std::printf("  %10.1f", set_operation_ms(large, small, [&](TimeMap& lhs, TimeMap& rhs) { lhs.intersect(rhs, threads); }));
+        }
+
+        std::printf("\n  %-12s %10.1f", "difference", set_operation_ms(large, small, [&](TimeMap& lhs, TimeMap& rhs) {
+            for (auto it = rhs.begin(); it != rhs.end(); ++it) {
+                lhs.erase((*it).first);
+            }
+            rhs.clear();
+        }));
+        for (unsigned threads : {1, 2, 4, 8}) {
+            std::printf("  %10.1f", set_operation_ms(large, small, [&](TimeMap& lhs, TimeMap& rhs) { lhs.subtract(rhs, threads); }));
+        }
+        std::printf("\n");
+    }
+}
+
+// Sorted batches of half upserts and half erasures, with keys spread over the whole key space or
+// packed into a window a few times as wide as the batch
+std::vector<std::vector<BatchOp<uint64_t, uint64_t>>> make_batches(size_t batch, size_t rounds, uint64_t key_space, bool clustered)
+{
+    std::mt19937_64 rng(batch + clustered);
+    std::vector<std::vector<BatchOp<uint64_t, uint64_t>>> batches(rounds);
+    for (auto& ops : batches) {
+        const uint64_t width = clustered ? std::min<uint64_t>(key_space, 4 * batch) : key_space;
+        const uint64_t start = rng() % (key_space - width + 1);
+        for (size_t index = 0; index < batch; ++index) {
+            const BatchAction action = (rng() % 2 == 0) ? BatchAction::Upsert : BatchAction::Erase;
+            ops.push_back({action, start + rng() % width, rng()});
+        }
+        std::stable_sort(ops.begin(), ops.end(), [](const auto& lhs, const auto& rhs) { return lhs.key < rhs.key; });
+    }
+    return batches;
+}
+
+// Best of three runs of each, on fresh copies of the map
+void benchmark_batch()
+{
+    const size_t size = 1000000;
+    const uint64_t key_space = 2 * size;
+    std::printf("batch apply: %zu elements, sorted batches of upserts and erasures, ns per op\n", size);
+
+    using BatchMap = Map<uint64_t, uint64_t>;
+    BatchMap initial;
+    for (uint64_t key : random_keys(size, 71)) {
+        initial.emplace(key % key_space, key);
+    }
+
+    std::printf("  %-8s %-10s %10s %12s\n", "batch", "keys", "per op", "apply_batch");
+    for (size_t batch : {10, 100, 1000, 10000, 100000}) {
+        const size_t rounds = std::max<size_t>(1, 500000 / batch);
+        for (bool clustered : {false, true}) {
+            const auto batches = make_batches(batch, rounds, key_space, clustered);
+            double per_op_ns = 0;
+            double batched_ns = 0;
+            for (int run = 0; run < 3; ++run) {
+                BatchMap per_op(initial);
+                const double run_per_op_ns = measure_ns(rounds * batch, [&] {
+                    for (const auto& ops : batches) {
+                        for (const auto& op : ops) {
+                            if (op.action == BatchAction::Upsert) {
+                                per_op.insert_or_assign(op.key, op.value);
+                            } else {
+                                per_op.erase(op.key);
+                            }
+                        }
+                    }
+                });
+
+                BatchMap batched(initial);
+                const double run_batched_ns = measure_ns(rounds * batch, [&] {
+                    for (const auto& ops : batches) {
+                        batched.apply_batch(ops);
+                    }
+                });
+                per_op_ns = (run == 0) ? run_per_op_ns : std::min(per_op_ns, run_per_op_ns);
+                batched_ns = (run == 0) ? run_batched_ns : std::min(batched_ns, run_batched_ns);
+            }
+            std::printf("  %-8zu %-10s %10.1f %12.1f\n", batch, clustered ? "clustered" : "spread", per_op_ns, batched_ns);
+        }
+    }
+}
+
+// A map of random keys inserted in random order, so that its nodes lie scattered in memory as in
+// a long-lived map, rather than in key order as in a copy
+template <typename MapType>
+MapType random_map(size_t size)
+{
+    MapType map;
+    for (uint64_t key : random_keys(size, 73)) {
+        map.emplace(key, key);
+    }
+    return map;
+}
+
+// glibc sets small freed blocks aside and merges them on a later large allocation or free, which
+// may come inside whatever is timed next. Each timed erasure pays for its own instead.
+void settle_heap()
+{
+    std::vector<char> block(1 << 23);
+    volatile char* data = block.data();
+    data[0] = 1;
+}
+
+void benchmark_erase_if()
+{
+    const size_t size = 1000000;
+    std::printf("erase_if: %zu random keys, best of two, ns per element\n", size);
+
+    using EraseMap = Map<uint64_t, uint64_t>;
+    using StdMap = std::map<uint64_t, uint64_t>;
+    std::printf("  %-9s %10s %10s %14s\n", "erased", "loop", "erase_if", "std::map loop");
+    for (unsigned percent : {1, 5, 10, 15, 25, 50, 90}) {
+        auto doomed = [percent](const auto& element) { return (element.second >> 8) % 100 < percent; };
+        std::array<double, 3> best = {};
+        for (int round = 0; round < 2; ++round) {
+            EraseMap loop_map = random_map<EraseMap>(size);
+            const double loop_ns = measure_ns(size, [&] {
+                for (auto it = loop_map.begin(); it != loop_map.end(); ) {
+                    it = doomed(*it) ? loop_map.erase(it) : ++it;
+                }
+                settle_heap();
+            });
+
+            EraseMap erase_if_map = random_map<EraseMap>(size);
+            const double erase_if_ns = measure_ns(size, [&] {
+                erase_if(erase_if_map, doomed);
+                settle_heap();
+            });
+
+            StdMap std_map = random_map<StdMap>(size);
+            const double std_ns = measure_ns(size, [&] {
+                for (auto it = std_map.begin(); it != std_map.end(); ) {
+                    it = doomed(*it) ? std_map.erase(it) : std::next(it);
+                }
+                settle_heap();
+            });
+
+            const std::array<double, 3> ns = {loop_ns, erase_if_ns, std_ns};
+            for (size_t column = 0; column < ns.size(); ++column) {
+                best[column] = (round == 0) ? ns[column] : std::min(best[column], ns[column]);
+            }
+        }
+        std::printf("  %7u%% %10.1f %10.1f %14.1f\n", percent, best[0], best[1], best[2]);
+    }
+}
+
+} /*namespace*/
+
+int main(int argc, char** argv)
+{
+    const char* only = (argc > 1) ? argv[1] : nullptr;
+
+    if (only == nullptr || std::strcmp(only, "allocator") == 0) {
+        benchmark_allocator();
+    }
+
+    if (only == nullptr || std::strcmp(only, "layout") == 0) {
+        benchmark_layout();
+    }
+
+    if (only == nullptr || std::strcmp(only, "cold") == 0) {
+        benchmark_cold_values();
+    }
+
+    if (only == nullptr || std::strcmp(only, "compact") == 0) {
+        benchmark_compact();
+    }
+
+    if (only == nullptr || std::strcmp(only, "intrusive") == 0) {
+        benchmark_intrusive();
+    }
+
+    if (only == nullptr || std::strcmp(only, "set") == 0) {
+        benchmark_set();
+    }
+
+    if (only == nullptr || std::strcmp(only, "strings") == 0) {
+        benchmark_string_keys();
+    }
+
+    if (only == nullptr || std::strcmp(only, "prefix") == 0) {
+        benchmark_key_prefix();
+    }
+
+    if (only == nullptr || std::strcmp(only, "transparent") == 0) {
+        benchmark_transparent();
+    }
+
+    if (only == nullptr || std::strcmp(only, "comparisons") == 0) {
+        benchmark_comparisons();
+    }
+
+    if (only == nullptr || std::strcmp(only, "batch") == 0) {
+        benchmark_batch_lookup();
+    }
+
+    if (only == nullptr || std::strcmp(only, "locality") == 0) {
+        benchmark_locality();
+    }
+
+    if (only == nullptr || std::strcmp(only, "filter") == 0) {
+        benchmark_filter();
+    }
+
+    if (only == nullptr || std::strcmp(only, "hash") == 0) {
+        benchmark_hash_index();
+    }
+
+    if (only == nullptr || std::strcmp(only, "position") == 0) {
+        benchmark_insert_position();
+    }
+
+    if (only == nullptr || std::strcmp(only, "aggregation") == 0) {
+        benchmark_aggregation();
+    }
+
+    if (only == nullptr || std::strcmp(only, "sequential") == 0) {
+        benchmark_sequential();
+    }
+
+    if (only == nullptr || std::strcmp(only, "bulk") == 0) {
+        benchmark_bulk_load();
+    }
+
+    if (only == nullptr || std::strcmp(only, "parallel") == 0) {
+        benchmark_parallel_load();
+    }
+
+    if (only == nullptr || std::strcmp(only, "retention") == 0) {
+        benchmark_retention();
+    }
+
+    if (only == nullptr || std::strcmp(only, "setops") == 0) {
+        benchmark_set_operations();
+    }
+    if (only == nullptr || std::strcmp(only, "apply") == 0) {
+        benchmark_batch();
+    }
+    if (only == nullptr || std::strcmp(only, "erase_if") == 0) {
+        benchmark_erase_if();
+    }
+
+    return 0;
+}
@@ -1,156 +1,1333 @@
-/*#include "Map.h"
-#include <iostream>
+#include "IntrusiveMap.h"
+#include "Map.h"
+#include "NodePool.h"
+#include "Set.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <new>
+#include <random>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <tuple>
-#include <map>
-#include <utility>
-
-#include "Utility.h"
+#include <type_traits>
+#include <vector>
 
 using namespace naive;
 
-class A
+namespace {
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+void check(bool ok, const char* condition, const char* file, int line)
 {
-public:
-    int& x;
-    A() = default;
-    A(const A&) = default;
-    A(int f) : x(f)
-    {}
+    if (!ok) {
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+        std::exit(1);
+    }
+}
 
-    void operator=(const A& other)
+// A copy finds its first and last elements among its own nodes, also once the source is gone
+void test_copy_bounds()
+{
+    Map<int, int> assigned;
+    assigned.insert(MakePair(100, 100));
     {
-        x = other.x;
+        Map<int, int> source;
+        for (int i = 0; i < 10; ++i) {
+            source.insert(MakePair(i, i));
+        }
+        Map<int, int> copy(source);
+        source.clear();
+        CHECK(copy.begin()->first == 0);
+        CHECK((--copy.end())->first == 9);
+
+        assigned = copy;
+        copy.clear();
+    }
+    CHECK(assigned.size() == 10);
+    CHECK(assigned.begin()->first == 0);
+    CHECK((--assigned.end())->first == 9);
+}
+
+// Stepping back from end() reaches the last element, and from there the others in turn
+void test_decrement_end()
+{
+    Map<int, int> map;
+    for (int i = 0; i < 5; ++i) {
+        map.insert(MakePair(i, i));
+    }
+
+    auto it = map.end();
+    for (int i = 4; i >= 0; --i) {
+        --it;
+        CHECK(it->first == i);
+    }
+    CHECK(it == map.begin());
+}
+
+// Erasing the black leaf 5 leaves its place doubly black, with the black sibling 20 whose near
+// child 15 is red: case 3.4, rotating around the sibling and picking it up again from the parent
+void test_erase_near_red_nephew()
+{
+    Map<int, int> map;
+    for (int i : {10, 5, 20, 15}) {
+        map.insert(MakePair(i, i));
+    }
+    CHECK(map.erase(5) == 1);
+
+    auto it = map.begin();
+    for (int i : {10, 15, 20}) {
+        CHECK(it != map.end() && it->first == i);
+        ++it;
+    }
+    CHECK(it == map.end());
+
+    Map<int, int> mirrored;
+    for (int i : {10, 5, 20, 7}) {
+        mirrored.insert(MakePair(i, i));
+    }
+    CHECK(mirrored.erase(20) == 1);
+    CHECK(mirrored.size() == 3);
+    CHECK(mirrored.begin()->first == 5);
+    CHECK((--mirrored.end())->first == 10);
+}
+
+// Keys are made from integers and keep their order. Strings share a prefix longer than the
+// cached key prefixes, so that those tie and the full comparison decides. String views point into
+// a table that lives as long as the program.
+const std::string& key_text(int i)
+{
+    static std::deque<std::string> texts;
+    while (texts.size() <= static_cast<size_t>(i)) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "shared-prefix-%07zu", texts.size());
+        texts.emplace_back(text);
+    }
+    return texts[i];
+}
+
+template <typename Key>
+Key make_key(int i)
+{
+    if constexpr (std::is_integral_v<Key>) {
+        return static_cast<Key>(i);
+    } else {
+        return Key(key_text(i));
+    }
+}
+
+template <typename Reference>
+struct IsMapReference :
+    std::false_type
+{ };
+
+template <typename Key, typename Value>
+struct IsMapReference<std::map<Key, Value>> :
+    std::true_type
+{ };
+
+template <typename K, typename V, typename RK, typename RV>
+bool same_element(const Pair<K, V>& element, const std::pair<RK, RV>& expected)
+{ return element.first == expected.first && element.second == expected.second; }
+
+template <typename K>
+bool same_element(const K& element, const K& expected)
+{ return element == expected; }
+
+template <typename K, typename V>
+const K& element_key(const std::pair<const K, V>& element)
+{ return element.first; }
+
+template <typename K>
+const K& element_key(const K& element)
+{ return element; }
+
+// The container holds together and has the reference's elements, in its order both ways
+template <typename Container, typename Reference>
+void expect_same(const Container& container, const Reference& reference)
+{
+    CHECK(container.verify());
+    CHECK(container.size() == reference.size());
+    CHECK(container.empty() == reference.empty());
+
+    auto it = container.cbegin();
+    for (const auto& expected : reference) {
+        CHECK(it != container.cend());
+        CHECK(same_element(*it, expected));
+        ++it;
+    }
+    CHECK(it == container.cend());
+
+    for (auto expected = reference.rbegin(); expected != reference.rend(); ++expected) {
+        --it;
+        CHECK(same_element(*it, *expected));
+    }
+    CHECK(it == container.cbegin() || reference.empty());
+}
+
+template <typename Container, typename Reference>
+void insert_both(Container& container, Reference& reference, int i, int value)
+{
+    using Key = typename Reference::key_type;
+    if constexpr (IsMapReference<Reference>::value) {
+        container.emplace(make_key<Key>(i), value);
+        reference.emplace(make_key<Key>(i), value);
+    } else {
+        container.insert(make_key<Key>(i));
+        reference.insert(make_key<Key>(i));
+    }
+}
+
+template <typename Container, typename Reference>
+void fill_both(Container& container, Reference& reference, std::mt19937& rng, int count, int range)
+{
+    for (int i = 0; i < count; ++i) {
+        insert_both(container, reference, static_cast<int>(rng() % range), static_cast<int>(rng() % 1000));
+    }
+}
+
+// Single insertions and erasures, with and without hints
+template <typename Container, typename Reference>
+void test_insert_erase(unsigned seed)
+{
+    using Key = typename Reference::key_type;
+    std::mt19937 rng(seed);
+    const int range = 2000;
+    Container container;
+    Reference reference;
+    for (int step = 0; step < 4000; ++step) {
+        const int i = static_cast<int>(rng() % range);
+        switch (rng() % 4) {
+        case 0:
+            insert_both(container, reference, i, step);
+            break;
+        case 1:
+            if constexpr (IsMapReference<Reference>::value) {
+                container.emplace_hint(container.lower_bound(make_key<Key>(i)), make_key<Key>(i), step);
+                reference.emplace_hint(reference.lower_bound(make_key<Key>(i)), make_key<Key>(i), step);
+            } else {
+                container.insert(container.lower_bound(make_key<Key>(i)), make_key<Key>(i));
+                reference.insert(reference.lower_bound(make_key<Key>(i)), make_key<Key>(i));
+            }
+            break;
+        case 2:
+            CHECK(container.erase(make_key<Key>(i)) == reference.erase(make_key<Key>(i)));
+            break;
+        default: {
+            auto it = container.lower_bound(make_key<Key>(i));
+            auto expected = reference.lower_bound(make_key<Key>(i));
+            if (expected != reference.end()) {
+                it = container.erase(it);
+                expected = reference.erase(expected);
+                CHECK((it == container.end()) == (expected == reference.end()));
+            }
+        }
+        }
+
+        if (step % 500 == 0) {
+            expect_same(container, reference);
+        }
+    }
+
+    expect_same(container, reference);
+    container.clear();
+    reference.clear();
+    expect_same(container, reference);
+}
+
+// Reserved nodes are taken before the pool grows, and shrinking gives back only blocks nobody uses
+template <typename Container, typename Reference>
+void test_reserve_shrink(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    Container container;
+    Reference reference;
+    container.reserve(3000);
+    const size_t reserved = container.get_allocator().pool().allocated_bytes();
+    CHECK(reserved != 0);
+    for (int i = 0; i < 3000; ++i) {
+        insert_both(container, reference, i, static_cast<int>(rng() % 1000));
     }
+    CHECK(container.get_allocator().pool().allocated_bytes() == reserved);
+    expect_same(container, reference);
 
-    void operator=(A && other) noexcept
+    // Erasing most elements leaves every block in use
+    for (int i = 0; i < 3000; ++i) {
+        if (i % 100 != 0) {
+            CHECK(container.erase(i) == 1);
+            reference.erase(i);
+        }
+    }
+    container.shrink_to_fit();
+    CHECK(container.get_allocator().pool().allocated_bytes() == reserved);
+    expect_same(container, reference);
+
+    container.clear();
+    reference.clear();
+    container.shrink_to_fit();
+    CHECK(container.get_allocator().pool().allocated_bytes() == 0);
+    expect_same(container, reference);
+
+    fill_both(container, reference, rng, 500, 1000);
+    container.reserve(100);
+    container.shrink_to_fit();
+    expect_same(container, reference);
+}
+
+// Bytes the CountingAllocators hold
+size_t g_allocated_bytes = 0;
+
+template <typename T>
+struct CountingAllocator
+{
+    using value_type = T;
+
+    CountingAllocator() = default;
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&)
+    { }
+
+    T* allocate(size_t n)
     {
-        x = std::move(other.x);
+        g_allocated_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
     }
 
-    bool operator==(const A& other) const
+    void deallocate(T* p, size_t n)
     {
-        return x == other.x;
+        g_allocated_bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
     }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>&) const
+    { return true; }
+
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>&) const
+    { return false; }
 };
 
-int main()
+// A reserved slab takes the elements without moving them, and shrinking returns its unused tail
+template <typename Layout>
+void test_slab_reserve_shrink(unsigned seed)
+{
+    using Node = TreeNode<int, int, Layout>;
+    std::mt19937 rng(seed);
+    {
+        Map<int, int, CountingAllocator<Pair<const int, int>>, Layout> container;
+        std::map<int, int> reference;
+        container.reserve(3000);
+        CHECK(g_allocated_bytes == 3000 * sizeof(Node));
+
+        insert_both(container, reference, 0, 0);
+        const auto* first = &*container.begin();
+        for (int i = 1; i < 1000; ++i) {
+            insert_both(container, reference, i, static_cast<int>(rng() % 1000));
+        }
+        CHECK(&*container.begin() == first);
+        CHECK(g_allocated_bytes == 3000 * sizeof(Node));
+
+        container.reserve(100);
+        CHECK(g_allocated_bytes == 3000 * sizeof(Node));
+        container.shrink_to_fit();
+        CHECK(g_allocated_bytes == 1000 * sizeof(Node));
+        expect_same(container, reference);
+
+        // Erased slots in the middle are kept and taken again
+        for (int i = 0; i < 1000; i += 2) {
+            CHECK(container.erase(i) == 1);
+            reference.erase(i);
+        }
+        container.shrink_to_fit();
+        CHECK(g_allocated_bytes == 1000 * sizeof(Node));
+        for (int i = 0; i < 1000; i += 2) {
+            insert_both(container, reference, i, i);
+        }
+        CHECK(g_allocated_bytes == 1000 * sizeof(Node));
+        expect_same(container, reference);
+
+        container.clear();
+        reference.clear();
+        container.shrink_to_fit();
+        CHECK(g_allocated_bytes == 0);
+        expect_same(container, reference);
+
+        fill_both(container, reference, rng, 500, 1000);
+        expect_same(container, reference);
+    }
+    CHECK(g_allocated_bytes == 0);
+}
+
+// Cold elements stay where they are while the slab of hot nodes grows, and copies get their own
+template <typename Layout>
+void test_cold_values(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    Map<int, int, std::allocator<Pair<const int, int>>, Layout> container;
+    std::map<int, int> reference;
+    insert_both(container, reference, 0, 0);
+    const auto* first = &*container.begin();
+    fill_both(container, reference, rng, 3000, 2000);
+    CHECK(&*container.find(0) == first);
+    expect_same(container, reference);
+
+    auto copy = container;
+    CHECK(&*copy.find(0) != first);
+    copy.find(0)->second = 1;
+    CHECK(container.find(0)->second == 0);
+    expect_same(container, reference);
+
+    container.compact();
+    CHECK(&*container.find(0) == first);
+    expect_same(container, reference);
+}
+
+// Every node order keeps the elements and a tree that can be modified further
+template <typename Container, typename Reference>
+void test_compact(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    Container container;
+    Reference reference;
+    container.compact();
+    expect_same(container, reference);
+
+    fill_both(container, reference, rng, 2000, 3000);
+    for (CompactOrder order : {CompactOrder::BreadthFirst, CompactOrder::DepthFirst, CompactOrder::VanEmdeBoas}) {
+        container.compact(order);
+        expect_same(container, reference);
+
+        fill_both(container, reference, rng, 200, 3000);
+        for (int i = 0; i < 200; ++i) {
+            const auto key = make_key<typename Reference::key_type>(static_cast<int>(rng() % 3000));
+            CHECK(container.erase(key) == reference.erase(key));
+        }
+        expect_same(container, reference);
+    }
+}
+
+// Allocations FailingAllocators still make before they throw
+size_t g_allocations_left = SIZE_MAX;
+
+template <typename T>
+struct FailingAllocator
 {
-    std::map<int, int> pp;
-    pp.emplace(std::piecewise_construct, std::make_tuple(1), std::make_tuple(3));
-    pp.insert({ 2, 4 });
-    auto ppeit = pp.end();
-    pp.erase(2);
-    --ppeit;
-    //a.emplace(3, 3);
+    using value_type = T;
 
-    Map<int, std::string> map;
+    FailingAllocator() = default;
 
-    Pair<const int, std::string> tmp(10, "b");
+    template <typename U>
+    FailingAllocator(const FailingAllocator<U>&)
+    { }
 
-    map.insert(tmp);
-    map.insert(MakePair(5, "a"));
-    Pair<const short, std::string> tt = MakePair(3, "a");
-    map.insert(std::move(tt));
-    auto hint = map.insert(MakePair(20, "c")).first;
+    T* allocate(size_t n)
+    {
+        if (g_allocations_left == 0) {
+            throw std::bad_alloc();
+        }
+        --g_allocations_left;
+        return std::allocator<T>().allocate(n);
+    }
 
-    const auto& v = *hint;
-    map.insert(v);
-    auto it = map.insert(hint, MakePair(30, "e")).first;
-    hint == map.end();
-    ++hint;
-    hint++;
-    map.insert(std::move(*it));
+    void deallocate(T* p, size_t n)
+    { std::allocator<T>().deallocate(p, n); }
 
-    Map<int, std::string>::ConstIterator chint = hint;
+    template <typename U>
+    bool operator==(const FailingAllocator<U>&) const
+    { return true; }
 
-    map[40] = "f";
+    template <typename U>
+    bool operator!=(const FailingAllocator<U>&) const
+    { return false; }
+};
+
+// compact() running out of memory part way leaves the elements as they were. The mapped values
+// are long strings, which moving would leave empty.
+template <typename Layout, typename Key>
+void test_compact_failure(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    Map<Key, std::string, FailingAllocator<Pair<const Key, std::string>>, Layout> container;
+    std::map<Key, std::string> reference;
+    for (int i = 0; i < 1000; ++i) {
+        const int k = static_cast<int>(rng() % 2000);
+        container.emplace(make_key<Key>(k), key_text(k));
+        reference.emplace(make_key<Key>(k), key_text(k));
+    }
+
+    for (size_t allowed : {size_t(0), size_t(1), reference.size() / 2, reference.size() - 1}) {
+        g_allocations_left = allowed;
+        bool failed = false;
+        try {
+            container.compact();
+        } catch (const std::bad_alloc&) {
+            failed = true;
+        }
+        g_allocations_left = SIZE_MAX;
+        CHECK(failed);
+        expect_same(container, reference);
+    }
 
-    map.emplace(1, "-");
-    map.emplace(MakePair(25, "d"));
+    container.compact();
+    expect_same(container, reference);
+}
 
-    hint = map.emplace(30, "x").first;
-    map.emplace_hint(hint, 19, "+");
+// Random bytes, including zeros and bytes above 0x7f, of up to max_length
+std::string random_text(std::mt19937& rng, size_t max_length)
+{
+    static const char alphabet[] = { '\0', '\x01', 'a', 'b', '\x7f', '\x80', '\xff' };
+    std::string text(rng() % (max_length + 1), '\0');
+    for (char& c : text) {
+        c = alphabet[rng() % sizeof(alphabet)];
+    }
+    return text;
+}
 
-    map.emplace(PiecewiseConstruct, std::make_tuple(45), std::make_tuple("g"));
+// Keys own their bytes: the views they are inserted from go away, lengths run from empty to many
+// node slots
+template <typename Layout>
+void test_inline_keys(unsigned seed)
+{
+    using Container = Map<std::string_view, int, std::allocator<Pair<const std::string_view, int>>, InlineKeyLayout<Layout>>;
 
-    Map<int, std::string>::Iterator beg = map.begin();
+    std::mt19937 rng(seed);
+    Container container;
+    std::map<std::string, int> reference;
+    for (int i = 0; i < 2000; ++i) {
+        std::string key = random_text(rng, (i % 10 == 0) ? 300 : 12);
+        if (rng() % 4 == 0) {
+            CHECK(container.erase(std::string_view(key)) == reference.erase(key));
+        } else {
+            CHECK(container.emplace(std::string_view(key), i).second == reference.emplace(key, i).second);
+        }
+        key.assign(key.size(), '#');
+    }
+    expect_same(container, reference);
 
-    auto cit = map.cbegin();
-    while (cit != map.cend()) {
-        std::cout << (*cit).second << std::endl;
-        ++cit;
+    for (int i = 0; i < 500; ++i) {
+        const std::string key = random_text(rng, 12);
+        auto it = container.find(key);
+        CHECK((it != container.end()) == (reference.count(key) != 0));
+        CHECK(it == container.end() || (it->first == key && it->first.data() != key.data()));
     }
 
-    map.erase(hint);
+    // A copy has its own key bytes
+    Container copy(container);
+    container.clear();
+    expect_same(copy, reference);
+    copy.compact();
+    expect_same(copy, reference);
+}
 
-    map.empty();
-    map.size();
+// Batches of present, absent and repeated keys, shorter than, as long as and longer than the 16
+// descents that run at once, find what find() finds one key at a time
+template <typename Container, typename Reference>
+void test_find_many(unsigned seed)
+{
+    using Key = typename Reference::key_type;
+    std::mt19937 rng(seed);
+    Container container;
+    Reference reference;
+    fill_both(container, reference, rng, 1000, 2000);
 
-    Map<int, std::string> map2(map.begin(), map.end());
-    Map<int, std::string> map3 = {tmp};
-    map3 = {tmp};
+    for (size_t size : {0, 1, 2, 15, 16, 17, 33, 1000}) {
+        std::vector<Key> keys;
+        for (size_t i = 0; i < size; ++i) {
+            if (i > 0 && rng() % 8 == 0) {
+                keys.push_back(keys[rng() % i]);
+            } else {
+                keys.push_back(make_key<Key>(static_cast<int>(rng() % 4000)));
+            }
+        }
 
-    map2.swap(map3);
+        std::vector<typename Container::Iterator> found(size);
+        container.find_many(keys.begin(), keys.end(), found.begin());
+        size_t count = 0;
+        for (size_t i = 0; i < size; ++i) {
+            CHECK(found[i] == container.find(keys[i]));
+            count += reference.count(keys[i]);
+        }
+        CHECK(container.count_many(keys.begin(), keys.end()) == count);
+    }
+}
 
-    auto fit = map.find(10);
+// The iterator and the reference's iterator point to equal elements or are both at the end
+template <typename Container, typename It, typename Reference, typename ReferenceIt>
+bool same_position(Container& container, It it, const Reference& reference, ReferenceIt expected)
+{
+    if (expected == reference.end()) {
+        return it == container.end();
+    }
+    return it != container.end() && same_element(*it, *expected);
+}
 
-    const auto map4 = map;
-    map4.find(0);
-    map4.count(30);
+// Lookups that start from a hint or hit the find cache, near the previous key as in a skewed local
+// workload, between insertions, erasures, compactions and swaps
+template <typename Container, typename Reference>
+void test_finger_search(unsigned seed)
+{
+    using Key = typename Reference::key_type;
+    std::mt19937 rng(seed);
+    const int range = 3000;
+    Container container;
+    Reference reference;
+    container.enable_find_cache();
+    fill_both(container, reference, rng, 1000, range);
 
-    auto r = map.equal_range(30);
-    map4.equal_range(30);
+    Container other;
+    Reference other_reference;
+    other.enable_find_cache();
+    fill_both(other, other_reference, rng, 100, range);
 
-    auto lb = map.lower_bound(10);
-    map4.lower_bound(10);
+    int previous = 0;
+    for (int step = 0; step < 4000; ++step) {
+        const int i = std::clamp(previous + static_cast<int>(rng() % 41) - 20, 0, range - 1);
+        const Key key = make_key<Key>(i);
+        const Key previous_key = make_key<Key>(previous);
+        previous = i;
 
-    auto ub = map.upper_bound(10);
-    map4.upper_bound(10);
+        switch (rng() % 8) {
+        case 0:
+            CHECK(same_position(container, container.find(container.lower_bound(previous_key), key), reference, reference.find(key)));
+            break;
+        case 1:
+            CHECK(same_position(container, container.lower_bound(container.lower_bound(previous_key), key), reference, reference.lower_bound(key)));
+            break;
+        case 2:
+            CHECK(same_position(container, container.find(container.begin(), key), reference, reference.find(key)));
+            CHECK(same_position(container, container.lower_bound(container.end(), key), reference, reference.lower_bound(key)));
+            break;
+        case 3:
+            CHECK(same_position(container, container.find(key), reference, reference.find(key)));
+            CHECK(container.count(key) == reference.count(key));
+            break;
+        case 4:
+            insert_both(container, reference, i, step);
+            break;
+        case 5: {
+            auto it = container.find(key);
+            if (it != container.end()) {
+                container.erase(it);
+            }
+            reference.erase(key);
+            break;
+        }
+        case 6:
+            CHECK(container.erase(key) == reference.erase(key));
+            break;
+        default:
+            if (step % 3 == 0) {
+                container.compact();
+            } else {
+                container.swap(other);
+                std::swap(reference, other_reference);
+            }
+        }
 
-    map == map4;
+        // The same key again is found in the cache
+        CHECK(same_position(container, container.find(key), reference, reference.find(key)));
+    }
 
-    swap(map, map3);
+    expect_same(container, reference);
+    expect_same(other, other_reference);
+    // Maps with a hash index look keys up there and never ask the cache
+    const FindCacheStats stats = container.find_cache_stats();
+    CHECK(stats.hits <= stats.lookups && (stats.hits > 0 || stats.lookups == 0));
+}
 
-    bool cmp = map < map3;
+// With the filter on, lookups find what std::map finds, and no erasure makes the filter reject a key
+// that is still there. The filter outgrows its capacity, is turned off and on again and moves along
+// with the elements.
+template <typename Container, typename Reference>
+void test_filter(unsigned seed)
+{
+    using Key = typename Reference::key_type;
+    std::mt19937 rng(seed);
+    const int range = 4000;
+    Container container;
+    Reference reference;
+    container.enable_filter(0.01);
+    CHECK(container.filter_enabled());
 
-    map3.erase(map3.begin());
-    bool cmp2 = map3 < map;
-    bool cmp3 = map < map3;
+    for (int step = 0; step < 6000; ++step) {
+        const int i = static_cast<int>(rng() % range);
+        const Key key = make_key<Key>(i);
+        switch (rng() % 4) {
+        case 0:
+        case 1:
+            insert_both(container, reference, i, step);
+            break;
+        case 2:
+            CHECK(container.erase(key) == reference.erase(key));
+            break;
+        default:
+            CHECK(container.count(key) == reference.count(key));
+            CHECK(same_position(container, container.find(key), reference, reference.find(key)));
+        }
 
-    auto eit = map.end();
-    --eit;
+        if (step % 1000 == 0) {
+            expect_same(container, reference);
+            for (const auto& element : reference) {
+                CHECK(container.count(element_key(element)) == 1);
+            }
+        }
 
-    Map<int, std::string> rmap;
-    rmap[10] = "a";
-    rmap[20] = "b";
-    rmap[30] = "c";
-    rmap[40] = "d";
-    rmap[50] = "e";
-    rmap[60] = "f";
-    rmap[70] = "g";
-    auto rit = rmap.rcbegin();
-    while (rit != rmap.rcend()) {
-        std::cout << (*rit).second << std::endl;
-        ++rit;
+        if (step == 3000) {
+            container.disable_filter();
+            CHECK(!container.filter_enabled());
+            expect_same(container, reference);
+            container.enable_filter(0.001);
+        }
     }
-    rmap.erase(10);
-    rmap.erase(70);
-    
-    int b = 0;
-    auto a = MakePair(b, b);
+    expect_same(container, reference);
 
-    int x = 5;
-    const double f = 2.0;
-    //Pair<int, double> p(x, 2.0);
-    Pair<A, double> p(x, f);
+    Container copy(container);
+    CHECK(copy.filter_enabled());
+    expect_same(copy, reference);
 
-    Pair<A, double> j(p);
+    Container other;
+    other.swap(copy);
+    CHECK(other.filter_enabled() && !copy.filter_enabled());
+    for (int i = 0; i < range; ++i) {
+        CHECK(other.count(make_key<Key>(i)) == reference.count(make_key<Key>(i)));
+    }
 
-    bool c = (p != j);
+    container.clear();
+    reference.clear();
+    CHECK(container.filter_enabled());
+    CHECK(container.count(make_key<Key>(0)) == 0);
+    fill_both(container, reference, rng, 500, range);
+    expect_same(container, reference);
+}
 
-    swap(p, j);
+// at(), find() and count() take the hash index, which follows the nodes when they move or change
+// hands
+template <typename Layout>
+void test_indexed_map(unsigned seed)
+{
+    using Container = IndexedMap<int, int, std::hash<int>, std::allocator<Pair<const int, int>>, Layout>;
+
+    std::mt19937 rng(seed);
+    Container container;
+    std::map<int, int> reference;
+    auto expect_lookups = [&](Container& indexed) {
+        expect_same(indexed, reference);
+        for (int i = 0; i < 3000; ++i) {
+            const auto expected = reference.find(i);
+            CHECK(indexed.count(i) == reference.count(i));
+            CHECK(same_position(indexed, indexed.find(i), reference, expected));
+            bool thrown = false;
+            try {
+                CHECK(indexed.at(i) == expected->second);
+            } catch (const std::out_of_range&) {
+                thrown = true;
+            }
+            CHECK(thrown == (expected == reference.end()));
+        }
+    };
+
+    fill_both(container, reference, rng, 2000, 3000);
+    expect_lookups(container);
+
+    container.compact();
+    expect_lookups(container);
+
+    Container copy(container);
+    Container moved(std::move(container));
+    expect_lookups(moved);
+    Container other;
+    other.swap(copy);
+    expect_lookups(other);
+
+    container = other;
+    expect_lookups(container);
+    container.clear();
+    reference.clear();
+    expect_lookups(container);
+}
+
+// Links the element for key i at the position, as insert_both() would
+template <typename Container, typename Reference, typename Position>
+bool emplace_both_at(Container& container, Reference& reference, Position position, int i, int value)
+{
+    using Key = typename Reference::key_type;
+    if constexpr (IsMapReference<Reference>::value) {
+        auto [it, inserted] = container.emplace_at(position, make_key<Key>(i), value);
+        const auto expected = reference.emplace(make_key<Key>(i), value);
+        CHECK(inserted == expected.second);
+        CHECK(same_element(*it, *expected.first));
+        return inserted;
+    } else {
+        auto [it, inserted] = container.emplace_at(position, make_key<Key>(i));
+        const auto expected = reference.insert(make_key<Key>(i));
+        CHECK(inserted == expected.second);
+        CHECK(same_element(*it, *expected.first));
+        return inserted;
+    }
+}
+
+// Positions used right away, and positions gone stale: the tree changed in between, the key got
+// inserted meanwhile, or the position is another container's
+template <typename Container, typename Reference>
+void test_insert_position(unsigned seed)
+{
+    using Key = typename Reference::key_type;
+    std::mt19937 rng(seed);
+    const int range = 3000;
+    Container container;
+    Reference reference;
+    Container other;
+    for (int step = 0; step < 3000; ++step) {
+        const int i = static_cast<int>(rng() % range);
+        const Key key = make_key<Key>(i);
+        auto [it, position] = container.find_or_position(key);
+        const auto expected = reference.find(key);
+        CHECK(same_position(container, it, reference, expected));
+        if (expected != reference.end()) {
+            continue;
+        }
+
+        switch (rng() % 5) {
+        case 0: {
+            // A neighbour goes in first, maybe right where the key would have been linked
+            const int neighbour = std::min(i + 1, range - 1);
+            insert_both(container, reference, neighbour, step);
+            break;
+        }
+        case 1:
+            insert_both(container, reference, i, step);
+            break;
+        case 2: {
+            // The element the key would have been linked to goes away
+            auto next = reference.upper_bound(key);
+            if (next != reference.end()) {
+                CHECK(container.erase(element_key(*next)) == 1);
+                reference.erase(next);
+            }
+            break;
+        }
+        case 3:
+            position = other.find_or_position(key).second;
+            break;
+        default:
+            break;
+        }
+
+        emplace_both_at(container, reference, position, i, step);
+        if (step % 300 == 0) {
+            expect_same(container, reference);
+        }
+    }
+    expect_same(container, reference);
+    expect_same(other, Reference());
+}
+
+// Long strings, which moving leaves empty
+template <typename Layout>
+using StringStringMap = Map<std::string, std::string, std::allocator<Pair<const std::string, std::string>>, Layout>;
+
+// try_emplace, insert_or_assign, upsert and operator[], with keys and values passed as copies and
+// moved. try_emplace and upsert leave moved arguments alone when the key is present.
+template <typename Layout>
+void test_key_value_inserts(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    StringStringMap<Layout> container;
+    std::map<std::string, std::string> reference;
+    auto append = [](std::string& mapped, const std::string& value) { mapped.append(value, 0, 2); };
+
+    for (int step = 0; step < 4000; ++step) {
+        const std::string& key = key_text(static_cast<int>(rng() % 1500));
+        const std::string& value = key_text(step);
+        std::string moved_key = key;
+        std::string moved_value = value;
+        const bool present = reference.count(key) != 0;
+
+        switch (rng() % 6) {
+        case 0: {
+            auto [it, inserted] = container.try_emplace(std::move(moved_key), std::move(moved_value));
+            reference.try_emplace(key, value);
+            CHECK(inserted == !present);
+            CHECK(it->first == key && it->second == reference[key]);
+            CHECK(!present || (moved_key == key && moved_value == value));
+            break;
+        }
+        case 1: {
+            auto [it, inserted] = container.try_emplace(key, 10, 'x');
+            reference.try_emplace(key, 10, 'x');
+            CHECK(inserted == !present);
+            CHECK(it->second == reference[key]);
+            break;
+        }
+        case 2: {
+            auto [it, inserted] = (step % 2 == 0) ? container.insert_or_assign(key, value)
+                                                  : container.insert_or_assign(std::move(moved_key), std::move(moved_value));
+            reference.insert_or_assign(key, value);
+            CHECK(inserted == !present);
+            CHECK(it->first == key && it->second == value);
+            break;
+        }
+        case 3: {
+            auto [it, inserted] = container.upsert(std::move(moved_key), value, append);
+            auto expected = reference.try_emplace(key, value);
+            if (!expected.second) {
+                append(expected.first->second, value);
+            }
+            CHECK(inserted == !present);
+            CHECK(it->first == key && it->second == expected.first->second);
+            CHECK(!present || moved_key == key);
+            break;
+        }
+        case 4:
+            container[key] += "a";
+            reference[key] += "a";
+            break;
+        default:
+            CHECK(container[std::move(moved_key)] == reference[key]);
+            CHECK(!present || moved_key == key);
+            break;
+        }
+
+        if (step % 500 == 0) {
+            expect_same(container, reference);
+        }
+    }
+    expect_same(container, reference);
+}
+
+// Mapped value that counts how often one was constructed
+struct Tracked
+{
+    static size_t constructed;
+
+    Tracked(int v) :
+        value(v)
+    { ++constructed; }
+
+    Tracked(const Tracked& other) :
+        value(other.value)
+    { ++constructed; }
+
+    Tracked(Tracked&& other) :
+        value(other.value)
+    { ++constructed; }
+
+    Tracked& operator=(const Tracked&) = default;
+
+    bool operator==(int v) const
+    { return value == v; }
+
+    int value;
+};
+
+size_t Tracked::constructed = 0;
+
+// Every form of emplace finds the key among its arguments, or builds it alone, before it constructs
+// the element: a present key constructs no mapped value, a missing one exactly one, in its node.
+// Growing a slab moves every element, so contiguous layouts get room for all of them first.
+template <typename Layout>
+void test_emplace_forms(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    Map<int, Tracked, std::allocator<Pair<const int, Tracked>>, Layout> container;
+    std::map<int, int> reference;
+    container.reserve(1000);
+    for (int step = 0; step < 3000; ++step) {
+        const int key = static_cast<int>(rng() % 1000);
+        const bool present = reference.count(key) != 0;
+        Tracked::constructed = 0;
+
+        bool inserted = false;
+        switch (rng() % 5) {
+        case 0:
+            inserted = container.emplace(key, step).second;
+            break;
+        case 1:
+            inserted = container.emplace(static_cast<short>(key), step).second;
+            break;
+        case 2:
+            inserted = container.emplace(PiecewiseConstructT(), std::forward_as_tuple(key), std::forward_as_tuple(step)).second;
+            break;
+        case 3:
+            inserted = container.emplace_hint(container.lower_bound(key), key, step).second;
+            break;
+        default:
+            inserted = container.try_emplace(key, step).second;
+            break;
+        }
+        reference.emplace(key, step);
+
+        CHECK(inserted == !present);
+        CHECK(Tracked::constructed == (present ? 0 : 1));
+        CHECK(container.find(key)->second.value == reference[key]);
+    }
+    expect_same(container, reference);
+
+    // Sets build the key from the argument alone, before looking for it
+    Set<std::string, std::allocator<std::string>, Layout> set;
+    std::set<std::string> set_reference;
+    for (int step = 0; step < 1000; ++step) {
+        const char* text = key_text(static_cast<int>(rng() % 300)).c_str();
+        CHECK(set.emplace(text).second == set_reference.emplace(text).second);
+    }
+    expect_same(set, set_reference);
+}
+
+// Keys shorter than the prefix, keys that differ only in trailing zeros and bytes above 0x7f order as
+// std::string does
+template <typename Layout>
+void test_key_prefix_ties(unsigned seed)
+{
+    using Container = Map<std::string, int, std::allocator<Pair<const std::string, int>>, KeyPrefixLayout<Layout>>;
+
+    std::mt19937 rng(seed);
+    Container container;
+    std::map<std::string, int> reference;
+    for (int i = 0; i < 3000; ++i) {
+        const std::string key = random_text(rng, 10);
+        if (rng() % 4 == 0) {
+            CHECK(container.erase(key) == reference.erase(key));
+        } else {
+            CHECK(container.emplace(key, i).second == reference.emplace(key, i).second);
+        }
+    }
+    expect_same(container, reference);
+
+    for (int i = 0; i < 500; ++i) {
+        const std::string key = random_text(rng, 10);
+        CHECK(container.count(key) == reference.count(key));
+        const auto lower = reference.lower_bound(key);
+        auto it = container.lower_bound(key);
+        CHECK((it == container.end()) == (lower == reference.end()));
+        CHECK(it == container.end() || it->first == lower->first);
+    }
+}
+
+// Lookups and erasures by std::string_view and const char* find what std::map finds by them
+template <typename Layout>
+void test_transparent_lookup(unsigned seed)
+{
+    using Container = Map<std::string, int, std::allocator<Pair<const std::string, int>>, Layout, std::less<>>;
+
+    std::mt19937 rng(seed);
+    Container container;
+    std::map<std::string, int, std::less<>> reference;
+    for (int i = 0; i < 1000; ++i) {
+        const int k = static_cast<int>(rng() % 2000);
+        container.emplace(key_text(k), i);
+        reference.emplace(key_text(k), i);
+    }
+
+    for (int i = 0; i < 2000; ++i) {
+        const std::string& text = key_text(static_cast<int>(rng() % 2100));
+        const std::string_view view = text;
+        const char* chars = text.c_str();
+
+        CHECK(container.count(view) == reference.count(view));
+        CHECK(container.count(chars) == reference.count(chars));
+
+        auto found = container.find(view);
+        const auto expected = reference.find(view);
+        CHECK((found == container.end()) == (expected == reference.end()));
+        CHECK(found == container.end() || found->first == expected->first);
+        CHECK(container.find(chars) == found);
+
+        auto lower = container.lower_bound(view);
+        const auto expected_lower = reference.lower_bound(view);
+        CHECK((lower == container.end()) == (expected_lower == reference.end()));
+        CHECK(lower == container.end() || lower->first == expected_lower->first);
+        CHECK(container.lower_bound(chars) == lower);
+
+        auto upper = container.upper_bound(view);
+        const auto expected_upper = reference.upper_bound(view);
+        CHECK((upper == container.end()) == (expected_upper == reference.end()));
+        CHECK(upper == container.end() || upper->first == expected_upper->first);
+        CHECK(container.upper_bound(chars) == upper);
+
+        if (i % 3 == 0) {
+            CHECK(container.erase(view) == reference.erase(text));
+        } else if (i % 3 == 1) {
+            CHECK(container.erase(chars) == reference.erase(text));
+        }
+    }
+    expect_same(container, reference);
+
+    Set<std::string, std::allocator<std::string>, Layout, std::less<>> set;
+    std::set<std::string, std::less<>> set_reference;
+    for (int i = 0; i < 100; ++i) {
+        set.insert(key_text(i));
+        set_reference.insert(key_text(i));
+    }
+    for (int i = 0; i < 120; i += 3) {
+        const std::string_view view = key_text(i);
+        CHECK(set.count(key_text(i + 1).c_str()) == set_reference.count(key_text(i + 1).c_str()));
+        CHECK(set.erase(view) == set_reference.erase(key_text(i)));
+    }
+    expect_same(set, set_reference);
+}
+
+// An object that links itself into an IntrusiveMap
+template <typename Layout>
+struct HookedItem :
+    IntrusiveMapHook<HookedItem<Layout>, Layout>
+{
+    int key = 0;
+    int index = 0;
+};
+
+struct HookedItemKey
+{
+    template <typename Item>
+    const int& operator()(const Item& item) const
+    { return item.key; }
+};
+
+template <typename Item>
+bool unlinked(const Item& item)
+{
+    return item.parent() == nullptr && item.left_child() == nullptr && item.right_child() == nullptr &&
+           item.is_red();
+}
+
+// The reference maps each key to the index of the linked item
+template <typename Map, typename Item>
+void expect_linked(Map& map, const std::deque<Item>& items, const std::map<int, size_t>& reference)
+{
+    CHECK(map.size() == reference.size());
+    CHECK(map.empty() == reference.empty());
+
+    auto it = map.begin();
+    for (const auto& [key, index] : reference) {
+        CHECK(it != map.end());
+        CHECK(&*it == &items[index]);
+        CHECK(it->key == key);
+        ++it;
+    }
+    CHECK(it == map.end());
+
+    for (auto expected = reference.rbegin(); expected != reference.rend(); ++expected) {
+        --it;
+        CHECK(&*it == &items[expected->second]);
+    }
+}
+
+// Objects are linked and unlinked through each overload as std::map inserts and erases their keys
+template <typename Layout>
+void test_intrusive_map(unsigned seed)
+{
+    using Item = HookedItem<Layout>;
+    using ItemMap = IntrusiveMap<int, Item, HookedItemKey>;
+
+    std::mt19937 rng(seed);
+    std::deque<Item> items(3000);
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i].key = static_cast<int>(rng() % 1000);
+        items[i].index = static_cast<int>(i);
+        CHECK(unlinked(items[i]));
+    }
+
+    std::map<int, size_t> reference;
+    ItemMap map;
+    for (size_t i = 0; i < items.size(); ++i) {
+        auto [it, inserted] = map.insert(items[i]);
+        const auto expected = reference.emplace(items[i].key, i);
+        CHECK(inserted == expected.second);
+        CHECK(&*it == &items[expected.first->second]);
+        if (!inserted) {
+            CHECK(unlinked(items[i]));
+        }
+    }
+    expect_linked(map, items, reference);
+
+    for (int i = 0; i < 1500; ++i) {
+        const int key = static_cast<int>(rng() % 1000);
+        const auto expected = reference.find(key);
+        CHECK(map.count(key) == reference.count(key));
+        const auto lower = reference.lower_bound(key);
+        CHECK(map.lower_bound(key) == ((lower != reference.end()) ? map.iterator_to(items[lower->second]) : map.end()));
+        const auto upper = reference.upper_bound(key);
+        CHECK(map.upper_bound(key) == ((upper != reference.end()) ? map.iterator_to(items[upper->second]) : map.end()));
+
+        if (expected == reference.end()) {
+            CHECK(map.find(key) == map.end());
+            CHECK(map.erase(key) == 0);
+            continue;
+        }
+
+        Item& item = items[expected->second];
+        CHECK(&*map.find(key) == &item);
+        const auto next = std::next(expected);
+        const auto expected_next = (next != reference.end()) ? map.iterator_to(items[next->second]) : map.end();
+        switch (i % 3) {
+            case 0:
+                CHECK(map.erase(item) == expected_next);
+                break;
+            case 1:
+                CHECK(map.erase(map.find(key)) == expected_next);
+                break;
+            default:
+                CHECK(map.erase(key) == 1);
+                break;
+        }
+        reference.erase(expected);
+        CHECK(unlinked(item));
+        CHECK(map.find(key) == map.end());
+    }
+    expect_linked(map, items, reference);
+
+    // Erased objects can be linked again
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (unlinked(items[i]) && reference.emplace(items[i].key, i).second) {
+            CHECK(map.insert(items[i]).second);
+        }
+    }
+    expect_linked(map, items, reference);
+
+    // A copy of a linked object starts unlinked, assigning to one keeps its links
+    Item& linked = items[reference.begin()->second];
+    Item copy = linked;
+    CHECK(unlinked(copy));
+    CHECK(copy.key == linked.key && copy.index == linked.index);
+    linked = copy;
+    CHECK(!unlinked(linked));
+    CHECK(map.insert(copy).second == false);
+    expect_linked(map, items, reference);
+
+    // Moving hands the objects over, move assignment unlinks what the target held
+    ItemMap moved(std::move(map));
+    CHECK(map.empty());
+    CHECK(map.begin() == map.end());
+    expect_linked(moved, items, reference);
+
+    std::deque<Item> others(10);
+    ItemMap assigned;
+    for (size_t i = 0; i < others.size(); ++i) {
+        others[i].key = static_cast<int>(i);
+        assigned.insert(others[i]);
+    }
+    assigned = std::move(moved);
+    for (const Item& other : others) {
+        CHECK(unlinked(other));
+    }
+    expect_linked(assigned, items, reference);
+
+    assigned.clear();
+    CHECK(assigned.empty());
+    for (const Item& item : items) {
+        CHECK(unlinked(item));
+    }
+
+    // Going away unlinks whatever is left
+    {
+        ItemMap scoped;
+        size_t inserted = 0;
+        for (Item& item : items) {
+            inserted += scoped.insert(item).second ? 1 : 0;
+        }
+        CHECK(scoped.size() == inserted);
+    }
+    for (const Item& item : items) {
+        CHECK(unlinked(item));
+    }
+}
+
+template <typename Container, typename Reference>
+void test_container(unsigned seeds)
+{
+    for (unsigned seed = 0; seed < seeds; ++seed) {
+        test_insert_erase<Container, Reference>(seed);
+        test_find_many<Container, Reference>(seed);
+        test_finger_search<Container, Reference>(seed);
+        test_filter<Container, Reference>(seed);
+        test_insert_position<Container, Reference>(seed);
+    }
+    test_compact<Container, Reference>(seeds);
+}
+
+// Every layout and allocator, as maps and as sets
+void test_all(unsigned seeds)
+{
+    using IntMap = std::map<int, int>;
+    using StringMap = std::map<std::string, int>;
+    using ViewMap = std::map<std::string_view, int>;
+    using IntPairAllocator = std::allocator<Pair<const int, int>>;
+    using IntPool = PoolAllocator<Pair<const int, int>>;
+
+    test_container<Map<int, int>, IntMap>(seeds);
+    test_container<Map<int, int, IntPairAllocator, PackedColorLayout>, IntMap>(seeds);
+    test_container<Map<int, int, IntPairAllocator, ParentFreeLayout>, IntMap>(seeds);
+    test_container<Map<int, int, IntPairAllocator, IndexLayout>, IntMap>(seeds);
+    test_container<Map<std::string, int, std::allocator<Pair<const std::string, int>>, IndexLayout>, StringMap>(seeds);
+    test_container<Map<int, int, IntPairAllocator, ColdValueLayout<>>, IntMap>(seeds);
+    test_container<Map<int, int, IntPairAllocator, ColdValueLayout<IndexLayout>>, IntMap>(seeds);
+    test_container<Map<std::string, int, std::allocator<Pair<const std::string, int>>, ColdValueLayout<ParentFreeLayout>>, StringMap>(seeds);
+    test_container<Map<int, int, IntPool>, IntMap>(seeds);
+    test_container<Map<int, int, IntPool, PackedColorLayout>, IntMap>(seeds);
+    test_container<Map<int, int, IntPool, ParentFreeLayout>, IntMap>(seeds);
+    test_container<Set<int>, std::set<int>>(seeds);
+    test_container<Set<int, PoolAllocator<int>, PackedColorLayout>, std::set<int>>(seeds);
+    test_container<Set<int, std::allocator<int>, ParentFreeLayout>, std::set<int>>(seeds);
+    test_container<Set<int, std::allocator<int>, IndexLayout>, std::set<int>>(seeds);
+    test_container<Set<std::string, std::allocator<std::string>, IndexLayout>, std::set<std::string>>(seeds);
+    test_container<Map<std::string_view, int, std::allocator<Pair<const std::string_view, int>>, InlineKeyLayout<>>, ViewMap>(seeds);
+    test_container<Map<std::string_view, int, std::allocator<Pair<const std::string_view, int>>, InlineKeyLayout<ParentFreeLayout>>, ViewMap>(seeds);
+    test_container<Set<std::string_view, std::allocator<std::string_view>, InlineKeyLayout<>>, std::set<std::string_view>>(seeds);
+    test_container<Map<std::string, int, std::allocator<Pair<const std::string, int>>, KeyPrefixLayout<>>, StringMap>(seeds);
+    test_container<Map<std::string, int, std::allocator<Pair<const std::string, int>>, KeyPrefixLayout<IndexLayout>>, StringMap>(seeds);
+    test_container<Set<std::string, std::allocator<std::string>, KeyPrefixLayout<>>, std::set<std::string>>(seeds);
+    test_container<IndexedMap<int, int>, IntMap>(seeds);
+    test_container<IndexedMap<std::string, int>, StringMap>(seeds);
+    test_container<IndexedMap<int, int, std::hash<int>, IntPairAllocator, IndexLayout>, IntMap>(seeds);
+    test_reserve_shrink<Map<int, int, IntPool>, IntMap>(seeds);
+    test_reserve_shrink<Set<int, PoolAllocator<int>>, std::set<int>>(seeds);
+    test_slab_reserve_shrink<IndexLayout>(seeds);
+    test_cold_values<ColdValueLayout<>>(seeds);
+    test_cold_values<ColdValueLayout<IndexLayout>>(seeds);
+    test_compact_failure<PlainLayout, int>(seeds);
+    test_compact_failure<PackedColorLayout, int>(seeds);
+    test_compact_failure<ParentFreeLayout, int>(seeds);
+    test_compact_failure<ColdValueLayout<>, std::string>(seeds);
+    test_compact_failure<InlineKeyLayout<>, std::string_view>(seeds);
+    test_inline_keys<PlainLayout>(seeds);
+    test_inline_keys<PackedColorLayout>(seeds);
+    test_key_prefix_ties<PlainLayout>(seeds);
+    test_key_prefix_ties<IndexLayout>(seeds);
+    test_transparent_lookup<PlainLayout>(seeds);
+    test_transparent_lookup<KeyPrefixLayout<>>(seeds);
+    test_indexed_map<PlainLayout>(seeds);
+    test_indexed_map<IndexLayout>(seeds);
+    test_key_value_inserts<PlainLayout>(seeds);
+    test_key_value_inserts<ParentFreeLayout>(seeds);
+    test_key_value_inserts<IndexLayout>(seeds);
+    test_key_value_inserts<ColdValueLayout<>>(seeds);
+    test_key_value_inserts<KeyPrefixLayout<>>(seeds);
+    test_emplace_forms<PlainLayout>(seeds);
+    test_emplace_forms<ParentFreeLayout>(seeds);
+    test_emplace_forms<IndexLayout>(seeds);
+    test_emplace_forms<ColdValueLayout<>>(seeds);
+    test_intrusive_map<PlainLayout>(seeds);
+    test_intrusive_map<PackedColorLayout>(seeds);
+}
+
+} /*namespace*/
+
+int main()
+{
+    test_copy_bounds();
+    test_decrement_end();
+    test_erase_near_red_nephew();
+    test_all(5);
 
-    std::cin.get();
+    std::puts("map_test: ok");
     return 0;
-}*/
\ No newline at end of file
+}